@@ -16,6 +16,7 @@
 #define FPLBASE_ASSET_H
 
 #include <assert.h>
+#include <stddef.h>
 
 namespace fplbase {
 
@@ -25,7 +26,7 @@ class AssetManager;
 /// @brief Base class of all assets that _may_ be managed by Assetmanager.
 class Asset {
  public:
-  Asset() : refcount_(1) {}
+  Asset() : refcount_(1), resident_gpu_bytes_(0), resident_cpu_bytes_(0) {}
   virtual ~Asset() {}
 
   /// @brief indicate there is an additional owner of this asset.
@@ -33,7 +34,8 @@ class Asset {
   /// AssetManager, that will directly delete the asset since they all start
   /// out with a single reference count. Call this function to indicate
   /// multiple owners will call Unload*() independently, and only have the
-  /// asset deleted by the last one.
+  /// asset deleted by the last one. See AssetManager::SetResidencyBudget()
+  /// for keeping unloaded assets around for reuse.
   void IncreaseRefCount() { refcount_++; }
 
  private:
@@ -45,6 +47,9 @@ class Asset {
   };
 
   int refcount_;
+  // Memory AssetManager counted for this asset when it was finalized.
+  size_t resident_gpu_bytes_;
+  size_t resident_cpu_bytes_;
 };
 
 }  // namespace fplbase
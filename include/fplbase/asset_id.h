@@ -0,0 +1,83 @@
+// Copyright 2017 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPLBASE_ASSET_ID_H
+#define FPLBASE_ASSET_ID_H
+
+#include <stdint.h>
+#include <string>
+
+namespace fplbase {
+
+/// @addtogroup fplbase_asset_manager
+/// @{
+
+namespace internal {
+
+static const uint64_t kAssetIdOffsetBasis = 14695981039346656037ULL;
+static const uint64_t kAssetIdPrime = 1099511628211ULL;
+
+// 64-bit FNV-1a, written as a single expression so it can run at compile time.
+constexpr uint64_t HashAssetName(const char *name, uint64_t hash) {
+  return *name ? HashAssetName(name + 1,
+                               (hash ^ static_cast<uint8_t>(*name)) *
+                                   kAssetIdPrime)
+               : hash;
+}
+
+}  // namespace internal
+
+/// @class AssetId
+/// @brief Identifies an asset by a hash of its name.
+///
+/// AssetManager looks assets up by their AssetId, so code that looks up the
+/// same asset often can hash its name once, or at compile time, and skip the
+/// string hashing and comparing on every lookup:
+///
+///     static constexpr AssetId kPlayerTexture =
+///         AssetIdFromName("textures/player.webp");
+///     Texture *texture = asset_manager.FindTexture(kPlayerTexture);
+class AssetId {
+ public:
+  /// @brief An AssetId that matches no asset.
+  constexpr AssetId() : hash_(0) {}
+
+  /// @brief Construct from the value returned by hash().
+  constexpr explicit AssetId(uint64_t hash) : hash_(hash) {}
+
+  /// @brief The hash of the asset's name.
+  constexpr uint64_t hash() const { return hash_; }
+
+  bool operator==(const AssetId &other) const { return hash_ == other.hash_; }
+  bool operator!=(const AssetId &other) const { return hash_ != other.hash_; }
+
+ private:
+  uint64_t hash_;
+};
+
+/// @brief The AssetId of the asset with the given name. Runs at compile time
+/// when `name` is a literal and the result is used as a constant.
+constexpr AssetId AssetIdFromName(const char *name) {
+  return AssetId(internal::HashAssetName(name, internal::kAssetIdOffsetBasis));
+}
+
+/// @brief The AssetId of the asset with the given name.
+inline AssetId AssetIdFromName(const std::string &name) {
+  return AssetIdFromName(name.c_str());
+}
+
+/// @}
+}  // namespace fplbase
+
+#endif  // FPLBASE_ASSET_ID_H
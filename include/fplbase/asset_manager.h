@@ -15,15 +15,31 @@
 #ifndef FPLBASE_ASSET_MANAGER_H
 #define FPLBASE_ASSET_MANAGER_H
 
-#include <map>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "fplbase/config.h"  // Must come first.
 
+#include "fplbase/asset_id.h"
 #include "fplbase/async_loader.h"
 #include "fplbase/fpl_common.h"
+#include "fplbase/internal/asset_table.h"
 #include "fplbase/renderer.h"
 #include "fplbase/texture_atlas.h"
+#include "fplutil/mutex.h"
+
+namespace manifestdef {
+struct AssetLoad;
+}
 
 namespace fplbase {
 
@@ -35,12 +51,143 @@ namespace fplbase {
 /// @brief A generic asset whose contents the AssetManager doesn't care about.
 class FileAsset : public AsyncAsset {
   virtual void Load();
+  // There is nothing to decode, so load entirely in the I/O stage.
+  virtual void Read() { Load(); }
+  virtual void Decode() {}
   virtual bool Finalize();
   virtual bool IsValid();
  public:
+  FileAsset() : valid_(false) {}
   std::string contents;
+
+ private:
+  // Whether the file was read, as of Finalize().
+  bool valid_;
+};
+
+/// @brief The load statistics of a single asset, see
+/// AssetManager::GetLoadStats().
+struct AssetLoadStats {
+  /// @brief The kind of asset: "texture", "mesh", "shader" or "file".
+  const char *type;
+  /// @brief The name the asset was loaded by.
+  std::string name;
+  /// @brief Where the time went while loading it.
+  AsyncLoadStats stats;
 };
 
+/// @brief The 50th, 95th and 99th percentile of a load statistic.
+struct LoadStatPercentiles {
+  LoadStatPercentiles() : p50(0.0), p95(0.0), p99(0.0) {}
+  double p50;
+  double p95;
+  double p99;
+};
+
+/// @brief The load statistics of all assets of one kind, see
+/// AssetManager::GetLoadStatsByType().
+struct AssetTypeLoadStats {
+  /// @brief The kind of asset, as in AssetLoadStats::type.
+  const char *type;
+  /// @brief The number of assets the statistics cover.
+  int count;
+  /// @brief Percentiles of the AsyncLoadStats fields of the same name.
+  LoadStatPercentiles queue_seconds;
+  LoadStatPercentiles read_seconds;
+  LoadStatPercentiles decode_seconds;
+  LoadStatPercentiles finalize_seconds;
+  LoadStatPercentiles bytes_read;
+  LoadStatPercentiles bytes_uploaded;
+};
+
+/// @brief What sharing textures with the same contents saves, see
+/// AssetManager::SetTextureDeduplication().
+struct TextureDeduplicationStats {
+  TextureDeduplicationStats() : shared_textures(0), bytes_saved(0) {}
+  /// @brief The number of textures that share the GPU texture of another one
+  /// with the same contents.
+  int shared_textures;
+  /// @brief The approximate GPU memory those textures would use on their
+  /// own, in bytes.
+  size_t bytes_saved;
+};
+
+/// @brief How far along the loads of an AssetGroup are.
+struct AssetGroupProgress {
+  AssetGroupProgress()
+      : assets_done(0), assets_total(0), bytes_done(0), bytes_total(0) {}
+  /// @brief The number of assets in the group that are finalized.
+  int assets_done;
+  /// @brief The number of assets in the group, as far as its dependencies
+  /// have been found.
+  int assets_total;
+  /// @brief The size of the files of the finalized assets, in bytes.
+  size_t bytes_done;
+  /// @brief The size of the files of all the assets, in bytes. Files whose
+  /// size isn't known without reading them (see FileSize()) count as empty.
+  size_t bytes_total;
+};
+
+/// @class AssetGroup
+/// @brief The assets loaded by AssetManager::LoadAssetList(), including the
+/// ones they depend on.
+///
+/// The totals of progress() grow as dependencies are found, so wait for
+/// IsFinalized() rather than for assets_done to reach assets_total. Use on
+/// the render thread only.
+class AssetGroup {
+ public:
+  /// @brief How far along the loads are.
+  const AssetGroupProgress &progress() const { return progress_; }
+
+  /// @brief Whether all the dependencies have been found, and all the assets
+  /// are finalized. Assets that failed to load count as finalized; check
+  /// their IsValid().
+  bool IsFinalized() const { return finalized_; }
+
+  /// @brief Calls `callback` once the group is finalized, or right away if it
+  /// already is. Callbacks run from AssetManager::TryFinalize().
+  void then(const AsyncAsset::AssetFinalizedCallback &callback);
+
+ private:
+  friend class AssetManager;
+  friend class AssetListScan;
+
+  AssetGroup() : num_pending_scans_(0), finalized_(false) {}
+
+  // Adds `asset`, unless it is in the group already, in which case
+  // `file_size` is counted if the asset's size wasn't known yet.
+  void Add(AsyncAsset *asset, size_t file_size);
+  void OnAssetFinalized(AsyncAsset *asset);
+  // Finalizes the group if nothing is left to find or load.
+  void CheckFinalized();
+  // Returns false if the dependencies of the named asset are already being
+  // found by another scan of the group. Called on the loader threads.
+  bool StartExpanding(const std::string &filename);
+
+  struct Member {
+    size_t file_size;
+    bool done;
+  };
+  std::unordered_map<AsyncAsset *, Member> members_;
+  AssetGroupProgress progress_;
+  // AssetListScans of the group that are yet to be finalized.
+  int num_pending_scans_;
+  bool finalized_;
+  std::vector<AsyncAsset::AssetFinalizedCallback> callbacks_;
+  // Weakly referenced by the finalize callbacks of the members, which may
+  // outlive the group.
+  std::weak_ptr<AssetGroup> self_;
+
+  // Hashes of the names of the assets being expanded, see StartExpanding().
+  fplutil::Mutex expanding_mutex_;
+  std::unordered_set<uint64_t> expanding_;
+};
+
+/// @brief A handle to an AssetGroup. The group is freed with the last handle
+/// to it; its assets stay loaded.
+typedef std::shared_ptr<AssetGroup> AssetGroupHandle;
+
 /// @class AssetManager
 /// @brief Central place to own game assets loaded from disk.
 ///
@@ -50,6 +197,15 @@ class FileAsset : public AsyncAsset {
 ///
 /// Loading assets such as meshes will trigger the load of dependent assets
 /// such as textures.
+///
+/// The Find*() and Load*() functions may be called from any thread. Asking
+/// for an asset that another thread is already loading returns the same
+/// asset rather than loading it twice. Only the render thread, the one that
+/// created the AssetManager, talks to OpenGL: on other threads Load*() always
+/// queues the asset for async loading, as if asked to, and it gets finalized
+/// by TryFinalize() on the render thread. Everything else, including
+/// Unload*(), TryFinalize() and ClearAllAssets(), must be called on the
+/// render thread.
 class AssetManager {
  public:
   /// @brief AssetManager constructor.
@@ -71,6 +227,12 @@ class AssetManager {
   /// @return Returns the shader, or nullptr if not previously loaded.
   Shader *FindShader(const char *basename);
 
+  /// @brief Returns a previously loaded shader, without hashing its name.
+  ///
+  /// @param id The AssetId of the shader's name. See AssetIdFromName().
+  /// @return Returns the shader, or nullptr if not previously loaded.
+  Shader *FindShader(AssetId id);
+
   /// @brief Loads and returns a shader object.
   ///
   /// Loads a shader if it hasn't been loaded already, by appending .glslv
@@ -79,9 +241,12 @@ class AssetManager {
   ///
   /// @param basename The name of the shader.
   /// @param async A boolean to indicate whether to load asynchronously or not.
+  /// @param priority If async, how urgently the shader is needed. See
+  /// AsyncLoadPriority.
   /// @return Returns the loaded shader, or nullptr if there was an error.
   Shader *LoadShader(const char *basename, bool async = false,
-                     const char *alias = nullptr);
+                     const char *alias = nullptr,
+                     int priority = kLoadPriorityNormal);
 
   /// @brief Loads and returns a shader object with pre-defined identifiers.
   ///
@@ -90,6 +255,8 @@ class AssetManager {
   /// @param basename The name of the shader.
   /// @param defines A vector of defines.
   /// @param async A boolean to indicate whether to load asynchronously or not.
+  /// @param priority If async, how urgently the shader is needed. See
+  /// AsyncLoadPriority.
   /// @note An example of how to call this function:
   ///       const std::vector<std::string> defines[] = {
   ///         USE_SHADOWS,
@@ -101,16 +268,23 @@ class AssetManager {
   /// @return Returns the loaded shader, or nullptr if there was an error.
   Shader *LoadShader(const char *basename,
                      const std::vector<std::string> &defines,
-                     bool async = false, const char *alias = nullptr);
+                     bool async = false, const char *alias = nullptr,
+                     int priority = kLoadPriorityNormal);
 
   /// @brief Load a shader built by shader_pipeline.
   ///
   /// Loads a shader built by the shader_pipeline if it hasn't been loaded.
   /// already.  If this returns nullptr, the error can be found in
-  /// Renderer::last_error().
+  /// Renderer::last_error(). Like LoadShader(), the shader is queued if
+  /// `async` is set or this is called off the render thread.
   /// @param filename Name of the shader file to load.
-  /// @return Returns the loaded shader, or nullptr if there was an error.
-  Shader *LoadShaderDef(const char *filename);
+  /// @param async A boolean to indicate whether to load asynchronously or not.
+  /// @param priority If async, how urgently the shader is needed. See
+  /// AsyncLoadPriority.
+  /// @return Returns the loaded shader, or nullptr if there was an error. If
+  /// async, the shader isn't usable until it is finalized.
+  Shader *LoadShaderDef(const char *filename, bool async = false,
+                        int priority = kLoadPriorityNormal);
 
   /// @brief Deletes the previously loaded shader.
   ///
@@ -128,6 +302,12 @@ class AssetManager {
   /// @return Returns the texture, or nullptr if not previously loaded.
   Texture *FindTexture(const char *filename);
 
+  /// @brief Returns a previously loaded texture, without hashing its name.
+  ///
+  /// @param id The AssetId of the texture's name. See AssetIdFromName().
+  /// @return Returns the texture, or nullptr if not previously loaded.
+  Texture *FindTexture(AssetId id);
+
   /// @brief Queue loading a texture if it hasn't been loaded already.
   ///
   /// If async, queues a texture for loading if it hasn't been loaded already,
@@ -136,14 +316,42 @@ class AssetManager {
   /// If async, the returned texture isn't usable until TryFinalize() succeeds
   /// and the id is non-zero.
   ///
+  /// If the texture is still queued, asking for it again with a higher
+  /// priority moves it up the queue.
+  ///
   /// @param filename The name of the texture to load.
   /// @param format The texture format, defaults to kFormatAuto.
   /// @param flags The texture flags, by default loads textures async.
+  /// @param priority If async, how urgently the texture is needed. See
+  /// AsyncLoadPriority.
   /// @return Returns an unloaded texture object. If not async, may also
   ///         return null to signal and error.
   Texture *LoadTexture(const char *filename, TextureFormat format = kFormatAuto,
                        TextureFlags flags = kTextureFlagsUseMipMaps |
-                                            kTextureFlagsLoadAsync);
+                                            kTextureFlagsLoadAsync,
+                       int priority = kLoadPriorityNormal);
+
+  /// @brief Loads a texture asynchronously, and returns a handle to it.
+  ///
+  /// Works like LoadTexture() with kTextureFlagsLoadAsync set. Use the handle
+  /// to chain work onto the texture with AsyncHandle::then(), or to block on
+  /// it with AsyncHandle::wait(), instead of polling IsFinalized().
+  ///
+  /// @param filename The name of the texture to load.
+  /// @param format The texture format, defaults to kFormatAuto.
+  /// @param flags The texture flags. kTextureFlagsLoadAsync is always added.
+  /// @param priority How urgently the texture is needed. See
+  /// AsyncLoadPriority.
+  /// @return Returns a handle to the texture.
+  AsyncHandle<Texture> LoadTextureAsync(
+      const char *filename, TextureFormat format = kFormatAuto,
+      TextureFlags flags = kTextureFlagsUseMipMaps,
+      int priority = kLoadPriorityNormal) {
+    return AsyncHandle<Texture>(
+        LoadTexture(filename, format, flags | kTextureFlagsLoadAsync,
+                    priority),
+        &loader_);
+  }
 
   /// @brief Start loading all previously queued textures.
   ///
@@ -151,6 +359,55 @@ class AssetManager {
   /// loading of all files, and decompression.
   void StartLoadingTextures();
 
+  /// @brief Set the number of threads that decode queued assets.
+  ///
+  /// Must be called before StartLoadingTextures(), or while loading is
+  /// stopped.
+  ///
+  /// @param num_threads The number of decode threads. Values less than 1
+  /// select the default, which is one less than the number of CPU cores.
+  void SetNumLoadingThreads(int num_threads) {
+    loader_.SetNumWorkerThreads(num_threads);
+  }
+
+  /// @brief Set the number of threads that read the files of queued assets,
+  /// i.e. how many files are read at the same time.
+  ///
+  /// Must be called before StartLoadingTextures(), or while loading is
+  /// stopped.
+  ///
+  /// @param num_threads The number of I/O threads. Values less than 1 select
+  /// kDefaultNumIOThreads.
+  void SetNumIOThreads(int num_threads) {
+    loader_.SetNumIOThreads(num_threads);
+  }
+
+  /// @brief Read the files of queued assets with `reader`, which keeps many
+  /// reads in flight rather than one per I/O thread.
+  ///
+  /// Must be called before StartLoadingTextures(), or while loading is
+  /// stopped. See AsyncLoader::SetBatchFileReader().
+  ///
+  /// @param reader A started reader, which must outlive the AssetManager, or
+  /// nullptr to read files on the I/O threads.
+  void SetBatchFileReader(BatchFileReader *reader) {
+    loader_.SetBatchFileReader(reader);
+  }
+
+  /// @brief Change the priority and deadline of a queued asset.
+  ///
+  /// Use this when an asset that was queued for the background is suddenly
+  /// needed. Does nothing if the asset is already loading or loaded.
+  ///
+  /// @param asset The asset returned by one of the Load*() functions.
+  /// @param priority The new priority. See AsyncLoadPriority.
+  /// @param deadline Seconds from now by which the asset should be loaded, or
+  /// kNoLoadDeadline.
+  void PrioritizeLoad(AsyncAsset *asset, int priority,
+                      double deadline = kNoLoadDeadline) {
+    loader_.PrioritizeJob(asset, priority, deadline);
+  }
+
   /// @brief Stop loading previously queued textures.
   ///
   /// This method will block until the currently loading textures have finished
@@ -168,6 +425,176 @@ class AssetManager {
   /// @return Returns true when all resources have been loaded & finalized.
   bool TryFinalize();
 
+  /// @brief Check for the status of async loading resources, within a budget.
+  ///
+  /// Works like TryFinalize(), but stops turning loaded resources into OpenGL
+  /// resources once either budget is used up. The rest is left for the next
+  /// call, which avoids frame hitches when many resources finish loading at
+  /// once.
+  ///
+  /// @param max_seconds The time to spend per call, or 0 for no limit.
+  /// @param max_bytes The amount of data to upload per call, or 0 for no
+  /// limit.
+  /// @return Returns true when all resources have been loaded & finalized.
+  bool TryFinalize(double max_seconds, size_t max_bytes = 0);
+
+  /// @brief The number of loaded resources still waiting for TryFinalize().
+  int NumPendingFinalizes() { return loader_.NumPendingFinalizes(); }
+
+  /// @brief The amount of data the resources waiting for TryFinalize() will
+  /// upload, in bytes.
+  size_t PendingFinalizeBytes() { return loader_.PendingFinalizeBytes(); }
+
+  /// @brief Limit how much decoded data may wait for TryFinalize().
+  ///
+  /// Keeps a large batch of textures from holding all of their decoded pixels
+  /// in memory at once: loading pauses until TryFinalize() catches up. See
+  /// AsyncLoader::SetMaxDecodedBytes().
+  ///
+  /// @param max_bytes The limit in bytes, or 0 for no limit.
+  void SetMaxDecodedBytes(size_t max_bytes) {
+    loader_.SetMaxDecodedBytes(max_bytes);
+  }
+
+  /// @brief The amount of decoded data that has not been finalized yet, in
+  /// bytes.
+  size_t DecodedBytes() const { return loader_.DecodedBytes(); }
+
+  /// @brief Keep unloaded textures and meshes in memory, up to a budget.
+  ///
+  /// By default UnloadTexture() and UnloadMesh() delete the asset once its
+  /// reference count drops to zero. With a budget, the asset stays loaded
+  /// instead, so that asking for it again with Load*() or Find*() is free.
+  /// Once the textures and meshes use more memory than the budget, the ones
+  /// that were unloaded the longest ago are deleted, until they fit or no
+  /// unloaded ones are left. Asking for one of those again loads it anew,
+  /// asynchronously if requested so.
+  ///
+  /// Pick a budget per device, so the same set of assets runs on devices
+  /// with little and lots of memory.
+  ///
+  /// @param max_bytes The budget for the GPU and CPU memory of all textures
+  /// and meshes, see ResidentGpuBytes() and ResidentCpuBytes(). 0 turns off
+  /// keeping unloaded assets, and deletes the ones that were kept.
+  void SetResidencyBudget(size_t max_bytes);
+
+  /// @brief The budget set by SetResidencyBudget().
+  size_t residency_budget() const { return residency_budget_; }
+
+  /// @brief The approximate GPU memory used by all finalized textures and
+  /// meshes, including unloaded ones kept for the residency budget.
+  size_t ResidentGpuBytes() const { return resident_gpu_bytes_; }
+
+  /// @brief The approximate CPU memory used by all finalized textures and
+  /// meshes, including unloaded ones kept for the residency budget.
+  size_t ResidentCpuBytes() const { return resident_cpu_bytes_; }
+
+  /// @brief Share the GPU texture of textures whose files have the same
+  /// contents.
+  ///
+  /// When on, LoadTexture() hashes the file of each texture it loads as the
+  /// file is read. If a finalized texture with the same contents, format,
+  /// flags and scale is already loaded under another name, the new texture
+  /// shares its GPU texture instead of being decoded and uploaded again. The
+  /// shared texture stays loaded until the textures sharing it are unloaded.
+  /// Handy when the same image is copied to several paths.
+  ///
+  /// Only affects textures loaded after the call.
+  ///
+  /// @param enabled Whether to share textures with the same contents.
+  void SetTextureDeduplication(bool enabled);
+
+  /// @brief The memory saved by SetTextureDeduplication().
+  TextureDeduplicationStats GetTextureDeduplicationStats() const;
+
+  /// @brief Get the load statistics of every texture, mesh, shader and file
+  /// that has finished loading.
+  ///
+  /// @param stats Receives one entry per asset, sorted by type and name.
+  void GetLoadStats(std::vector<AssetLoadStats> *stats) const;
+
+  /// @brief Get percentiles of the load statistics of each kind of asset.
+  ///
+  /// @param stats Receives one entry per kind of asset that has finished
+  /// loading.
+  void GetLoadStatsByType(std::vector<AssetTypeLoadStats> *stats) const;
+
+  /// @brief The results of GetLoadStatsByType() and GetLoadStats() as JSON.
+  ///
+  /// The object has a "types" array and an "assets" array, with fields named
+  /// like the members of AssetTypeLoadStats and AssetLoadStats, and a
+  /// "texture_deduplication" object like TextureDeduplicationStats. Handy for
+  /// comparing load times between builds.
+  std::string LoadStatsToJson() const;
+
+  /// @brief Start recording which textures, meshes, materials and shaders
+  /// are loaded, in order, to save with SaveLoadManifest().
+  ///
+  /// Records every asset the first time it is asked for, whether it was
+  /// already loaded or not, so that the order matches the order the game
+  /// needs them in. Shaders loaded with an alias are not recorded. Clears any
+  /// previous recording.
+  void StartRecordingLoads();
+
+  /// @brief Stop recording loads. The recording is kept for
+  /// SaveLoadManifest().
+  void StopRecordingLoads();
+
+  /// @brief Save the loads recorded since StartRecordingLoads() to a load
+  /// manifest, for PrefetchLoadManifest() to replay on later runs.
+  ///
+  /// @param filename The file to write, conventionally with the extension
+  /// "fplmanifest".
+  /// @return Returns false if the file could not be written.
+  bool SaveLoadManifest(const char *filename) const;
+
+  /// @brief Queue every asset in a load manifest for async loading.
+  ///
+  /// Call at startup, before StartLoadingTextures(), so that assets the game
+  /// is going to ask for are already loading, or loaded, when it does. The
+  /// assets are queued at kLoadPriorityLow, in the order they were recorded;
+  /// asking for one through Load*() with a higher priority moves it up the
+  /// queue. Assets that are already loaded, and assets whose files no longer
+  /// exist, are skipped. Manifests recorded by a different version of
+  /// AssetManager are ignored.
+  ///
+  /// @param filename The manifest written by SaveLoadManifest().
+  /// @return Returns the number of assets queued. Returns 0 if the manifest
+  /// doesn't exist or can't be used.
+  int PrefetchLoadManifest(const char *filename);
+
+  /// @brief Load every asset in a list, and the assets they depend on,
+  /// asynchronously, as one group.
+  ///
+  /// The list is a load manifest, as written by SaveLoadManifest(), or
+  /// compiled by flatc from JSON with schemas/load_manifest.fbs, in which case
+  /// the version may be left out. All the listed assets are queued right
+  /// away. Meanwhile the loader threads read the mesh and material files in
+  /// the list to find the materials and textures they use, and queue those
+  /// too, rather than each being found only once the asset that uses it is
+  /// finalized. Assets that are listed, or used, more than once are loaded
+  /// once.
+  ///
+  /// Call on the render thread, then keep calling TryFinalize(). Unloading
+  /// an asset of the group before it is finalized keeps the group from
+  /// finalizing.
+  ///
+  /// @param filename The list.
+  /// @param priority How urgently the assets are needed. See
+  /// AsyncLoadPriority.
+  /// @return Returns a handle to the group, or null if the list can't be read.
+  AssetGroupHandle LoadAssetList(const char *filename,
+                                 int priority = kLoadPriorityNormal);
+
+  /// @brief Works like LoadAssetList() above, with a list in memory.
+  ///
+  /// @param data The load manifest. Only used during the call.
+  /// @param size The size of `data`, in bytes.
+  /// @param priority How urgently the assets are needed.
+  /// @return Returns a handle to the group, or null if the list isn't valid.
+  AssetGroupHandle LoadAssetList(const uint8_t *data, size_t size,
+                                 int priority = kLoadPriorityNormal);
+
   /// @brief Deletes the previously loaded texture.
   ///
   /// Deletes the texture and removes it from the material manager. Any
@@ -184,16 +611,33 @@ class AssetManager {
   /// @return Returns the material, or nullptr if not previously loaded.
   Material *FindMaterial(const char *filename);
 
+  /// @brief Returns a previously loaded material, without hashing its name.
+  ///
+  /// @param id The AssetId of the material's name. See AssetIdFromName().
+  /// @return Returns the material, or nullptr if not previously loaded.
+  Material *FindMaterial(AssetId id);
+
   /// @brief Loads and returns a material object.
   ///
   /// Loads a material, which is a compiled FlatBuffer file with
   /// root Material. This loads all resources contained there-in.
-  /// Optionally, you can Q up any contained resources for async loading.
+  /// Optionally, you can Q up any contained resources for async loading, or
+  /// the material file itself too. The material is finalized once its
+  /// textures are.
   /// If this returns nullptr, the error can be found in Renderer::last_error().
   ///
   /// @param filename The name of the material.
+  /// @param async_resources Whether to load the textures asynchronously.
+  /// @param async Whether to load the material file asynchronously too. Its
+  /// textures are then always loaded asynchronously.
+  /// @param priority If async, how urgently the material and its textures
+  /// are needed. See AsyncLoadPriority.
   /// @return Returns the loaded material, or nullptr if there was an error.
-  Material *LoadMaterial(const char *filename, bool async_resources = false);
+  /// If async, returns a material that has no textures until the file is
+  /// loaded; check IsValid() once it is finalized.
+  Material *LoadMaterial(const char *filename, bool async_resources = false,
+                         bool async = false,
+                         int priority = kLoadPriorityNormal);
 
   /// @brief Deletes the previously loaded material.
   ///
@@ -211,14 +655,38 @@ class AssetManager {
   /// @return Returns the mesh, or nullptr if not previously loaded.
   Mesh *FindMesh(const char *filename);
 
+  /// @brief Returns a previously loaded mesh, without hashing its name.
+  ///
+  /// @param id The AssetId of the mesh's name. See AssetIdFromName().
+  /// @return Returns the mesh, or nullptr if not previously loaded.
+  Mesh *FindMesh(AssetId id);
+
   /// @brief Loads and returns a mesh object.
   ///
   /// Loads a mesh, which is a compiled FlatBuffer file with root Mesh.
   /// If this returns nullptr, the error can be found in Renderer::last_error().
   ///
   /// @param filename The name of the mesh.
+  /// @param async A boolean to indicate whether to load asynchronously or not.
+  /// @param priority If async, how urgently the mesh and its textures are
+  /// needed. See AsyncLoadPriority.
   /// @return
-  Mesh *LoadMesh(const char *filename, bool async = false);
+  Mesh *LoadMesh(const char *filename, bool async = false,
+                 int priority = kLoadPriorityNormal);
+
+  /// @brief Loads a mesh asynchronously, and returns a handle to it.
+  ///
+  /// Works like LoadMesh() with `async` set. The handle is ready once the
+  /// mesh itself is finalized; its textures may still be loading.
+  ///
+  /// @param filename The name of the mesh.
+  /// @param priority How urgently the mesh and its textures are needed. See
+  /// AsyncLoadPriority.
+  /// @return Returns a handle to the mesh.
+  AsyncHandle<Mesh> LoadMeshAsync(const char *filename,
+                                  int priority = kLoadPriorityNormal) {
+    return AsyncHandle<Mesh>(LoadMesh(filename, true, priority), &loader_);
+  }
 
   /// @brief Deletes the previously loaded mesh.
   ///
@@ -236,6 +704,12 @@ class AssetManager {
   /// @return Pointer to the texture atlas if found, nullptr otherwise.
   TextureAtlas *FindTextureAtlas(const char *filename);
 
+  /// @brief Returns a previously loaded texture atlas, without hashing its name.
+  ///
+  /// @param id The AssetId of the texture atlas's name. See AssetIdFromName().
+  /// @return Returns the texture atlas, or nullptr if not previously loaded.
+  TextureAtlas *FindTextureAtlas(AssetId id);
+
   /// @brief Loads a texture atlas.
   ///
   /// Loads a texture atlas, which is a compiled FlatBuffer file containing a
@@ -244,13 +718,20 @@ class AssetManager {
   /// @param filename Name of the texture atlas file to load.
   /// @param format The texture format, defaults to kFormatAuto.
   /// @param flags Texture flags: by default load async.
+  /// @param async Whether to load the atlas file asynchronously. The atlas
+  /// is finalized once its texture is.
+  /// @param priority If async, how urgently the atlas and its texture are
+  /// needed. See AsyncLoadPriority.
   ///
   /// @return If this returns nullptr, the error can be found in
-  /// Renderer::last_error().
+  /// Renderer::last_error(). If async, the atlas has no bounds until it is
+  /// finalized; check IsValid() then.
   TextureAtlas *LoadTextureAtlas(const char *filename,
                                  TextureFormat format = kFormatAuto,
                                  TextureFlags flags = kTextureFlagsUseMipMaps |
-                                                      kTextureFlagsLoadAsync);
+                                                      kTextureFlagsLoadAsync,
+                                 bool async = false,
+                                 int priority = kLoadPriorityNormal);
 
   /// @brief Delete a texture atlas and remove it from the asset manager.
   ///
@@ -267,10 +748,22 @@ class AssetManager {
   /// @return Pointer to the file asset if found, nullptr otherwise.
   FileAsset *FindFileAsset(const char *filename);
 
+  /// @brief Returns a previously loaded file asset, without hashing its name.
+  ///
+  /// @param id The AssetId of the file asset's name. See AssetIdFromName().
+  /// @return Returns the file asset, or nullptr if not previously loaded.
+  FileAsset *FindFileAsset(AssetId id);
+
   /// @brief Loads a file asset.
   ///
-  /// @return nullptr on error.
-  FileAsset *LoadFileAsset(const char *filename);
+  /// @param filename The name of the file.
+  /// @param async Whether to read the file asynchronously.
+  /// @param priority If async, how urgently the file is needed. See
+  /// AsyncLoadPriority.
+  /// @return nullptr on error. If async, the contents are empty until the
+  /// asset is finalized; check IsValid() then.
+  FileAsset *LoadFileAsset(const char *filename, bool async = false,
+                           int priority = kLoadPriorityNormal);
 
   /// @brief Delete a file asset and remove it from the asset manager.
   ///
@@ -313,39 +806,233 @@ class AssetManager {
                                const std::function<void(Shader *)> &func);
 
  private:
+  // These load like their public counterparts, without recording the load.
   Shader *LoadShaderHelper(const char *basename,
                            const std::vector<std::string> &local_defines,
-                           const char *alias, bool async);
+                           const char *alias, bool async, int priority);
+  Texture *LoadTextureHelper(const char *filename, TextureFormat format,
+                             TextureFlags flags, int priority);
+  Material *LoadMaterialHelper(const char *filename, bool async_resources,
+                               bool async, int priority);
+  Mesh *LoadMeshHelper(const char *filename, bool async, int priority);
   FPL_DISALLOW_COPY_AND_ASSIGN(AssetManager);
 
   // This implements the mechanism for each asset to be both loadable
   // sync or async.
-  // It gets passed a blank asset that we take ownership of, and the map it
-  // should go into if all succeeds.
+  // It gets passed a blank asset that was just added to its map, outside of
+  // the map's lock.
   template <typename T>
-  T *LoadOrQueue(T *asset, std::map<std::string, T *> &asset_map, bool async,
-                 const char *alias) {
-    asset_map[alias != nullptr ? alias : asset->filename()] = asset;
-    if (async) {
-      loader_.QueueJob(asset);
+  T *LoadOrQueue(T *asset, bool async, int priority) {
+    // Finalizing talks to OpenGL, so other threads leave it to TryFinalize().
+    if (async || !OnRenderThread()) {
+      loader_.QueueJob(asset, priority);
     } else {
       asset->LoadNow();
     }
     return asset;
   }
 
+  // Like LoadOrQueue(), for the assets that are only added to their map once
+  // loaded, when loaded synchronously, so that a failed load returns null.
+  // Returns the asset named `name` in `map`, or adds the one `create()`
+  // returns.
+  //
+  // The map's lock isn't held while loading, so other lookups don't wait on
+  // the file system. Instead, the name is marked as loading, and other
+  // threads that ask for it wait for that one load.
+  template <typename T, typename F>
+  T *FindOrLoad(fplutil::Mutex &mutex, AssetTable<T *> &map, const char *name,
+                bool async, int priority, F create) {
+    const bool queue = async || !OnRenderThread();
+    const SyncLoad sync_load(&map, name);
+    T *asset;
+    bool found;
+    for (;;) {
+      bool loading = false;
+      {
+        fplutil::MutexLock lock(mutex);
+        asset = map.Find(name);
+        found = asset != nullptr;
+        // Only the render thread loads synchronously, so if it asks for a
+        // name it is loading, waiting would never end.
+        if (!found && !OnRenderThread()) loading = IsSyncLoading(sync_load);
+        if (!found && !loading) {
+          asset = create();
+          if (queue) {
+            map.Insert(name, asset);
+          } else {
+            StartSyncLoad(sync_load);
+          }
+        }
+      }
+      if (!loading) break;
+      WaitForSyncLoad(sync_load);
+    }
+
+    if (found) {
+      RaisePriority(asset, priority);
+    } else if (queue) {
+      loader_.QueueJob(asset, priority);
+    } else {
+      const bool ok = asset->LoadNow();
+      {
+        fplutil::MutexLock lock(mutex);
+        if (ok) map.Insert(name, asset);
+        FinishSyncLoad(sync_load);
+      }
+      if (!ok) {
+        delete asset;
+        return nullptr;
+      }
+    }
+    return asset;
+  }
+
+  // A map and a name in it that FindOrLoad() is loading synchronously.
+  typedef std::pair<const void *, std::string> SyncLoad;
+  bool IsSyncLoading(const SyncLoad &sync_load);
+  void StartSyncLoad(const SyncLoad &sync_load);
+  void FinishSyncLoad(const SyncLoad &sync_load);
+  void WaitForSyncLoad(const SyncLoad &sync_load);
+
+  bool OnRenderThread() const {
+    return std::this_thread::get_id() == render_thread_;
+  }
+
+  friend class AssetListScan;
+
+  // A load recorded for, or read from, a load manifest.
+  struct RecordedLoad {
+    int type;  // manifestdef::AssetType
+    std::string filename;
+    int format;
+    int flags;
+    std::vector<std::string> defines;
+  };
+  void RecordLoad(int type, const std::string &filename, int format = 0,
+                  int flags = 0,
+                  const std::vector<std::string> *defines = nullptr);
+  static RecordedLoad ReadListedLoad(const manifestdef::AssetLoad &load);
+  // Loads an asset listed in a load manifest asynchronously. Returns null for
+  // kinds of assets this AssetManager doesn't know how to load. Only adds the
+  // load to the recorded manifest if `record` is set.
+  AsyncAsset *LoadListedAsset(const RecordedLoad &load, int priority,
+                              bool record = true);
+  // Deletes the AssetListScans the loader is done with.
+  void DeleteFinishedScans();
+
+  // An unloaded texture or mesh, kept for the residency budget.
+  struct ReleasedAsset {
+    AsyncAsset *asset;
+    bool is_mesh;
+  };
+
+  // Takes back an asset that was asked for after being unloaded. The
+  // residency functions below must be called while holding resident_mutex_,
+  // except for EnforceResidencyBudget(), which takes it.
+  template <typename T>
+  T *Revive(T *asset) {
+    if (asset && asset->refcount_ == 0) ReviveReleased(asset);
+    return asset;
+  }
+  void ReviveReleased(AsyncAsset *asset);
+  // Counts the memory of a texture or mesh once it is finalized.
+  void TrackResidency(AsyncAsset *asset);
+  // Stops counting an asset that is about to be deleted.
+  void ForgetResidency(AsyncAsset *asset);
+  // Handles an asset whose reference count dropped to zero. Returns true if
+  // the caller should delete it, or false if it is kept.
+  bool ReleaseAsset(AsyncAsset *asset, bool is_mesh);
+  // Deletes unloaded assets until the resident ones fit the budget. Does
+  // nothing off the render thread.
+  void EnforceResidencyBudget();
+  // Unloads a texture or mesh, see UnloadTexture().
+  template <typename T>
+  void UnloadResidentAsset(AssetTable<T *> &map, const char *filename,
+                           bool is_mesh);
+  // Whether a texture or mesh is in `map`, without taking it back if it was
+  // unloaded.
+  template <typename T>
+  bool HasResidentAsset(const AssetTable<T *> &map, const char *filename);
+
+  // Returns the material for a matdef embedded in a mesh, creating it if no
+  // mesh embedded an identical one before, so that identical surfaces share
+  // a Material.
+  Material *LoadEmbeddedMaterial(const matdef::Material *def,
+                                 const TextureLoaderFn &load_texture_fn);
+
+  // Makes a new texture look for one with the same contents to share, see
+  // SetTextureDeduplication().
+  void DeduplicateTexture(Texture *tex);
+  // The Texture::DuplicateFinder of DeduplicateTexture(). Runs on the loader
+  // threads.
+  Texture *FindDuplicateTexture(Texture *tex);
+  // Stops sharing a texture that is about to be deleted. If it shared
+  // another texture, adds that one to `unshared`, for the caller to unload
+  // once it lets go of resident_mutex_. Meshes aren't shared.
+  void ForgetSharing(Texture *tex, std::vector<Texture *> *unshared);
+  void ForgetSharing(Mesh *, std::vector<Texture *> *) {}
+  void UnloadUnshared(const std::vector<Texture *> &unshared);
+
+  // Moves an asset that is requested again up the load queue, if the new
+  // request is more urgent than the one that queued it.
+  void RaisePriority(AsyncAsset *asset, int priority) {
+    if (!asset->IsFinalized() && priority > asset->load_priority()) {
+      loader_.PrioritizeJob(asset, priority);
+    }
+  }
+
   Renderer &renderer_;
-  std::map<std::string, Shader *> shader_map_;
-  std::map<std::string, Texture *> texture_map_;
-  std::map<std::string, TextureAtlas *> texture_atlas_map_;
-  std::map<std::string, Material *> material_map_;
-  std::map<std::string, Mesh *> mesh_map_;
-  std::map<std::string, FileAsset *> file_map_;
+  std::thread::id render_thread_;
+
+  // The maps are sharded by asset type, each with its own lock. Textures and
+  // meshes share one, since evicting them for the residency budget touches
+  // both. Locks are taken in the order material or atlas, then resident,
+  // then sync_load_mutex_, and no lock is held while an asset is loaded.
+  mutable fplutil::Mutex shader_mutex_;
+  mutable fplutil::Mutex resident_mutex_;
+  mutable fplutil::Mutex material_mutex_;
+  mutable fplutil::Mutex atlas_mutex_;
+  mutable fplutil::Mutex file_mutex_;
+  mutable fplutil::Mutex record_mutex_;
+  // Guards sync_loads_, the names FindOrLoad() is loading synchronously.
+  // sync_load_done_ is signalled whenever one of those loads is done.
+  std::mutex sync_load_mutex_;
+  std::condition_variable sync_load_done_;
+  std::set<SyncLoad> sync_loads_;
+  AssetTable<Shader *> shader_map_;
+  AssetTable<Texture *> texture_map_;
+  AssetTable<TextureAtlas *> texture_atlas_map_;
+  AssetTable<Material *> material_map_;
+  AssetTable<Mesh *> mesh_map_;
+  AssetTable<FileAsset *> file_map_;
   AsyncLoader loader_;
   mathfu::vec2 texture_scale_;
 
+  // Guarded by shader_mutex_.
   std::vector<std::string> defines_to_add_;
   std::vector<std::string> defines_to_omit_;
+
+  // The AssetListScans of LoadAssetList(). Render thread only.
+  std::vector<AsyncAsset *> scans_;
+
+  // Guarded by record_mutex_.
+  bool recording_loads_;
+  std::vector<RecordedLoad> recorded_loads_;
+  // Type and filename of each of recorded_loads_.
+  std::set<std::pair<int, std::string>> recorded_names_;
+
+  // Guarded by resident_mutex_.
+  size_t residency_budget_;
+  size_t resident_gpu_bytes_;
+  size_t resident_cpu_bytes_;
+  // Least recently unloaded first.
+  std::list<ReleasedAsset> released_;
+  bool deduplicate_textures_;
+  // Finalized textures that others may share, by Texture::content_hash().
+  std::unordered_multimap<uint64_t, Texture *> texture_contents_;
+  // The texture each sharing texture shares, holding a reference to it.
+  std::unordered_map<Texture *, Texture *> shared_textures_;
 };
 
 /// @}
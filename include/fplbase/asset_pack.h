@@ -0,0 +1,130 @@
+// Copyright 2017 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPLBASE_ASSET_PACK_H
+#define FPLBASE_ASSET_PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+
+#include "fplbase/config.h"  // Must come first.
+
+#include "fplbase/file_utilities.h"
+#include "fplbase/fpl_common.h"
+
+namespace packdef {
+struct Pack;
+}
+
+namespace fplbase {
+
+/// @file
+/// @addtogroup fplbase_asset_pack
+/// @{
+
+/// @brief The version of the pack format AssetPack reads, and pack_pipeline
+/// writes.
+static const uint32_t kAssetPackVersion = 1;
+
+/// @brief The default alignment of the files in a pack, in bytes. Enough for
+/// FlatBuffers and SIMD loads of the contents.
+static const uint32_t kAssetPackDefaultAlignment = 16;
+
+/// @class AssetPack
+/// @brief Reads asset files from a pack built by pack_pipeline.
+///
+/// A pack holds many asset files in one file, which is mapped into memory
+/// with MapFile(), so reading a file from it costs no system calls. Once
+/// mounted, LoadFile() reads the files in the pack from it, and ViewFile()
+/// returns them without copying, which the FlatBuffer-based loaders (meshes,
+/// materials, texture atlases) use to parse straight from the mapping:
+///
+///     AssetPack pack;
+///     if (pack.Open("assets.fplpack")) pack.Mount();
+///     asset_manager.LoadMesh("meshes/tree.fplmesh");
+///
+/// Files that are not in the pack are still loaded the way they were before.
+class AssetPack {
+ public:
+  AssetPack();
+
+  /// @brief Unmounts and closes the pack.
+  ~AssetPack() { Close(); }
+
+  /// @brief Maps a pack into memory and checks its table of contents.
+  /// @param[in] filename The pack to open.
+  /// @return Returns false, and logs why, if the pack can't be used.
+  bool Open(const char *filename);
+
+  /// @brief Unmounts the pack, and unmaps it once the FileViews into it are
+  /// gone. Pointers returned by View() become invalid.
+  void Close();
+
+  /// @brief Whether Open() succeeded.
+  bool is_open() const { return toc_ != nullptr; }
+
+  /// @brief Whether the pack has a file with the given name.
+  bool Contains(const char *name) const;
+
+  /// @brief The contents of a file in the pack, without copying them.
+  /// @param[in] name The name of the file, as it was passed to LoadFile().
+  /// @param[out] data Set to the contents of the file, which stay valid until
+  /// Close().
+  /// @param[out] size Set to the size of the file, in bytes.
+  /// @return Returns false if the pack doesn't have the file.
+  bool View(const char *name, const uint8_t **data, size_t *size) const;
+
+  /// @brief Copies a file in the pack into a string.
+  /// @return Returns false if the pack doesn't have the file.
+  bool Load(const char *name, std::string *dest) const;
+
+  /// @brief The number of files in the pack.
+  size_t num_files() const;
+
+  /// @brief Adds the names of the files in the pack to `index`, e.g. to
+  /// build a FileIndex of a pack that was unpacked on disk. The index only
+  /// answers for them once the directory they are in is added with
+  /// FileIndex::AddRoot().
+  void AddToIndex(FileIndex *index) const;
+
+  /// @brief Makes LoadFile() and ViewFile() read the files in this pack from
+  /// it. Other files go to the functions that were set before.
+  ///
+  /// Packs can be stacked: the one mounted last is searched first. Unmount
+  /// them in the reverse order.
+  void Mount();
+
+  /// @brief Restores the LoadFile() and ViewFile() functions that were set
+  /// before Mount().
+  void Unmount();
+
+ private:
+  const uint8_t *mapped_;
+  // Owns the mapping. Shared with the FileViews LoadFileView() returns from
+  // the pack, so that they outlive Close().
+  std::shared_ptr<const void> mapping_;
+  const packdef::Pack *toc_;
+  bool mounted_;
+  LoadFileFunction previous_load_file_;
+  ViewFileFunction previous_view_file_;
+
+  FPL_DISALLOW_COPY_AND_ASSIGN(AssetPack);
+};
+
+/// @}
+}  // namespace fplbase
+
+#endif  // FPLBASE_ASSET_PACK_H
@@ -16,13 +16,21 @@
 #define FPLBASE_ASYNC_LOADER_H
 
 #include <stdint.h>
+#include <algorithm>
+#include <atomic>
 #include <deque>
 #include <functional>
+#include <limits>
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "fplbase/config.h"  // Must come first.
 #include "fplbase/asset.h"
+#include "fplbase/batch_file_reader.h"
+#include "fplbase/file_utilities.h"
+#include "fplutil/mutex.h"
 
 #ifdef FPLBASE_BACKEND_STDLIB
 #include <mutex>
@@ -42,6 +50,51 @@ typedef void *Semaphore;
 
 class AsyncLoader;
 
+/// @brief Common priorities for queued asset loads.
+///
+/// Loads with a higher priority are started before loads with a lower one.
+/// Any other integer may be used as a priority as well.
+enum AsyncLoadPriority {
+  kLoadPriorityLow = -100,
+  kLoadPriorityNormal = 0,
+  kLoadPriorityHigh = 100,
+  kLoadPriorityUrgent = 200,
+};
+
+/// @brief Pass as the deadline of a queued asset load that has none.
+const double kNoLoadDeadline = -1.0;
+
+/// @brief The number of I/O threads AsyncLoader uses unless
+/// AsyncLoader::SetNumIOThreads() says otherwise.
+const int kDefaultNumIOThreads = 2;
+
+/// @brief Where the time went while loading an AsyncAsset.
+///
+/// Filled in by AsyncLoader as the asset goes through the loading stages, or
+/// by AsyncAsset::LoadNow(). Durations are in seconds.
+struct AsyncLoadStats {
+  AsyncLoadStats()
+      : queue_seconds(0.0),
+        read_seconds(0.0),
+        decode_seconds(0.0),
+        finalize_seconds(0.0),
+        bytes_read(0),
+        bytes_uploaded(0) {}
+
+  /// @brief Time spent waiting in the loader's queues to be read or decoded.
+  double queue_seconds;
+  /// @brief Time spent in AsyncAsset::Read().
+  double read_seconds;
+  /// @brief Time spent in AsyncAsset::Decode().
+  double decode_seconds;
+  /// @brief Time spent in AsyncAsset::Finalize().
+  double finalize_seconds;
+  /// @brief Number of bytes read from storage, as reported by the asset.
+  size_t bytes_read;
+  /// @brief Number of bytes given to Finalize(), from AsyncAsset::UploadSize().
+  size_t bytes_uploaded;
+};
+
 /// @class AsyncResource
 /// @brief Any resource that can be loaded asynchronously should inherit from
 ///        this.
@@ -51,7 +104,17 @@ class AsyncAsset : public Asset {
   typedef std::function<void()> AssetFinalizedCallback;
 
   /// @brief Default constructor for an empty AsyncAsset.
-  AsyncAsset() : data_(nullptr), finalized_(false) {}
+  AsyncAsset()
+      : data_(nullptr),
+        finalized_(false),
+        load_priority_(kLoadPriorityNormal),
+        load_deadline_(std::numeric_limits<double>::infinity()),
+        load_sequence_(0),
+        load_queued_time_(0.0),
+        upload_size_(0),
+        load_cancelled_(false),
+        read_deferred_(false),
+        next_completed_(nullptr) {}
 
   /// @brief Construct an AsyncAsset with a given file name.
   /// @param[in] filename A C-string corresponding to the name of the asset
@@ -60,7 +123,15 @@ class AsyncAsset : public Asset {
       : filename_(filename),
         data_(nullptr),
         finalize_callbacks_(0),
-        finalized_(false) {}
+        finalized_(false),
+        load_priority_(kLoadPriorityNormal),
+        load_deadline_(std::numeric_limits<double>::infinity()),
+        load_sequence_(0),
+        load_queued_time_(0.0),
+        upload_size_(0),
+        load_cancelled_(false),
+        read_deferred_(false),
+        next_completed_(nullptr) {}
 
   /// @brief AsyncAsset destructor.
   virtual ~AsyncAsset() {}
@@ -68,12 +139,37 @@ class AsyncAsset : public Asset {
   /// @brief Override with the actual loading behavior.
   ///
   /// Load should perform the actual loading of filename_, and store the
-  /// result in data_, or nullptr upon failure. It is called on the loader
-  /// thread, so should not access any program state outside of this object.
-  /// Since there will be only one loader thread, any libraries called by Load
-  /// need not be MT-safe as long as they're not also called by the main thread.
+  /// result in data_, or nullptr upon failure. It is called on one of the
+  /// loader threads, so should not access any program state outside of this
+  /// object. Several loader threads may call Load on different assets at the
+  /// same time, so any libraries called by Load must be MT-safe.
   virtual void Load() = 0;
 
+  /// @brief Override to split Load() into a read stage and a decode stage.
+  ///
+  /// The loader calls Read() on one of its I/O threads, and then Decode() on
+  /// one of its decode threads, so that slow reads don't hold up decoding and
+  /// the other way around. Read() should only read the files the asset needs
+  /// and keep them in the asset; Decode() should turn them into data_. Assets
+  /// that override these should implement Load() as Read() then Decode().
+  ///
+  /// By default Read() does nothing and Decode() calls Load(), so all the work
+  /// happens in the decode stage.
+  virtual void Read() {}
+
+  /// @brief Override with the one file Read() loads, so that AsyncLoader can
+  /// read it ahead.
+  ///
+  /// When the loader has a read-ahead function, e.g. a BatchFileReader, it
+  /// starts reading this file without waiting for it, and calls Read() on a
+  /// decode thread once it is in memory. Read() must then get the file from
+  /// LoadReadFile(), which returns the contents that were read ahead. Returns
+  /// null by default, in which case Read() is called on an I/O thread.
+  virtual const char *ReadAheadFile() const { return nullptr; }
+
+  /// @brief Override to turn what Read() loaded into data_. See Read().
+  virtual void Decode() { Load(); }
+
   /// @brief Override with converting the data into the resource.
   ///
   /// This should implement the behavior of turning data_ into the actual
@@ -89,16 +185,30 @@ class AsyncAsset : public Asset {
   /// Finalize has been called (by AssetManager::TryFinalize).
   virtual bool IsValid() = 0;
 
-  /// @brief Performs a synchronous load by calling Load & Finalize.
+  /// @brief Override with the number of bytes Finalize() will upload.
+  ///
+  /// Called on the loader thread right after Decode(). Used to limit how much
+  /// data AsyncLoader::TryFinalize() uploads per call. It does not need to be
+  /// exact.
+  virtual size_t UploadSize() const { return 0; }
+
+  /// @brief Override with the approximate number of bytes of GPU memory the
+  /// asset uses once finalized, e.g. for textures and vertex buffers.
+  ///
+  /// Used by AssetManager to keep assets within its residency budget.
+  virtual size_t GpuMemorySize() const { return 0; }
+
+  /// @brief Override with the approximate number of bytes of CPU memory the
+  /// asset holds on to, not counting the object itself.
+  ///
+  /// Used by AssetManager to keep assets within its residency budget.
+  virtual size_t CpuMemorySize() const { return 0; }
+
+  /// @brief Performs a synchronous load by calling Read, Decode & Finalize.
   ///
   /// Not used by the loader thread, should be called on the main thread.
   /// @return Returns false on failure.
-  bool LoadNow() {
-    Load();
-    bool ok = data_ != nullptr;
-    // Call this even if data_ is null, to enforce Finalize() checking for it.
-    return Finalize() && ok;
-  }
+  bool LoadNow();
 
   /// @brief Sets the filename that should be loaded.
   ///
@@ -113,15 +223,31 @@ class AsyncAsset : public Asset {
   /// @return Returns the filename.
   const std::string &filename() const { return filename_; }
 
+  /// @brief The priority this asset was last queued or prioritized with.
+  int load_priority() const { return load_priority_; }
+
+  /// @brief How long each stage of the last load took.
+  const AsyncLoadStats &load_stats() const { return load_stats_; }
+
+  /// @brief Whether AsyncLoader::AbortJob() cancelled this asset while it was
+  /// loading.
+  ///
+  /// Load(), Read() and Decode() may poll this and return early, since the
+  /// loader discards the asset once they return.
+  bool IsLoadCancelled() const { return load_cancelled_; }
+
   /// @brief Adds a callback to be called when the asset is finalized.
   ///
   /// Add a callback so logic can be executed when an asset is done loading.
-  /// This does nothing if the asset has already been finalized.
+  /// This does nothing if the asset has already been finalized, in which case
+  /// the caller should call it itself. Callbacks run on the main thread, from
+  /// AsyncLoader::TryFinalize(). May be called on any thread.
   ///
   /// @param callback The function to be called.
   /// @return Returns true if the asset is not finalized and the callback was
   /// added.
-  bool AddFinalizeCallback(AssetFinalizedCallback callback) {
+  bool AddFinalizeCallback(const AssetFinalizedCallback &callback) {
+    fplutil::MutexLock lock(finalize_mutex_);
     if (finalized_) {
       return false;
     }
@@ -129,20 +255,53 @@ class AsyncAsset : public Asset {
     return true;
   }
 
+  /// @brief Like AddFinalizeCallback() above, but only moves from `callback`
+  /// if it is added, so the caller can still call it otherwise.
+  bool AddFinalizeCallback(AssetFinalizedCallback &&callback) {
+    fplutil::MutexLock lock(finalize_mutex_);
+    if (finalized_) {
+      return false;
+    }
+    finalize_callbacks_.push_back(std::move(callback));
+    return true;
+  }
+
  protected:
   /// @brief Calls app callbacks when an asset is ready to be used.
   ///
   /// This should be called by descendants as soon as they are finalized.
   void CallFinalizeCallback() {
-    auto callbacks = finalize_callbacks_;
-    finalize_callbacks_.clear();
+    // Mark the asset finalized first, so callbacks that add more callbacks
+    // have them called right away rather than dropped.
+    std::vector<AssetFinalizedCallback> callbacks;
+    {
+      fplutil::MutexLock lock(finalize_mutex_);
+      finalized_ = true;
+      callbacks.swap(finalize_callbacks_);
+    }
     for (auto it = callbacks.begin();
          it != callbacks.end(); ++it) {
       (*it)();
     }
-    finalized_ = true;
   }
 
+  /// @brief Calls CallFinalizeCallback() once all of `assets` are finalized.
+  ///
+  /// For assets that are only usable once the assets they refer to are, e.g.
+  /// a material and its textures. Calls it right away if they all are. This
+  /// asset may be deleted before then. Call on the main thread only.
+  ///
+  /// @param assets The assets to wait for.
+  void CallFinalizeCallbackAfter(const std::vector<AsyncAsset *> &assets);
+
+  /// @brief Loads a file for Read(), like LoadFileView(), or returns the
+  /// contents the loader read ahead if they are of that file. See
+  /// ReadAheadFile().
+  ///
+  /// @param filename The file to load.
+  /// @return Returns null if the file couldn't be loaded.
+  FileView LoadReadFile(const char *filename);
+
   /// @brief The resource file name.
   std::string filename_;
   /// @brief The resource data.
@@ -150,14 +309,55 @@ class AsyncAsset : public Asset {
 
   /// @brief List of callbacks to be invoked when the asset is finalized.
   std::vector<AssetFinalizedCallback> finalize_callbacks_;
-  /// @brief Whether the asset has been finalized.
-  bool finalized_;
+  /// @brief Protects finalize_callbacks_, and setting finalized_, so that
+  /// callbacks added on other threads are never dropped.
+  fplutil::Mutex finalize_mutex_;
+  /// @brief Whether the asset has been finalized. Atomic, so that other
+  /// threads can poll IsFinalized() on assets AssetManager hands them.
+  std::atomic<bool> finalized_;
+
+  /// @brief Statistics of the last load. Read(), or Load() for assets that
+  /// don't override Read(), should set `bytes_read`.
+  AsyncLoadStats load_stats_;
+
+ private:
+  // Scheduling state, owned by the AsyncLoader that queued this asset.
+  // Atomic, since AssetManager reads the priority on any thread.
+  std::atomic<int> load_priority_;
+  // Absolute time, in AsyncLoader::CurrentTime() seconds, or infinity.
+  double load_deadline_;
+  // Order in which the asset was queued, to keep equal loads FIFO.
+  uint64_t load_sequence_;
+  // When the asset entered its current loader queue, in CurrentTime() seconds.
+  double load_queued_time_;
+  // UploadSize() as of when the asset finished loading.
+  size_t upload_size_;
+  // Set by AsyncLoader::AbortJob() while the asset is loading.
+  std::atomic<bool> load_cancelled_;
+  // Set while the loader reads ReadAheadFile() ahead, so that the decode
+  // thread calls Read() before Decode().
+  bool read_deferred_;
+  // The file the loader read ahead, filled in by its read-ahead function, and
+  // handed to LoadReadFile() as `read_ahead_`.
+  std::string read_ahead_name_;
+  std::string read_ahead_contents_;
+  FileView read_ahead_;
+  // Next asset in AsyncLoader::completed_.
+  AsyncAsset *next_completed_;
+  // Weakly referenced by the callbacks of CallFinalizeCallbackAfter(), which
+  // may outlive this asset.
+  std::shared_ptr<AsyncAsset *> self_;
 
   friend class AsyncLoader;
 };
 
 /// @class AsyncLoader
 /// @brief Handles loading AsyncAsset objects.
+///
+/// Loading happens in three stages, with a queue in front of each: a few I/O
+/// threads call AsyncAsset::Read(), a pool of decode threads calls
+/// AsyncAsset::Decode(), and TryFinalize() calls AsyncAsset::Finalize() on the
+/// main thread.
 class AsyncLoader {
  public:
   AsyncLoader();
@@ -167,45 +367,196 @@ class AsyncLoader {
   ///
   /// Call this any number of times before StartLoading.
   ///
+  /// Queued resources are loaded in order of decreasing priority. Among
+  /// resources of equal priority, the one with the earliest deadline is
+  /// loaded first, and resources without a deadline load in the order they
+  /// were queued.
+  ///
   /// @param res The resource to queue for loading.
-  void QueueJob(AsyncAsset *res);
+  /// @param priority How urgently the resource is needed. See
+  /// AsyncLoadPriority.
+  /// @param deadline Seconds from now by which the resource should be loaded,
+  /// or kNoLoadDeadline.
+  void QueueJob(AsyncAsset *res, int priority = kLoadPriorityNormal,
+                double deadline = kNoLoadDeadline);
+
+  /// @brief Changes the priority and deadline of a queued resource.
+  ///
+  /// Use this when a resource that was queued for the background is suddenly
+  /// needed right away. Does nothing if the resource is already loading or
+  /// loaded.
+  ///
+  /// @param res The resource to reschedule.
+  /// @param priority The new priority. See AsyncLoadPriority.
+  /// @param deadline Seconds from now by which the resource should be loaded,
+  /// or kNoLoadDeadline.
+  void PrioritizeJob(AsyncAsset *res, int priority,
+                     double deadline = kNoLoadDeadline);
 
   /// @brief Aborts any pending operations for the given asset.
   ///
-  /// If the given asset is currently loading, this blocks until it is complete.
-  /// If it has not yet been loaded, this removes it from the queue.
+  /// Never blocks. If the asset is queued or waiting for TryFinalize(), this
+  /// removes it from the loader. If a loader thread is busy with it, this
+  /// cancels it instead (see AsyncAsset::IsLoadCancelled()), and the loader
+  /// takes ownership: the asset is deleted by TryFinalize() once the loader
+  /// thread is done with it. Call on the main thread only.
   ///
   /// @param res The resource to abort performing any operations on.
-  void AbortJob(AsyncAsset *res);
+  /// @return Returns true if the loader no longer refers to `res`, so the
+  /// caller may delete it. Returns false if the loader will delete it.
+  bool AbortJob(AsyncAsset *res);
+
+  /// @brief Sets the number of decode threads.
+  ///
+  /// Must be called while the loader is not running, i.e. before
+  /// StartLoading() or after Stop(). Jobs that are already queued are kept.
+  ///
+  /// @param num_threads The number of decode threads to use. Values less than
+  /// 1 select the default, which is one less than the number of CPU cores.
+  void SetNumWorkerThreads(int num_threads);
+
+  /// @brief The number of decode threads launched by StartLoading().
+  int num_worker_threads() const { return num_worker_threads_; }
+
+  /// @brief Sets the number of I/O threads, i.e. how many files are read at
+  /// the same time.
+  ///
+  /// Must be called while the loader is not running, like
+  /// SetNumWorkerThreads().
+  ///
+  /// @param num_threads The number of I/O threads to use. Values less than 1
+  /// select the default of kDefaultNumIOThreads.
+  void SetNumIOThreads(int num_threads);
+
+  /// @brief The number of I/O threads launched by StartLoading().
+  int num_io_threads() const { return num_io_threads_; }
 
-  /// @brief Launches the loading thread for the previously queued jobs.
+  /// @brief Starts reading a whole file into `dest`, and calls `callback`
+  /// once it is done, like BatchFileReader::Read().
+  typedef std::function<bool(const char *filename, std::string *dest,
+                             BatchReadCallback callback)>
+      ReadAheadFunction;
+
+  /// @brief Reads the files of queued assets with `read_ahead` rather than on
+  /// the I/O threads.
+  ///
+  /// The I/O threads start a read for every queued asset that names its file
+  /// with AsyncAsset::ReadAheadFile(), up to the read-ahead limit, without
+  /// waiting for any of them. Each asset goes on to be decoded once its read
+  /// completes, so far more reads can be in flight than there are I/O
+  /// threads. Files that ViewFile() can view, e.g. those in a mounted
+  /// AssetPack, are still read by AsyncAsset::Read() on an I/O thread. Only
+  /// the stdlib backend reads ahead.
+  ///
+  /// Must be called while the loader is not running, like
+  /// SetNumWorkerThreads().
+  ///
+  /// @param read_ahead The function to read files with, or nullptr to read
+  /// them on the I/O threads.
+  void SetReadAheadFunction(ReadAheadFunction read_ahead);
+
+  /// @brief Reads the files of queued assets with `reader`. See
+  /// SetReadAheadFunction().
+  ///
+  /// @param reader A started reader, which must outlive the loader, or
+  /// nullptr to read files on the I/O threads.
+  void SetBatchFileReader(BatchFileReader *reader) {
+    if (!reader) {
+      SetReadAheadFunction(nullptr);
+      return;
+    }
+    SetReadAheadFunction([reader](const char *filename, std::string *dest,
+                                  BatchReadCallback callback) {
+      return reader->Read(filename, dest, std::move(callback));
+    });
+  }
+
+  /// @brief Launches the loading threads for the previously queued jobs.
   void StartLoading();
 
-  /// @brief Pause the loading thread for previously queued jobs.
+  /// @brief Pause the loading threads for previously queued jobs.
   ///
-  /// Blocks until only the current job is finished loading. You can resume
+  /// Blocks until only the current jobs are finished loading. You can resume
   /// loading assets by calling StartLoading().
   void PauseLoading();
 
-  /// @brief Ends the loading thread when all jobs are done.
+  /// @brief Ends the loading threads when all jobs are done.
   ///
-  /// Cleans-up the background loading thread once all jobs have been completed.
-  /// You can restart with StartLoading() if you like.
+  /// Cleans-up the background loading threads once all jobs have been
+  /// completed. You can restart with StartLoading() if you like.
   void StopLoadingWhenComplete();
 
   /// @brief Call to Finalize any resources that have finished loading.
   ///
   /// Call this once per frame after StartLoading. Will call Finalize on any
   /// resources that have finished loading. One it returns true, that means
-  /// the queue is empty, all resources have been processed, and the loading
-  /// thread has terminated.
+  /// the queue is empty and all resources have been processed.
   ///
   /// @return Returns true once the queue is empty.
   bool TryFinalize();
 
+  /// @brief Call to Finalize resources that have finished loading, within a
+  /// budget.
+  ///
+  /// Works like TryFinalize(), but stops once either budget is used up, and
+  /// leaves the remaining resources for the next call. Always finalizes at
+  /// least one resource if any are ready, so that loading makes progress.
+  ///
+  /// @param max_seconds The time to spend finalizing, or 0 for no limit.
+  /// @param max_bytes The number of bytes to upload, as reported by
+  /// AsyncAsset::UploadSize(), or 0 for no limit.
+  /// @return Returns true once the queue is empty.
+  bool TryFinalize(double max_seconds, size_t max_bytes = 0);
+
+  /// @brief The number of resources that are loaded and waiting for
+  /// TryFinalize().
+  ///
+  /// Call on the main thread only, like TryFinalize().
+  int NumPendingFinalizes();
+
+  /// @brief The number of bytes the resources waiting for TryFinalize() will
+  /// upload.
+  ///
+  /// Call on the main thread only, like TryFinalize().
+  size_t PendingFinalizeBytes();
+
+  /// @brief Limits how much decoded data may wait for TryFinalize().
+  ///
+  /// Decoded assets hold their data, e.g. a texture's pixels, until they are
+  /// finalized. Once the decoded data waiting for TryFinalize() reaches
+  /// `max_bytes`, the decode threads pause until TryFinalize() releases
+  /// some. The size of an asset is only known once it is decoded, so each
+  /// decode thread may go over the limit by one asset. Stop() finishes all
+  /// loads regardless of the limit. May be called at any time.
+  ///
+  /// @param max_bytes The limit, as reported by AsyncAsset::UploadSize(), or
+  /// 0 for no limit, which is the default.
+  void SetMaxDecodedBytes(size_t max_bytes);
+
+  /// @brief The limit set by SetMaxDecodedBytes().
+  size_t max_decoded_bytes() const { return max_decoded_bytes_; }
+
+  /// @brief The number of bytes of decoded data that has not been finalized
+  /// yet. Can be called from any thread.
+  size_t DecodedBytes() const { return decoded_bytes_; }
+
+  /// @brief Blocks until the given resource is finalized.
+  ///
+  /// Moves the resource to the front of the queue, starts the loader if it
+  /// isn't running, and calls TryFinalize() until the resource is finalized.
+  /// Other resources that finish in the meantime are finalized as well. Call
+  /// on the main thread only.
+  ///
+  /// @param res A resource queued on this loader.
+  void WaitForFinalize(AsyncAsset *res);
+
   /// @brief Shuts down the loader after completing all pending loads.
   void Stop();
 
+  /// @brief Monotonic time in seconds, as used for deadlines and
+  /// AsyncLoadStats.
+  static double CurrentTime();
+
  private:
 #ifdef FPLBASE_BACKEND_SDL
   void Lock(const std::function<void()> &body);
@@ -217,31 +568,255 @@ class AsyncLoader {
   }
 #endif
 
-  void LoaderWorker();
+  struct Worker;
+
+  // Returns true if `a` should be loaded before `b`.
+  static bool LoadsBefore(const AsyncAsset *a, const AsyncAsset *b) {
+    if (a->load_priority_ != b->load_priority_) {
+      return a->load_priority_ > b->load_priority_;
+    }
+    if (a->load_deadline_ != b->load_deadline_) {
+      return a->load_deadline_ < b->load_deadline_;
+    }
+    return a->load_sequence_ < b->load_sequence_;
+  }
+
+  // Inserts `res` into `queue`, which is sorted by LoadsBefore().
+  static void InsertSorted(std::deque<AsyncAsset *> *queue, AsyncAsset *res) {
+    queue->insert(std::upper_bound(queue->begin(), queue->end(), res,
+                                   LoadsBefore),
+                  res);
+  }
+
+  static void SetSchedule(AsyncAsset *res, int priority, double deadline) {
+    res->load_priority_ = priority;
+    res->load_deadline_ = deadline >= 0.0
+                              ? CurrentTime() + deadline
+                              : std::numeric_limits<double>::infinity();
+  }
+
+  static int DefaultNumWorkerThreads();
+  // Calls AsyncAsset::Read(), and then forgets what was read ahead for it.
+  static void ReadJob(AsyncAsset *job);
+  void ReaderWorker(Worker *worker);
+  void LoaderWorker(Worker *worker);
   static int LoaderThread(void *user_data);
 
-  std::deque<AsyncAsset *> queue_, done_;
-  AsyncAsset *loading_;
-  int num_pending_requests_;
+  // Jobs waiting to be read, sorted by LoadsBefore().
+  std::deque<AsyncAsset *> queue_;
+  uint64_t next_sequence_;
+
+  // Called by the loader threads when they are done with a job, whether it
+  // loaded or was cancelled. Lock-free, so the main thread never waits for a
+  // loader thread to finalize a job.
+  void PushCompleted(AsyncAsset *job);
+  // Moves the jobs pushed by PushCompleted() to done_. Main thread only.
+  void PopCompleted();
+  // Deletes the cancelled jobs in done_ and forgets the rest. Main thread
+  // only, once the loader threads have stopped.
+  void ClearCompleted();
+
+  // Whether the decode threads should wait for TryFinalize() to release
+  // decoded data before decoding more.
+  bool OverDecodeBudget() const {
+    const size_t max_bytes = max_decoded_bytes_;
+    return max_bytes > 0 && decoded_bytes_ >= max_bytes;
+  }
+  // Subtracts a job that was finalized or dropped from decoded_bytes_, and
+  // wakes up the decode threads if they are waiting for that.
+  void ReleaseDecodedBytes(size_t bytes);
+  // Wakes up the decode threads that are waiting in OverDecodeBudget().
+  void WakeThrottledWorkers();
+
+  // Jobs pushed by PushCompleted(), newest first. A lock-free stack linked
+  // through AsyncAsset::next_completed_, which the main thread empties in one
+  // go.
+  std::atomic<AsyncAsset *> completed_;
+  // Jobs waiting for TryFinalize(), oldest first. Main thread only.
+  std::deque<AsyncAsset *> done_;
+  // Sum of the upload_size_ of the assets in done_. Main thread only.
+  size_t done_bytes_;
+  // The job TryFinalize() is finalizing, if any.
+  AsyncAsset *finalizing_;
+  // Jobs that are queued, loading or waiting to be finalized.
+  std::atomic<int> num_pending_requests_;
+  // The upload_size_ of the jobs that were decoded but not yet finalized or
+  // dropped.
+  std::atomic<size_t> decoded_bytes_;
+  std::atomic<size_t> max_decoded_bytes_;
+  // Decode threads waiting for decoded_bytes_ to drop. Incremented before
+  // checking OverDecodeBudget() again, so that ReleaseDecodedBytes() either
+  // sees it or the check sees the release.
+  std::atomic<int> num_throttled_workers_;
+  int num_worker_threads_;
+  int num_io_threads_;
+  ReadAheadFunction read_ahead_;
 #ifdef FPLBASE_BACKEND_SDL
-  // Keep handle to the worker thread around so that we can wait for it to
-  // finish before destroying the class.
-  Thread worker_thread_;
-
-  // This lock protects ALL state in this class, i.e. the two vectors.
+  // State of a single I/O or decode thread.
+  struct Worker {
+    AsyncLoader *loader;
+    // Keep handle to the worker thread around so that we can wait for it to
+    // finish before destroying the class.
+    Thread thread;
+    // The job this thread is currently reading or decoding, if any.
+    AsyncAsset *loading;
+    // True for I/O threads, false for decode threads.
+    bool reader;
+  };
+
+  // The decode threads pull jobs from this single queue, sorted by
+  // LoadsBefore().
+  std::deque<AsyncAsset *> decode_queue_;
+  std::vector<Worker> readers_;
+  std::vector<Worker> workers_;
+  // I/O threads that haven't reached the bookend yet. The last one passes it
+  // on to the decode threads.
+  int num_running_readers_;
+
+  // This lock protects the queues and the jobs being loaded. The finished
+  // jobs go through the lock-free completed_ instead.
   Mutex mutex_;
 
-  // Kick-off the worker thread when a new job arrives.
+  // Kick-off an I/O thread when a new job arrives.
   Semaphore job_semaphore_;
+  // Kick-off a decode thread when a job has been read.
+  Semaphore decode_semaphore_;
+  // Wakes up a decode thread waiting in OverDecodeBudget().
+  Semaphore memory_semaphore_;
+  // Set by StopLoadingWhenComplete(), to stop waiting in OverDecodeBudget().
+  std::atomic<bool> stopping_;
 #elif defined(FPLBASE_BACKEND_STDLIB)
-  std::thread worker_thread_;
+  // State of a single I/O or decode thread. Each decode thread has its own job
+  // deque, sorted by LoadsBefore(), and pops from its front. Once its deque is
+  // empty, it steals the most important of the jobs at the front of the other
+  // deques. I/O threads share queue_.
+  struct Worker {
+    Worker(AsyncLoader *loader, size_t index, bool reader)
+        : loader(loader), index(index), reader(reader), loading(nullptr) {}
+    AsyncLoader *loader;
+    // Position of this worker in AsyncLoader::workers_ or readers_.
+    size_t index;
+    // True for I/O threads, false for decode threads.
+    bool reader;
+    std::thread thread;
+    // Protects `jobs`. Never held while acquiring AsyncLoader::mutex_.
+    std::mutex mutex;
+    std::deque<AsyncAsset *> jobs;
+    // The job this thread is currently reading or decoding, if any. Atomic, as
+    // AbortJob() reads it while the worker sets and clears it. A job is
+    // published here before it leaves queue_ or a deque, and only cleared
+    // after it has been pushed to completed_ or a deque, so AbortJob() always
+    // finds it in one of them.
+    std::atomic<AsyncAsset *> loading;
+  };
+
+  AsyncAsset *PopJob(Worker *worker);
+  // Starts reading `job` ahead, or returns false if it must be read on the
+  // I/O thread.
+  bool StartReadAhead(Worker *reader, AsyncAsset *job);
+  // Hands a job that has been read to the decode threads. `reader` is null
+  // for jobs that were read ahead.
+  void QueueDecode(Worker *reader, AsyncAsset *job);
+  bool RemoveQueuedJob(AsyncAsset *res);
+  bool IsRunning() const;
+
+  std::vector<std::unique_ptr<Worker>> readers_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  // Round-robin index of the worker that receives the next job to decode.
+  size_t next_worker_;
+  // Number of jobs sitting in the worker deques, waiting to be decoded. Only
+  // incremented while holding mutex_, so workers waiting on job_cv_ never miss
+  // a new job. The I/O threads stop reading ahead while this is too high.
+  std::atomic<int> num_queued_jobs_;
+  // Number of jobs the I/O threads are reading, including those read ahead.
+  int num_reading_;
+  // Jobs being read ahead, which no `loading` slot holds.
+  std::vector<AsyncAsset *> reading_ahead_;
+  // Set by PauseLoading() and StopLoadingWhenComplete() to end the workers.
+  bool pause_;
+  bool stop_when_complete_;
+
+  // Protects queue_, the worker `loading` hand-offs and the state above.
   std::mutex mutex_;
+  // Wakes up the decode threads.
   std::condition_variable job_cv_;
+  // Wakes up the I/O threads.
+  std::condition_variable read_cv_;
 #else
 #error Need to define FPLBASE_BACKEND_XXX
 #endif
 };
 
+/// @brief Calls `callback` once all of `assets` are finalized.
+///
+/// Use this to build something out of several assets, e.g. a material once
+/// all of its textures are uploaded. Calls `callback` right away if all of
+/// them are already finalized, and otherwise from AsyncLoader::TryFinalize().
+/// Call on the main thread only.
+///
+/// @param assets The assets to wait for.
+/// @param callback The function to call once, when the last asset is
+/// finalized.
+void WhenAllFinalized(const std::vector<AsyncAsset *> &assets,
+                      AsyncAsset::AssetFinalizedCallback callback);
+
+/// @class AsyncHandle
+/// @brief A handle to an asset that is loading asynchronously.
+///
+/// Lets callers wait for the asset, or chain work onto it, instead of polling
+/// AsyncAsset::IsFinalized() every frame. Handles are cheap to copy, and are
+/// valid for as long as the asset they refer to. wait() must be called on the
+/// main thread; the other methods may be called on any thread.
+template <typename T>
+class AsyncHandle {
+ public:
+  /// @brief A function to call with the asset once it is finalized.
+  typedef std::function<void(T *)> Continuation;
+
+  /// @brief Constructs a handle that refers to no asset.
+  AsyncHandle() : asset_(nullptr), loader_(nullptr) {}
+
+  /// @brief Constructs a handle to `asset`, which is loaded by `loader`.
+  AsyncHandle(T *asset, AsyncLoader *loader)
+      : asset_(asset), loader_(loader) {}
+
+  /// @brief The asset, which is only usable once ready() returns true.
+  T *get() const { return asset_; }
+
+  /// @brief Whether the asset has been finalized. This does not signal
+  /// success or not -- check the asset's IsValid() for that.
+  bool ready() const { return asset_ == nullptr || asset_->IsFinalized(); }
+
+  /// @brief Blocks until the asset is finalized. See
+  /// AsyncLoader::WaitForFinalize().
+  /// @return Returns the asset.
+  T *wait() const {
+    if (!ready()) loader_->WaitForFinalize(asset_);
+    return asset_;
+  }
+
+  /// @brief Calls `continuation` with the asset once it is finalized.
+  ///
+  /// Calls it right away if the asset is already finalized, and otherwise
+  /// from AsyncLoader::TryFinalize() on the main thread. Continuations are
+  /// called in the order they were added.
+  ///
+  /// @param continuation The function to call.
+  /// @return Returns this handle, so calls can be chained.
+  const AsyncHandle &then(Continuation continuation) const {
+    if (asset_ == nullptr) return *this;
+    T *asset = asset_;
+    AsyncAsset::AssetFinalizedCallback callback =
+        std::bind(std::move(continuation), asset);
+    if (!asset->AddFinalizeCallback(std::move(callback))) callback();
+    return *this;
+  }
+
+ private:
+  T *asset_;
+  AsyncLoader *loader_;
+};
+
 /// @}
 }  // namespace fplbase
 
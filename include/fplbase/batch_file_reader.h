@@ -0,0 +1,143 @@
+// Copyright 2017 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPLBASE_BATCH_FILE_READER_H
+#define FPLBASE_BATCH_FILE_READER_H
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "fplbase/config.h"  // Must come first.
+
+#include "fplbase/file_utilities.h"
+#include "fplbase/fpl_common.h"
+
+namespace fplbase {
+
+/// @file
+/// @addtogroup fplbase_file_utilities
+/// @{
+
+class BatchFileReaderBackend;
+
+/// @brief Called once a file read by BatchFileReader::Read() is complete.
+/// @param success Whether the whole file was read.
+typedef std::function<void(bool success)> BatchReadCallback;
+
+/// @class BatchFileReader
+/// @brief Reads many files at once, so the storage device sees a deep queue.
+///
+/// LoadFileRaw() reads a file with one blocking read at a time, so even with
+/// several AsyncLoader I/O threads the device rarely has more than a few
+/// requests to work on. BatchFileReader splits every file into chunks and
+/// keeps up to `queue_depth` of them in flight, from all threads together.
+///
+/// On Linux it submits the reads to an io_uring, and falls back to a pool of
+/// threads calling `pread()` when io_uring is not available (older kernels,
+/// or a seccomp policy that blocks it). Elsewhere it reads with LoadFileRaw().
+///
+/// Hand it to the AssetManager, or an AsyncLoader, so that its I/O threads
+/// start a read for every queued asset without waiting for each one:
+///
+///     BatchFileReader reader;
+///     reader.Start();
+///     asset_manager.SetBatchFileReader(&reader);
+///     asset_manager.StartLoadingTextures();
+///
+/// Mount it to also use it for LoadFile() calls, before mounting any
+/// AssetPack, so that the packs are still searched first. Those calls block
+/// until their file is read, so they only keep one read per calling thread in
+/// flight. Files read either way are copied into memory rather than mapped by
+/// LoadFileView().
+class BatchFileReader {
+ public:
+  /// @brief How the reads are issued.
+  enum Backend {
+    /// Not started: reads go to LoadFileRaw() on the calling thread.
+    kBackendNone,
+    /// Reads are submitted to an io_uring.
+    kBackendIoUring,
+    /// Reads are issued by a pool of threads.
+    kBackendThreadPool,
+  };
+
+  /// @brief The number of reads kept in flight unless Start() says otherwise.
+  static const int kDefaultQueueDepth = 32;
+
+  BatchFileReader();
+
+  /// @brief Unmounts and stops the reader.
+  ~BatchFileReader();
+
+  /// @brief Starts the reader.
+  /// @param[in] queue_depth The most reads to have in flight at once. Values
+  /// less than 1 select kDefaultQueueDepth.
+  /// @param[in] allow_io_uring Whether io_uring may be used, rather than
+  /// only the thread pool.
+  /// @return Returns false if neither backend could be started on this
+  /// platform, in which case reads still work, through LoadFileRaw().
+  bool Start(int queue_depth = kDefaultQueueDepth, bool allow_io_uring = true);
+
+  /// @brief Waits for the reads in flight to complete, and stops the reader.
+  void Stop();
+
+  /// @brief The backend that Start() picked.
+  Backend backend() const;
+
+  /// @brief Starts reading a file from the file system.
+  ///
+  /// `callback` is called on one of the reader's threads once all of the file
+  /// is in `dest`. Neither `dest` nor the file may be touched until then.
+  ///
+  /// @param[in] filename The file to read.
+  /// @param[out] dest The string to read the file into.
+  /// @param[in] callback Called once the read is done.
+  /// @return Returns false if the file can't be opened, isn't a regular file,
+  /// is empty, or isn't listed by an enabled FileIndex, in which case
+  /// `callback` is never called. Like LoadFileRaw(), only a file that fails to
+  /// open logs an error.
+  bool Read(const char *filename, std::string *dest,
+            BatchReadCallback callback);
+
+  /// @brief Reads a whole file, like LoadFileRaw(), and waits for it. Can be
+  /// called from any number of threads at once.
+  bool LoadFile(const char *filename, std::string *dest);
+
+  /// @brief Makes LoadFile() read files with this reader, in place of the
+  /// function that was set before.
+  void Mount();
+
+  /// @brief Restores the LoadFile() function that was set before Mount().
+  void Unmount();
+
+ private:
+  // Guards backend_ and num_submitting_, so that Stop() waits for reads that
+  // are being handed to the backend, and later reads fall back safely.
+  mutable std::mutex mutex_;
+  std::condition_variable submitted_;
+  std::unique_ptr<BatchFileReaderBackend> backend_;
+  int num_submitting_;
+  bool mounted_;
+  LoadFileFunction previous_load_file_;
+
+  FPL_DISALLOW_COPY_AND_ASSIGN(BatchFileReader);
+};
+
+/// @}
+}  // namespace fplbase
+
+#endif  // FPLBASE_BATCH_FILE_READER_H
@@ -15,8 +15,15 @@
 #ifndef FPLBASE_FILE_UTILITIES_H
 #define FPLBASE_FILE_UTILITIES_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_set>
+#include <vector>
 
 #if defined(__ANDROID__)
 #include <android/asset_manager.h>
@@ -29,6 +36,13 @@ namespace fplbase {
 typedef std::function<bool(const char *filename, std::string *dest)>
     LoadFileFunction;
 
+/// @brief Called by `ViewFile()`. `owner` may be null; otherwise it is set
+/// to an object that keeps `data` valid while held, or left empty if `data`
+/// stays valid until the function is replaced.
+typedef std::function<bool(const char *filename, const uint8_t **data,
+                           size_t *size, std::shared_ptr<const void> *owner)>
+    ViewFileFunction;
+
 /// @brief Checks if a file exists.
 /// @param[in] filename A UTF-8 C-string representing the file to check.
 /// @return Returns `true` if the file exists, false otherwise.
@@ -42,6 +56,12 @@ bool FileExistsRaw(const char *filename);
 /// it's not present, but can also mean there was a read error).
 bool LoadFileRaw(const char *filename, std::string *dest);
 
+/// @brief Gets the size of a file without reading it.
+/// @param[in] filename A UTF-8 C-string representing the file to check.
+/// @param[out] size Set to the size of the file, in bytes.
+/// @return Returns `false` if the file doesn't exist.
+bool FileSizeRaw(const char *filename, size_t *size);
+
 /// @brief Loads a file and returns its contents via string pointer.
 /// @details In contrast to `LoadFileRaw()`, this method simply calls the
 /// function set by `SetLoadFileFunction()` to read the specified file.
@@ -60,6 +80,164 @@ bool LoadFile(const char *filename, std::string *dest);
 /// @return Returns the function previously set by `LoadFileFunction()`.
 LoadFileFunction SetLoadFileFunction(LoadFileFunction load_file_function);
 
+/// @brief Gets the contents of a file without copying them, if they are
+/// already in memory, e.g. in a mounted `AssetPack`.
+/// @details Calls the function set by `SetViewFileFunction()`. By default no
+/// files can be viewed, so callers fall back on `LoadFile()`. The memory stays
+/// valid while `owner` is held, or, if it is left empty, until the function
+/// that provided it is replaced.
+/// @param[in] filename A UTF-8 C-string representing the file to view.
+/// @param[out] data Set to the contents of the file.
+/// @param[out] size Set to the size of the file, in bytes.
+/// @param[out] owner If not null, set to an object that keeps the contents
+/// valid while held.
+/// @return Returns `false` if the file can't be viewed.
+bool ViewFile(const char *filename, const uint8_t **data, size_t *size,
+              std::shared_ptr<const void> *owner = nullptr);
+
+/// @brief Set the function called by `ViewFile()`.
+/// @param[in] view_file_function The function to be used by `ViewFile()`.
+/// nullptr restores the default, which views no files.
+/// @return Returns the function previously set.
+ViewFileFunction SetViewFileFunction(ViewFileFunction view_file_function);
+
+class FileBuffer;
+
+/// @brief A reference-counted, read-only view of a file's contents, returned
+/// by `LoadFileView()`. The contents stay valid while any copy of it exists.
+typedef std::shared_ptr<const FileBuffer> FileView;
+
+/// @class FileBuffer
+/// @brief The contents of a file, either mapped into memory or owned.
+class FileBuffer {
+ public:
+  ~FileBuffer();
+
+  /// @brief The contents of the file.
+  const uint8_t *data() const { return data_; }
+
+  /// @brief The size of the file, in bytes.
+  size_t size() const { return size_; }
+
+  /// @brief Whether the contents are mapped from the file with `mmap`,
+  /// rather than read into memory owned by this buffer.
+  bool is_mapped() const { return mapped_size_ != 0; }
+
+ private:
+  friend FileView LoadFileView(const char *filename);
+  friend FileView MakeFileView(std::string &&contents);
+
+  FileBuffer() : data_(nullptr), size_(0), mapped_size_(0) {}
+
+  const uint8_t *data_;
+  size_t size_;
+  // Non-zero if `data_` is a mapping of this many bytes.
+  size_t mapped_size_;
+  // Holds the contents when they had to be copied.
+  std::string storage_;
+  // Keeps the contents valid when they are viewed in place, e.g. the mapping
+  // of an AssetPack that may be closed while this buffer is in use.
+  std::shared_ptr<const void> owner_;
+};
+
+/// @brief Gets the contents of a file without copying them where possible.
+/// @details Files that `ViewFile()` can provide, e.g. those in a mounted
+/// `AssetPack`, are returned in place. Otherwise, if `LoadFile()` reads from
+/// the file system with `LoadFileRaw()`, large files are mapped into memory,
+/// so their pages are read on first use and are never copied. Anything else
+/// falls back on `LoadFile()`.
+/// @param[in] filename A UTF-8 C-string representing the file to load.
+/// @return Returns null if the file couldn't be loaded.
+FileView LoadFileView(const char *filename);
+
+/// @brief Wraps file contents that were already read into memory, e.g. by a
+/// `BatchFileReader`, in a `FileView`, without copying them.
+/// @param[in] contents The contents of the file, which are moved from.
+/// @return Returns a view of `contents`.
+FileView MakeFileView(std::string &&contents);
+
+/// @brief Gets the size of a file without reading it, where possible.
+/// @details Files that `ViewFile()` can provide are measured in place.
+/// Otherwise, if `LoadFile()` reads from the file system with `LoadFileRaw()`,
+/// calls `FileSizeRaw()`. The size of files only a custom load function can
+/// read is not known until they are read, so this returns `false` for them.
+/// @param[in] filename A UTF-8 C-string representing the file to check.
+/// @param[out] size Set to the size of the file, in bytes.
+/// @return Returns `false` if the size isn't known.
+bool FileSize(const char *filename, size_t *size);
+
+/// @class FileIndex
+/// @brief The names of the files that exist, so that looking for a file that
+/// doesn't costs a hash lookup rather than a failed `fopen()`.
+///
+/// Loaders often probe for files that may not exist, e.g. a texture in a
+/// compressed format before falling back to WebP. Once an index is set with
+/// `SetFileIndex()`, `FileExistsRaw()`, `LoadFileRaw()` and `FileSizeRaw()`
+/// check it first, and return `false` for files it doesn't have without
+/// touching the file system or logging an error:
+///
+///     std::unique_ptr<FileIndex> index(new FileIndex());
+///     index->AddDirectory(".");
+///     SetFileIndex(std::move(index));
+///
+/// The index only answers for files under the directories it was given, and
+/// relative directories are taken to be relative to the working directory,
+/// which must not change while the index is set. Names are compared once
+/// `./` components, repeated slashes and backslashes are dropped, and
+/// ignoring case on Windows and macOS. Files elsewhere, and names with a `..`
+/// after a directory, which may be a symlink, are looked for on the file
+/// system. Only the hashes of the names are kept. A collision means a file is
+/// looked for on the file system after all, never that an existing file is
+/// missed.
+class FileIndex {
+ public:
+  /// @brief Adds every file in a directory and its subdirectories, under the
+  /// names they would be loaded with, i.e. prefixed with `root` unless it is
+  /// `.`, and adds `root` with `AddRoot()`.
+  /// @return Returns `false` if the directory can't be read, or this platform
+  /// can't list directories (Android).
+  bool AddDirectory(const char *root);
+
+  /// @brief Adds a single file.
+  void AddFile(const char *filename);
+
+  /// @brief Declares that every file in `dir` and its subdirectories has
+  /// been added, so that `MayExist()` answers for them. `AddDirectory()`
+  /// calls this.
+  void AddRoot(const char *dir);
+
+  /// @brief Whether the file was added.
+  bool Contains(const char *filename) const;
+
+  /// @brief Returns `false` only if the file is in a directory added with
+  /// `AddRoot()`, but wasn't added itself.
+  bool MayExist(const char *filename) const;
+
+  /// @brief The number of files added.
+  size_t size() const { return hashes_.size(); }
+
+ private:
+  static uint64_t HashFileName(const std::string &normalized);
+  bool Covers(const std::string &normalized) const;
+
+  std::unordered_set<uint64_t> hashes_;
+  // The directories added with AddRoot(), normalized and ending in a slash,
+  // or empty for the working directory.
+  std::vector<std::string> roots_;
+};
+
+/// @brief Makes the raw file functions consult `index` before the file
+/// system. Pass null to go back to always checking the file system.
+void SetFileIndex(std::unique_ptr<FileIndex> index);
+
+/// @brief Returns `false` only if a file index is set, and knows that the
+/// file doesn't exist. See `FileIndex::MayExist()`.
+bool FileMayExist(const char *filename);
+
+/// @brief Adds a file to the file index set with `SetFileIndex()`, if any.
+/// `SaveFile()` calls this, so that files written later are found.
+void AddToFileIndex(const char *filename);
+
 /// @brief Save a string to a file, overwriting the existing contents.
 /// @param[in] filename A UTF-8 C-string representing the file to save to.
 /// @param[in] data A const reference to a `std::string` containing the data
@@ -76,6 +254,66 @@ bool SaveFile(const char *filename, const std::string &data);
 /// @return Returns `false` if the file could not be written.
 bool SaveFile(const char *filename, const void *data, size_t size);
 
+/// @brief Saves a file so that it either has the new contents or the old
+/// ones, even if the program or the device stops halfway.
+/// @details Writes to `filename` with ".tmp" appended, flushes that to the
+/// storage device with `fsync()`, and renames it over `filename`.
+/// @param[in] filename A UTF-8 C-string representing the file to save to.
+/// @param[in] data The contents to save.
+/// @param[in] size The size of `data`, in bytes.
+/// @return Returns `false`, and logs why, if the file could not be written.
+bool SaveFileAtomic(const char *filename, const void *data, size_t size);
+
+/// @class FileSave
+/// @brief The status of a save started by `SaveFileAsync()`.
+class FileSave {
+ public:
+  FileSave() : done_(false), success_(false) {}
+
+  /// @brief Whether the save has finished, successfully or not.
+  bool done() const;
+
+  /// @brief Whether the file was written. Only meaningful once `done()`.
+  bool success() const;
+
+  /// @brief Blocks until the save has finished.
+  /// @return Returns whether the file was written.
+  bool Wait();
+
+ private:
+  friend class FileSaver;
+  void Finish(bool success);
+
+  mutable std::mutex mutex_;
+  std::condition_variable finished_;
+  bool done_;
+  bool success_;
+};
+
+/// @brief Tracks a save started by `SaveFileAsync()`.
+typedef std::shared_ptr<FileSave> FileSaveHandle;
+
+/// @brief Saves a file on a background thread with `SaveFileAtomic()`, so
+/// that slow storage doesn't stall the caller.
+/// @details Saves are written in the order they were made. A save to a file
+/// that is still waiting to be written replaces the contents that were
+/// waiting, and both handles finish once the newest contents are written,
+/// so saving the same file every frame writes it only as often as the
+/// storage keeps up.
+/// @param[in] filename A UTF-8 C-string representing the file to save to.
+/// @param[in] data The contents to save. Pass an rvalue to avoid a copy.
+/// @return Returns a handle that tells when the save is done.
+FileSaveHandle SaveFileAsync(const char *filename, std::string data);
+
+/// @brief Like `SaveFileAsync()` above, but copies `size` bytes of `data`,
+/// which the caller may change as soon as this returns.
+FileSaveHandle SaveFileAsync(const char *filename, const void *data,
+                             size_t size);
+
+/// @brief Blocks until every save started by `SaveFileAsync()` so far has
+/// finished. Call it before exiting.
+void FlushFileSaves();
+
 /// @brief Search and change to a given directory.
 /// @param binary_dir A C-string corresponding to the current directory
 /// to start searching from.
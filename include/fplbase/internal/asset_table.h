@@ -0,0 +1,172 @@
+// Copyright 2017 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPLBASE_ASSET_TABLE_H
+#define FPLBASE_ASSET_TABLE_H
+
+#include <assert.h>
+#include <string>
+#include <vector>
+
+#include "fplbase/asset_id.h"
+
+namespace fplbase {
+
+// Maps asset names to assets, for AssetManager. An open-addressing hash table
+// with linear probing, keyed by AssetId, so a lookup by AssetId only compares
+// 64-bit hashes. `T` is a pointer to the asset type; null values can't be
+// stored.
+//
+// The table keeps one copy of each name, for iteration and so that lookups by
+// name also compare the names. Two names with the same AssetId are kept apart
+// by those; Find(AssetId) returns either of them.
+template <typename T>
+class AssetTable {
+ public:
+  AssetTable() : size_(0), num_used_(0) {}
+
+  // Returns the asset with the given id, or null.
+  T Find(AssetId id) const {
+    const Slot *slot = FindSlot(id, nullptr);
+    return slot ? slot->value : nullptr;
+  }
+
+  // Returns the asset with the given name, or null.
+  T Find(const char *name) const {
+    const Slot *slot = FindSlot(AssetIdFromName(name), name);
+    return slot ? slot->value : nullptr;
+  }
+
+  // Adds `value` under `name`, replacing any asset with the same name.
+  void Insert(const std::string &name, T value) {
+    assert(value);
+    // Keep at least half of the slots empty, so probes stay short.
+    if ((num_used_ + 1) * 2 > slots_.size()) {
+      Rehash(size_ * 4 > slots_.size() ? slots_.size() * 2 : slots_.size());
+    }
+    const AssetId id = AssetIdFromName(name);
+    Slot *free_slot = nullptr;
+    for (size_t i = Home(id);; i = Next(i)) {
+      Slot &slot = slots_[i];
+      if (slot.value && slot.id == id && slot.name == name) {
+        slot.value = value;
+        return;
+      }
+      if (!slot.value) {
+        if (!free_slot) free_slot = &slot;
+        if (!slot.deleted) break;
+      }
+    }
+    if (!free_slot->deleted) ++num_used_;
+    free_slot->id = id;
+    free_slot->name = name;
+    free_slot->value = value;
+    free_slot->deleted = false;
+    ++size_;
+  }
+
+  // Removes the asset with the given id or name. Returns false if there was
+  // none.
+  bool Erase(AssetId id) { return EraseSlot(FindSlot(id, nullptr)); }
+  bool Erase(const char *name) {
+    return EraseSlot(FindSlot(AssetIdFromName(name), name));
+  }
+  bool Erase(const std::string &name) { return Erase(name.c_str()); }
+
+  // Calls `func(name, value)` for every asset, in no particular order. `func`
+  // must not change the table.
+  template <typename F>
+  void ForEach(F func) const {
+    for (auto it = slots_.begin(); it != slots_.end(); ++it) {
+      if (it->value) func(it->name, it->value);
+    }
+  }
+
+  void Clear() {
+    slots_.clear();
+    size_ = 0;
+    num_used_ = 0;
+  }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+ private:
+  struct Slot {
+    Slot() : value(nullptr), deleted(false) {}
+    AssetId id;
+    T value;
+    // Whether an asset was erased from this slot. Lookups probe past these.
+    bool deleted;
+    std::string name;
+  };
+
+  // Returns the slot holding `id`, or null. If `name` isn't null, the slot's
+  // name must match too.
+  const Slot *FindSlot(AssetId id, const char *name) const {
+    if (slots_.empty()) return nullptr;
+    for (size_t i = Home(id);; i = Next(i)) {
+      const Slot &slot = slots_[i];
+      if (slot.id == id && slot.value && (!name || slot.name == name)) {
+        return &slot;
+      }
+      if (!slot.value && !slot.deleted) return nullptr;
+    }
+  }
+
+  bool EraseSlot(const Slot *found) {
+    if (!found) return false;
+    Slot &slot = slots_[found - slots_.data()];
+    // Leave a marker, so the probes for other ids don't stop here.
+    slot.value = nullptr;
+    slot.deleted = true;
+    std::string().swap(slot.name);
+    --size_;
+    return true;
+  }
+
+  size_t Home(AssetId id) const {
+    return static_cast<size_t>(id.hash()) & (slots_.size() - 1);
+  }
+  size_t Next(size_t i) const { return (i + 1) & (slots_.size() - 1); }
+
+  // Moves all assets to a table with `capacity` slots, dropping the deleted
+  // markers. `capacity` must be a power of two.
+  void Rehash(size_t capacity) {
+    if (capacity < kMinCapacity) capacity = kMinCapacity;
+    std::vector<Slot> old_slots(capacity);
+    old_slots.swap(slots_);
+    num_used_ = size_;
+    for (auto it = old_slots.begin(); it != old_slots.end(); ++it) {
+      if (!it->value) continue;
+      size_t i = Home(it->id);
+      while (slots_[i].value) i = Next(i);
+      slots_[i].id = it->id;
+      slots_[i].value = it->value;
+      slots_[i].name.swap(it->name);
+    }
+  }
+
+  static const size_t kMinCapacity = 16;
+
+  std::vector<Slot> slots_;
+  // Number of assets in the table.
+  size_t size_;
+  // Number of slots that hold an asset or a deleted marker.
+  size_t num_used_;
+};
+
+}  // namespace fplbase
+
+#endif  // FPLBASE_ASSET_TABLE_H
@@ -0,0 +1,81 @@
+// Copyright 2017 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPLBASE_IMAGE_KERNELS_H
+#define FPLBASE_IMAGE_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace fplbase {
+
+// Per-pixel operations on decoded images, for Texture. Each has a scalar
+// reference, and SIMD versions (SSE2, SSSE3 or AVX2 on x86, NEON on ARM) that
+// give exactly the same results. The fastest one the CPU supports is picked
+// the first time a kernel is called.
+
+// The reference for premultiplying a color channel by alpha: round(c * a /
+// 255), computed without a division as (c * a + 128) * 257 >> 16, which is
+// exact for all 8-bit `c` and `a`.
+inline uint8_t PremultiplyChannel(uint8_t c, uint8_t a) {
+  return static_cast<uint8_t>(((c * a + 128) * 257) >> 16);
+}
+
+// Premultiplies the RGB channels of `num_pixels` RGBA pixels by their alpha,
+// in place, with PremultiplyChannel().
+void MultiplyRgbByAlpha(uint8_t *rgba, size_t num_pixels);
+
+// The scalar version of MultiplyRgbByAlpha().
+void MultiplyRgbByAlphaReference(uint8_t *rgba, size_t num_pixels);
+
+// Converts `width` x `height` RGBA 8888 pixels to the 16-bit 5551 layout of
+// GL_UNSIGNED_SHORT_5_5_5_1. With `dither`, the color channels first get a
+// 4x4 ordered dither (see DitherOffset()); alpha is always thresholded at
+// 128. `dest` may point to the same memory as `src`, to convert in place.
+void ConvertRgba8888ToRgba5551(const uint8_t *src, int width, int height,
+                               bool dither, uint16_t *dest);
+
+// Converts RGB 888 pixels to the 16-bit 565 layout of
+// GL_UNSIGNED_SHORT_5_6_5, like ConvertRgba8888ToRgba5551().
+void ConvertRgb888ToRgb565(const uint8_t *src, int width, int height,
+                           bool dither, uint16_t *dest);
+
+// The scalar versions of the conversions above.
+void ConvertRgba8888ToRgba5551Reference(const uint8_t *src, int width,
+                                        int height, bool dither,
+                                        uint16_t *dest);
+void ConvertRgb888ToRgb565Reference(const uint8_t *src, int width, int height,
+                                    bool dither, uint16_t *dest);
+
+// What the conversions add to a channel at pixel (x, y) before truncating it
+// to `bits` bits, saturating at 255: a 4x4 Bayer matrix, scaled to the step
+// between the values `bits` bits can represent.
+inline uint8_t DitherOffset(int x, int y, int bits) {
+  static const uint8_t kBayer4x4[4][4] = {
+      {0, 8, 2, 10}, {12, 4, 14, 6}, {3, 11, 1, 9}, {15, 7, 13, 5}};
+  return static_cast<uint8_t>(kBayer4x4[y & 3][x & 3] >> (bits - 4));
+}
+
+// A buffer of at least `size` bytes that belongs to the calling thread, for
+// temporary results such as converted pixels. It stays valid until the next
+// call on the same thread, and is reused rather than freed.
+void *ThreadScratchBuffer(size_t size);
+
+// The newest instruction set the kernels use on this CPU: "avx2", "ssse3",
+// "sse2", "neon" or "scalar".
+const char *ImageKernelsInstructionSet();
+
+}  // namespace fplbase
+
+#endif  // FPLBASE_IMAGE_KERNELS_H
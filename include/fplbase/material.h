@@ -20,7 +20,8 @@
 
 #include "fplbase/config.h"  // Must come first.
 
-#include "fplbase/asset.h"
+#include "fplbase/async_loader.h"
+#include "fplbase/file_utilities.h"
 #include "fplbase/render_state.h"
 #include "fplbase/texture.h"
 #include "materials_generated.h"
@@ -35,10 +36,46 @@ class Renderer;
 class Texture;
 
 /// @brief Collections of textures used for rendering multi-texture models.
-class Material : public Asset {
+///
+/// A material loaded from a file counts as finalized once its textures are.
+/// One built in code has nothing to load, so it is finalized right away.
+class Material : public AsyncAsset {
  public:
-  /// @brief Default constructor for Material.
-  Material() : blend_mode_(kBlendModeOff) {}
+  /// @brief Default constructor for Material. The material is finalized.
+  Material() : blend_mode_(kBlendModeOff), valid_(true) {
+    CallFinalizeCallback();
+  }
+
+  /// @brief Construct a Material to be loaded from a .fplmat file, with
+  /// LoadNow() or by an AsyncLoader.
+  /// @param[in] filename The file to load.
+  /// @param[in] tlf Loads the textures of the material, when it is
+  /// finalized.
+  Material(const char *filename, const TextureLoaderFn &tlf)
+      : AsyncAsset(filename),
+        blend_mode_(kBlendModeOff),
+        texture_loader_(tlf),
+        valid_(false) {}
+
+  /// @brief Reads the file, the same as Read() then Decode().
+  virtual void Load();
+
+  /// @brief Reads the file of the material.
+  virtual void Read();
+
+  /// @brief The file Read() reads, which the loader may read ahead.
+  virtual const char *ReadAheadFile() const { return filename_.c_str(); }
+
+  /// @brief Verifies the file read by Read().
+  virtual void Decode();
+
+  /// @brief Loads the textures of the material. The material is finalized
+  /// once they are.
+  virtual bool Finalize();
+
+  /// @brief Whether the material file was loaded. Its textures may still be
+  /// loading, or may have failed to.
+  virtual bool IsValid() { return valid_; }
 
   /// @brief Set the renderer for this Material.
   /// @param[in] renderer The renderer to set for this Material.
@@ -72,27 +109,42 @@ class Material : public Asset {
   void DeleteTextures();
 
   /// @brief Create a Material from the specified flatbuffer matdef::Material*.
+  /// The material is finalized once its textures are.
   static Material *LoadFromMaterialDef(const matdef::Material *matdef,
                                        const TextureLoaderFn &tlf);
 
+  /// @brief Calls `func` with the filename, format and flags of each texture
+  /// in `matdef`, in order, as LoadFromMaterialDef() passes them to its
+  /// TextureLoaderFn. Doesn't load anything.
+  static void ForEachTexture(
+      const matdef::Material *matdef,
+      const std::function<void(const char *filename, TextureFormat format,
+                               TextureFlags flags)> &func);
+
   /// @brief Load a .fplmat file, and all the textures referenced from it.
   /// Used by the more convenient AssetManager interface, but can be used
   /// without it.
   static Material *LoadFromMaterialDef(const char *filename,
                                        const TextureLoaderFn &tlf);
 
-  /// @brief The filename that was the source of the material, if this
-  /// material was loaded from a file.
-  const std::string& filename() const { return filename_; }
+ private:
+  // Constructs a Material for LoadFromMaterialDef(), which is only finalized
+  // once the textures InitFromMaterialDef() loads are.
+  explicit Material(const TextureLoaderFn &tlf)
+      : blend_mode_(kBlendModeOff), texture_loader_(tlf), valid_(true) {}
 
-  /// @brief Setter for The filename that is the source of the
-  /// material.
-  void set_filename(const std::string& filename) { filename_ = filename; }
+  // Sets the blend mode, and loads the textures with `tlf`.
+  bool InitFromMaterialDef(const matdef::Material *matdef,
+                           const TextureLoaderFn &tlf);
+  // Calls CallFinalizeCallbackAfter() with the textures.
+  void FinalizeAfterTextures();
 
- private:
-  std::string filename_;
   std::vector<Texture *> textures_;
   BlendMode blend_mode_;
+  TextureLoaderFn texture_loader_;
+  // The file read by Read(), waiting for Finalize().
+  FileView file_;
+  bool valid_;
 };
 
 /// @}
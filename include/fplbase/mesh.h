@@ -104,9 +104,29 @@ class Mesh : public AsyncAsset {
   /// @brief Loads and unpacks the Mesh from 'filename_' and 'data_'.
   virtual void Load();
 
+  /// @brief Loads the file for 'filename_' into 'data_', the first half of
+  /// Load().
+  virtual void Read();
+
+  /// @brief The file Read() reads, which the loader may read ahead.
+  virtual const char *ReadAheadFile() const { return filename_.c_str(); }
+
+  /// @brief Verifies the FlatBuffer in 'data_', the second half of Load().
+  virtual void Decode();
+
   /// @brief Creates a mesh from 'data_'.
   virtual bool Finalize();
 
+  /// @brief The size of the FlatBuffer in 'data_'.
+  virtual size_t UploadSize() const;
+
+  /// @brief The size of the vertex and index buffers.
+  virtual size_t GpuMemorySize() const;
+
+  /// @brief The size of the FlatBuffer, if not finalized yet, and the bone
+  /// data.
+  virtual size_t CpuMemorySize() const;
+
   /// @brief Whether this object loaded and finalized correctly. Call after
   /// Finalize has been called (by AssetManager::TryFinalize).
   bool IsValid();
@@ -389,11 +409,14 @@ class Mesh : public AsyncAsset {
           ibo(InvalidBufferHandle()),
           mat(nullptr),
           index_type(0),
+          index_size(0),
           indexBufferMem(InvalidDeviceMemoryHandle()) {}
     int count;
     BufferHandle ibo;
     Material *mat;
     uint32_t index_type;
+    // Bytes per index.
+    size_t index_size;
     DeviceMemoryHandle indexBufferMem;
   };
 
@@ -241,6 +241,13 @@ class RendererBase {
   /// @brief Returns if multiview capabilities are supported by the hardware.
   bool SupportsMultiview() const;
 
+  /// @brief Returns if mipmaps can be generated for 16bpp textures, as
+  /// queried once by Initialize(). See MipmapGeneration16bppSupported().
+  ///
+  /// Can be called from the loader threads, unlike
+  /// MipmapGeneration16bppSupported(), which may call into Java on Android.
+  bool SupportsMipmapGeneration16bpp() const;
+
   // For internal use only.
   RendererBaseImpl* impl() { return impl_; }
 
@@ -281,6 +288,7 @@ class RendererBase {
   bool supports_texture_npot_;
   bool supports_multiview_;
   bool supports_instancing_;
+  bool supports_mipmap_generation_16bpp_;
 
   Shader *force_shader_;
   BlendMode force_blend_mode_;
@@ -600,6 +608,11 @@ class Renderer {
     return base_->SupportsTextureNpot();
   }
 
+  /// @brief Returns if mipmaps can be generated for 16bpp textures.
+  bool SupportsMipmapGeneration16bpp() const {
+    return base_->SupportsMipmapGeneration16bpp();
+  }
+
   /// @brief Returns the current render state.
   const RenderState &GetRenderState() const { return render_state_; }
 
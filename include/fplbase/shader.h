@@ -195,6 +195,16 @@ class Shader : public AsyncAsset {
   /// used without it.
   static Shader *LoadFromShaderDef(const char *filename);
 
+  /// @brief Whether `filename_` is a .fplshader file built by shader_pipeline,
+  /// rather than the basename of a .glslv and .glslf pair.
+  bool from_shader_def() const { return from_shader_def_; }
+
+  /// @brief Load `filename_` as a .fplshader file. Set before loading the
+  /// shader with LoadNow() or an AsyncLoader.
+  void set_from_shader_def(bool from_shader_def) {
+    from_shader_def_ = from_shader_def;
+  }
+
  private:
   friend class Renderer;
   friend class RendererBase;
@@ -217,6 +227,7 @@ class Shader : public AsyncAsset {
   bool ReloadInternal();
 
   ShaderSourcePair *LoadSourceFile();
+  ShaderSourcePair *LoadShaderDefFile();
 
   // Backend-specific create and destroy calls. These just call new and delete
   // on the platform-specific impl structs.
@@ -249,6 +260,9 @@ class Shader : public AsyncAsset {
 
   // If true, means this shader needs to be reloaded.
   bool dirty_;
+
+  // If true, `filename_` is a .fplshader file.
+  bool from_shader_def_;
 };
 
 /// @}
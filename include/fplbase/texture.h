@@ -20,6 +20,7 @@
 #include "fplbase/config.h"  // Must come first.
 
 #include "fplbase/async_loader.h"
+#include "fplbase/file_utilities.h"
 #include "fplbase/handles.h"
 #include "mathfu/constants.h"
 #include "mathfu/glsl_mappings.h"
@@ -63,6 +64,9 @@ enum TextureFlags {
   /// Premultiply by alpha on load.
   /// Not supported for ASTC, PKM, or KTX images.
   kTextureFlagsPremultiplyAlpha = 1 << 4,
+  /// Dither 8-bit images when converting them to 5551 or 565, which trades
+  /// banding in gradients for fine noise.
+  kTextureFlagsDither16Bit = 1 << 5,
 };
 
 inline TextureFlags operator|(TextureFlags a, TextureFlags b) {
@@ -97,12 +101,29 @@ inline bool IsCompressed(TextureFormat format) {
   }
 }
 
+/// @brief The format that data of `format` is uploaded as, when `desired` is
+/// asked for.
+inline TextureFormat UploadFormat(TextureFormat format, TextureFormat desired) {
+  if (desired == kFormatAuto) {
+    return IsCompressed(format) ? format
+                                : HasAlpha(format) ? kFormat5551 : kFormat565;
+  }
+  return desired == kFormatNative ? format : desired;
+}
+
 /// @class Texture
 /// @brief Abstraction for a texture object loaded on the GPU.
 ///
 /// Contains functions for loading, marshalling, and disposal of textures.
 class Texture : public AsyncAsset {
  public:
+  /// @brief Called on a loader thread once the file of a texture is read and
+  /// hashed, see set_find_duplicate().
+  /// @return Returns a finalized texture with the same content_hash(),
+  /// content_size(), desired format, flags and scale, whose GPU texture the
+  /// texture should share instead of decoding its own, or null.
+  typedef std::function<Texture *(Texture *texture)> DuplicateFinder;
+
   /// @brief Constructor for a Texture.
   explicit Texture(const char *filename = nullptr,
                    TextureFormat format = kFormatAuto,
@@ -116,6 +137,18 @@ class Texture : public AsyncAsset {
   /// also sets the original size, if it has not yet been set.
   virtual void Load();
 
+  /// @brief Loads the file for `filename_`, the first half of Load().
+  virtual void Read();
+
+  /// @brief The file Read() reads, which the loader may read ahead: null for
+  /// compressed textures the renderer can't upload, which are loaded from a
+  /// WebP file instead.
+  virtual const char *ReadAheadFile() const;
+
+  /// @brief Unpacks the file loaded by Read() into `data_`, the second half
+  /// of Load().
+  virtual void Decode();
+
   /// @brief Create a texture from data in memory.
   /// @param[in] data The Texture data in memory to load from.
   /// @param[in] size A const `mathfu::vec2i` reference to the original
@@ -127,6 +160,16 @@ class Texture : public AsyncAsset {
   /// @brief Creates a Texture from `data_` and stores the handle in `id_`.
   virtual bool Finalize();
 
+  /// @brief The approximate size of the pixel data in `data_`.
+  virtual size_t UploadSize() const;
+
+  /// @brief The approximate size of the texture on the GPU, including its
+  /// mipmaps.
+  virtual size_t GpuMemorySize() const;
+
+  /// @brief The size of the file and pixel data the texture still holds.
+  virtual size_t CpuMemorySize() const;
+
   /// @brief Whether this object loaded and finalized correctly. Call after
   /// Finalize has been called (by AssetManager::TryFinalize).
   bool IsValid() { return ValidTextureHandle(id_); }
@@ -304,12 +347,14 @@ class Texture : public AsyncAsset {
 
   /// @brief Utility function to convert 32bit RGBA (8-bits each) to 16bit RGB
   /// in hex 5551 format.
-  /// @note You must `delete[]` the return value afterwards.
+  /// @note You must `delete[]` the return value afterwards. To convert
+  /// without allocating, or with dithering, use ConvertRgba8888ToRgba5551().
   static uint16_t *Convert8888To5551(const uint8_t *buffer,
                                      const mathfu::vec2i &size);
   /// @brief Utility function to convert 24bit RGB (8-bits each) to 16bit RGB in
   /// hex 565 format.
-  /// @note You must `delete[]` the return value afterwards.
+  /// @note You must `delete[]` the return value afterwards. To convert
+  /// without allocating, or with dithering, use ConvertRgb888ToRgb565().
   static uint16_t *Convert888To565(const uint8_t *buffer,
                                    const mathfu::vec2i &size);
 
@@ -368,6 +413,28 @@ class Texture : public AsyncAsset {
   /// @return Returns the texture format.
   TextureFormat format() const { return texture_format_; }
 
+  /// @brief The format the texture was asked to be created in.
+  TextureFormat desired_format() const { return desired_; }
+
+  /// @brief Hash the file of the texture when it is read, and share the GPU
+  /// texture of the one `find_duplicate` returns, if any, instead of decoding
+  /// and uploading the file again. Must be called before the texture is
+  /// loaded.
+  void set_find_duplicate(const DuplicateFinder &find_duplicate) {
+    find_duplicate_ = find_duplicate;
+  }
+
+  /// @brief A hash of the contents of the texture's file, or 0 if it was not
+  /// hashed. See set_find_duplicate().
+  uint64_t content_hash() const { return content_hash_; }
+
+  /// @brief The size of the texture's file, if it was hashed.
+  size_t content_size() const { return content_size_; }
+
+  /// @brief The texture whose GPU texture this one shares, or null. The
+  /// shared texture must outlive this one.
+  Texture *shared_texture() const { return shared_; }
+
   /// @brief If the original size has not yet been set, then set it.
   /// @param[in] size A `mathfu::vec2i` containing the original Texture
   /// `x` and `y` sizes.
@@ -424,6 +491,28 @@ class Texture : public AsyncAsset {
   /// @brief Backend specific conversion of flags to TextureTarget.
   static TextureTarget TextureTargetFromFlags(TextureFlags flags);
 
+  // Converts `data_` to the 16-bit format CreateTexture() would upload it
+  // as, in place, so that Finalize() can upload it directly.
+  // `mipmap_16bpp_supported` is RendererBase::SupportsMipmapGeneration16bpp().
+  void ConvertForUpload(bool mipmap_16bpp_supported);
+
+  // Frees `data_`, or releases `file_` if it points into that.
+  void FreeData();
+
+  // The two halves of LoadAndUnpackTexture(). LoadTextureFile() loads the file,
+  // falling back on WebP in the same way, and returns the extension of the
+  // file it actually loaded in `ext`. If `texture` isn't null, the file is
+  // loaded with its LoadReadFile(). UnpackTextureFile() unpacks it.
+  static FileView LoadTextureFile(const char *filename, std::string *ext,
+                                  Texture *texture = nullptr);
+  static uint8_t *UnpackTextureFile(const char *filename,
+                                    const FileBuffer &file,
+                                    const std::string &ext,
+                                    const mathfu::vec2 &scale,
+                                    TextureFlags flags,
+                                    mathfu::vec2i *dimensions,
+                                    TextureFormat *texture_format);
+
   TextureImpl *impl_;
   TextureHandle id_;
   mathfu::vec2i size_;
@@ -434,6 +523,15 @@ class Texture : public AsyncAsset {
   TextureFormat desired_;
   TextureFlags flags_;
   bool is_external_;
+  // The file loaded by Read(), and its extension, waiting for Decode(). ASTC,
+  // PKM and KTX files are kept until Finalize(), with `data_` pointing into
+  // the file.
+  FileView file_;
+  std::string file_ext_;
+  DuplicateFinder find_duplicate_;
+  uint64_t content_hash_;
+  size_t content_size_;
+  Texture *shared_;
 };
 
 /// @brief used by some functions to allow the texture loading mechanism to
@@ -20,7 +20,9 @@
 #include <vector>
 
 #include "fplbase/config.h"  // Must come first.
-#include "fplbase/asset.h"
+#include "fplbase/async_loader.h"
+#include "fplbase/file_utilities.h"
+#include "fplbase/texture.h"
 
 namespace fplbase {
 
@@ -39,18 +41,57 @@ class Texture;
 /// index_map. Subtexture bounding boxes are returned in normalized texture
 /// coordinates, and take the form (u, v, width, height).
 ///
+/// A TextureAtlas loaded from a file counts as finalized once its texture is.
+///
 /// @warning This is will very likely be refactored.
-class TextureAtlas : public Asset {
+class TextureAtlas : public AsyncAsset {
  public:
-  TextureAtlas() : atlas_texture_(nullptr) {}
+  TextureAtlas()
+      : atlas_texture_(nullptr),
+        format_(kFormatAuto),
+        flags_(kTextureFlagsNone) {}
+
+  /// @brief Construct a TextureAtlas to be loaded from a file, with LoadNow()
+  /// or by an AsyncLoader.
+  /// @param[in] filename The file to load.
+  /// @param[in] format The format of the atlas texture.
+  /// @param[in] flags The flags of the atlas texture.
+  /// @param[in] tlf Loads the atlas texture, when the atlas is finalized.
+  TextureAtlas(const char *filename, TextureFormat format, TextureFlags flags,
+               const TextureLoaderFn &tlf)
+      : AsyncAsset(filename),
+        atlas_texture_(nullptr),
+        format_(format),
+        flags_(flags),
+        texture_loader_(tlf) {}
+
   ~TextureAtlas() { Delete(); }
 
   /// @brief Delete the texture associated with this atlas.
   void Delete() {
-    atlas_texture_->Delete();
+    if (atlas_texture_) atlas_texture_->Delete();
     atlas_texture_ = nullptr;
   }
 
+  /// @brief Reads the file, the same as Read() then Decode().
+  virtual void Load();
+
+  /// @brief Reads the atlas file.
+  virtual void Read();
+
+  /// @brief The file Read() reads, which the loader may read ahead.
+  virtual const char *ReadAheadFile() const { return filename_.c_str(); }
+
+  /// @brief Verifies the file read by Read().
+  virtual void Decode();
+
+  /// @brief Reads the subtexture bounds and loads the atlas texture. The
+  /// atlas is finalized once the texture is.
+  virtual bool Finalize();
+
+  /// @brief Whether the atlas file was loaded.
+  virtual bool IsValid() { return atlas_texture_ != nullptr; }
+
   /// @brief Get the bounds of a subtexture associated with name.
   ///
   /// @param name Name of the subtexture to lookup.
@@ -122,6 +163,12 @@ class TextureAtlas : public Asset {
  private:
   // Texture being used by this atlas.
   Texture *atlas_texture_;
+  // Passed to texture_loader_ to load atlas_texture_.
+  TextureFormat format_;
+  TextureFlags flags_;
+  TextureLoaderFn texture_loader_;
+  // The file read by Read(), waiting for Finalize().
+  FileView file_;
   // List of bounds (offsetx, offsety, sizex, sizey) of each subtexture.
   std::vector<vec4> subtexture_bounds_;
   // Map of subtexture names to indices into subtexture_bounds_.
@@ -133,7 +133,9 @@ void UnmapFile(const void *file, int32_t size);
 
 /// @brief check if 16bpp MipMap is supported.
 /// @return Return `true` if 16bpp MipMap generation is supported.
-/// @note Basically always true, except on certain android devices.
+/// @note Basically always true, except on certain android devices. Call on
+/// the render thread only, since on Android this calls into Java; other
+/// threads should use `RendererBase::SupportsMipmapGeneration16bpp()`.
 bool MipmapGeneration16bppSupported();
 
 /// @brief Get the system's RAM size.
@@ -25,7 +25,12 @@ FPLBASE_DIR := $(LOCAL_PATH)
 
 FPLBASE_COMMON_SRC_FILES := \
   src/asset_manager.cpp \
+  src/asset_pack.cpp \
+  src/async_loader_common.cpp \
+  src/batch_file_reader.cpp \
+  src/file_saver.cpp \
   src/gpu_debug_gl.cpp \
+  src/image_kernels.cpp \
   src/input.cpp \
   src/material.cpp \
   src/mesh_common.cpp \
@@ -74,7 +79,9 @@ FPLBASE_SCHEMA_DIR := $(FPLBASE_DIR)/schemas
 FPLBASE_SCHEMA_INCLUDE_DIRS :=
 
 FPLBASE_SCHEMA_FILES := \
+  $(FPLBASE_SCHEMA_DIR)/asset_pack.fbs \
   $(FPLBASE_SCHEMA_DIR)/common.fbs \
+  $(FPLBASE_SCHEMA_DIR)/load_manifest.fbs \
   $(FPLBASE_SCHEMA_DIR)/materials.fbs \
   $(FPLBASE_SCHEMA_DIR)/mesh.fbs \
   $(FPLBASE_SCHEMA_DIR)/shader.fbs \
@@ -0,0 +1,195 @@
+// Copyright 2017 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "pack_pipeline.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#include "asset_pack_generated.h"
+#include "fplbase/asset_pack.h"
+#include "fplbase/utilities.h"
+
+namespace fplbase {
+
+// The size of the table of contents, and 4 bytes of padding. See
+// schemas/asset_pack.fbs.
+static const size_t kPackHeaderSize = 8;
+
+struct PackFile {
+  std::string name;  // Relative to the input directory, with '/'.
+  std::string path;
+  uint64_t size;
+};
+
+static bool operator<(const PackFile& a, const PackFile& b) {
+  return a.name < b.name;
+}
+
+static uint64_t AlignUp(uint64_t n, uint64_t alignment) {
+  return (n + alignment - 1) / alignment * alignment;
+}
+
+// Adds every file under `dir` to `files`, recursively.
+static bool ListFiles(const std::string& dir, const std::string& prefix,
+                      std::vector<PackFile>* files) {
+#ifdef _WIN32
+  struct _finddata_t info;
+  intptr_t handle = _findfirst((dir + "/*").c_str(), &info);
+  if (handle == -1) return false;
+  bool ok = true;
+  do {
+    const std::string name = info.name;
+    if (name == "." || name == "..") continue;
+    if (info.attrib & _A_SUBDIR) {
+      ok = ListFiles(dir + "/" + name, prefix + name + "/", files) && ok;
+    } else {
+      PackFile file;
+      file.name = prefix + name;
+      file.path = dir + "/" + name;
+      file.size = static_cast<uint64_t>(info.size);
+      files->push_back(file);
+    }
+  } while (_findnext(handle, &info) == 0);
+  _findclose(handle);
+  return ok;
+#else
+  DIR* d = opendir(dir.c_str());
+  if (!d) return false;
+  bool ok = true;
+  while (struct dirent* entry = readdir(d)) {
+    const std::string name = entry->d_name;
+    if (name == "." || name == "..") continue;
+    const std::string path = dir + "/" + name;
+    struct stat sb;
+    if (stat(path.c_str(), &sb) != 0) {
+      ok = false;
+    } else if (S_ISDIR(sb.st_mode)) {
+      ok = ListFiles(path, prefix + name + "/", files) && ok;
+    } else if (S_ISREG(sb.st_mode)) {
+      PackFile file;
+      file.name = prefix + name;
+      file.path = path;
+      file.size = static_cast<uint64_t>(sb.st_size);
+      files->push_back(file);
+    }
+  }
+  closedir(d);
+  return ok;
+#endif
+}
+
+// Builds the table of contents for files laid out from `data_start` on.
+static void BuildTableOfContents(const std::vector<PackFile>& files,
+                                 uint64_t data_start, uint32_t alignment,
+                                 flatbuffers::FlatBufferBuilder* fbb) {
+  fbb->Clear();
+  // Write every field, so the size doesn't depend on the offsets.
+  fbb->ForceDefaults(true);
+  std::vector<flatbuffers::Offset<packdef::PackEntry>> entries;
+  uint64_t offset = data_start;
+  for (auto it = files.begin(); it != files.end(); ++it) {
+    offset = AlignUp(offset, alignment);
+    entries.push_back(packdef::CreatePackEntry(
+        *fbb, fbb->CreateString(it->name), offset, it->size));
+    offset += it->size;
+  }
+  auto pack = packdef::CreatePack(*fbb, kAssetPackVersion, alignment,
+                                  fbb->CreateVectorOfSortedTables(&entries));
+  packdef::FinishPackBuffer(*fbb, pack);
+}
+
+static bool WritePadding(uint64_t to, uint64_t* position, FILE* file) {
+  static const char kZeros[256] = {0};
+  while (*position < to) {
+    const size_t n =
+        static_cast<size_t>(std::min<uint64_t>(to - *position, sizeof(kZeros)));
+    if (fwrite(kZeros, 1, n, file) != n) return false;
+    *position += n;
+  }
+  return true;
+}
+
+int RunPackPipeline(const PackPipelineArgs& args) {
+  const uint32_t alignment =
+      args.alignment ? args.alignment : kAssetPackDefaultAlignment;
+
+  std::vector<PackFile> files;
+  if (!ListFiles(args.input_dir, "", &files)) {
+    printf("Unable to list the files in %s\n", args.input_dir.c_str());
+    return 1;
+  }
+  // Same order as the table of contents, which is sorted for lookups.
+  std::sort(files.begin(), files.end());
+
+  // The table of contents holds the offsets of the files, which come after
+  // it, so size it first.
+  flatbuffers::FlatBufferBuilder fbb;
+  BuildTableOfContents(files, 0, alignment, &fbb);
+  const size_t toc_size = fbb.GetSize();
+  const uint64_t data_start = AlignUp(kPackHeaderSize + toc_size, alignment);
+  BuildTableOfContents(files, data_start, alignment, &fbb);
+  if (fbb.GetSize() != toc_size) {
+    printf("Table of contents changed size while building it.\n");
+    return 1;
+  }
+
+  FILE* out = fopen(args.output_file.c_str(), "wb");
+  if (!out) {
+    printf("Could not open %s for writing.\n", args.output_file.c_str());
+    return 1;
+  }
+  uint8_t header[kPackHeaderSize] = {0};
+  flatbuffers::WriteScalar(header, static_cast<uint32_t>(toc_size));
+  bool ok = fwrite(header, 1, sizeof(header), out) == sizeof(header) &&
+            fwrite(fbb.GetBufferPointer(), 1, toc_size, out) == toc_size;
+  uint64_t position = kPackHeaderSize + toc_size;
+
+  std::string contents;
+  for (auto it = files.begin(); ok && it != files.end(); ++it) {
+    // LoadFileRaw() treats empty files as failures, but they belong in the
+    // pack like any other file.
+    contents.clear();
+    if (it->size != 0 && (!LoadFileRaw(it->path.c_str(), &contents) ||
+                          contents.size() != it->size)) {
+      printf("Unable to load file: %s\n", it->path.c_str());
+      ok = false;
+      break;
+    }
+    ok = WritePadding(AlignUp(position, alignment), &position, out) &&
+         fwrite(contents.data(), 1, contents.size(), out) == contents.size();
+    position += contents.size();
+  }
+  if (fclose(out) != 0) ok = false;
+  if (!ok) {
+    printf("Could not write %s\n", args.output_file.c_str());
+    remove(args.output_file.c_str());
+    return 1;
+  }
+  printf("Packed %d files into %s\n", static_cast<int>(files.size()),
+         args.output_file.c_str());
+  return 0;
+}
+
+}  // namespace fplbase
@@ -0,0 +1,34 @@
+// Copyright 2017 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPLBASE_PACK_PIPELINE_H_
+#define FPLBASE_PACK_PIPELINE_H_
+
+#include <stdint.h>
+#include <string>
+
+namespace fplbase {
+
+struct PackPipelineArgs {
+  PackPipelineArgs() : alignment(0) {}
+  std::string input_dir;    /// Directory whose files go into the pack.
+  std::string output_file;  /// The output fplpack file.
+  uint32_t alignment;       /// Alignment of the files, 0 for the default.
+};
+
+int RunPackPipeline(const PackPipelineArgs& args);
+
+}  // namespace fplbase
+
+#endif  // FPLBASE_PACK_PIPELINE_H_
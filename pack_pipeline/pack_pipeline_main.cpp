@@ -0,0 +1,80 @@
+// Copyright 2017 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pack_pipeline.h"
+
+static bool ParsePackPipelineArgs(int argc, char** argv,
+                                  fplbase::PackPipelineArgs* args) {
+  bool valid_args = argc >= 3;
+
+  // The last two parameters are the input directory and the output file.
+  if (valid_args) {
+    args->input_dir = std::string(argv[argc - 2]);
+    args->output_file = std::string(argv[argc - 1]);
+  }
+
+  // Parse switches.
+  for (int i = 1; valid_args && i < argc - 2; ++i) {
+    const std::string arg = argv[i];
+
+    // -a switch
+    if (arg == "-a" || arg == "--alignment") {
+      if (i < argc - 3) {
+        ++i;
+        const int alignment = atoi(argv[i]);
+        if (alignment > 0) {
+          args->alignment = static_cast<uint32_t>(alignment);
+        } else {
+          valid_args = false;
+        }
+      } else {
+        valid_args = false;
+      }
+
+      // all other (non-empty) arguments
+    } else if (arg != "") {
+      printf("Unknown parameter: %s\n", arg.c_str());
+      valid_args = false;
+    }
+  }
+
+  // Print usage.
+  if (!valid_args) {
+    printf(
+        "Usage: pack_pipeline [-a ALIGNMENT] INPUT_DIR OUTPUT_FILE\n"
+        "\n"
+        "Pipeline to pack all files under a directory into one fplpack file,\n"
+        "for fplbase::AssetPack. Files are named by their path relative to\n"
+        "INPUT_DIR, so run the game from INPUT_DIR.\n"
+        "\n"
+        "Options:\n"
+        "  -a, --alignment ALIGNMENT  Alignment of the files in bytes,\n"
+        "                             16 by default.\n");
+  }
+
+  return valid_args;
+}
+
+int main(int argc, char** argv) {
+  // Parse the command line arguments.
+  fplbase::PackPipelineArgs args;
+  if (!ParsePackPipelineArgs(argc, argv, &args)) {
+    return 1;
+  }
+  return fplbase::RunPackPipeline(args);
+}
@@ -51,15 +51,20 @@ int RunShaderPipeline(const ShaderPipelineArgs& args) {
   // loader will use the previous file loader for the actual loading operation.
   fplbase::SetLoadFileFunction([&load_fn, &args](const char* filename,
                                                  std::string* dest) {
+    // Only #included files are searched for in the include dirs. Check that
+    // each place they may be exists first, so the misses aren't logged as
+    // load failures.
+    const bool is_include = args.vertex_shader.compare(filename) != 0 &&
+                            args.fragment_shader.compare(filename) != 0;
+
     // First try to load the file at the given path.
-    if (load_fn(filename, dest)) {
+    if ((!is_include || fplbase::FileExistsRaw(filename)) &&
+        load_fn(filename, dest)) {
       return true;
     }
 
-    // Otherwise, try to load from each of the include dirs (but only for
-    // #included files).
-    if (args.vertex_shader.compare(filename) != 0 &&
-        args.fragment_shader.compare(filename) != 0) {
+    // Otherwise, try to load from each of the include dirs.
+    if (is_include) {
       std::string path;
       for (const auto& dir : args.include_dirs) {
         path = dir;
@@ -67,7 +72,8 @@ int RunShaderPipeline(const ShaderPipelineArgs& args) {
           path += '/';
         }
         path += filename;
-        if (load_fn(path.c_str(), dest)) {
+        if (fplbase::FileExistsRaw(path.c_str()) &&
+            load_fn(path.c_str(), dest)) {
           return true;
         }
       }
@@ -18,6 +18,8 @@
 #include "fplbase/texture.h"
 #include "fplbase/preprocessor.h"
 #include "fplbase/utilities.h"
+#include "load_manifest_generated.h"
+#include "materials_generated.h"
 #include "mesh_generated.h"
 
 using mathfu::mat4;
@@ -29,8 +31,12 @@ using mathfu::vec4i;
 
 namespace fplbase {
 
+// Bump when the meaning of the fields in load_manifest.fbs changes.
+static const uint32_t kLoadManifestVersion = 1;
+
 void FileAsset::Load() {
   if (LoadFile(filename_.c_str(), &contents)) {
+    load_stats_.bytes_read = contents.size();
     // This is just to signal the load succeeded. data_ doesn't own the memory.
     data_ = reinterpret_cast<const uint8_t *>(contents.c_str());
   }
@@ -38,252 +44,1266 @@ void FileAsset::Load() {
 
 bool FileAsset::Finalize() {
   // Since the asset was already "created", this is all we have to do here.
+  valid_ = data_ != nullptr;
   data_ = nullptr;
   CallFinalizeCallback();
-  return true;
+  return valid_;
+}
+
+bool FileAsset::IsValid() { return valid_; }
+
+void AssetGroup::then(const AsyncAsset::AssetFinalizedCallback &callback) {
+  if (finalized_) {
+    callback();
+  } else {
+    callbacks_.push_back(callback);
+  }
+}
+
+void AssetGroup::Add(AsyncAsset *asset, size_t file_size) {
+  auto inserted = members_.insert(std::make_pair(asset, Member()));
+  Member &member = inserted.first->second;
+  if (inserted.second) {
+    member.file_size = 0;
+    member.done = false;
+    ++progress_.assets_total;
+  }
+  if (member.file_size == 0 && file_size > 0) {
+    member.file_size = file_size;
+    progress_.bytes_total += file_size;
+    if (member.done) progress_.bytes_done += file_size;
+  }
+  if (!inserted.second) return;
+  std::weak_ptr<AssetGroup> group = self_;
+  if (!asset->AddFinalizeCallback([group, asset]() {
+        auto locked = group.lock();
+        if (locked) locked->OnAssetFinalized(asset);
+      })) {
+    OnAssetFinalized(asset);
+  }
+}
+
+void AssetGroup::OnAssetFinalized(AsyncAsset *asset) {
+  auto it = members_.find(asset);
+  if (it == members_.end() || it->second.done) return;
+  it->second.done = true;
+  ++progress_.assets_done;
+  progress_.bytes_done += it->second.file_size;
+  CheckFinalized();
+}
+
+void AssetGroup::CheckFinalized() {
+  if (finalized_ || num_pending_scans_ > 0 ||
+      progress_.assets_done < progress_.assets_total) {
+    return;
+  }
+  finalized_ = true;
+  std::vector<AsyncAsset::AssetFinalizedCallback> callbacks;
+  callbacks.swap(callbacks_);
+  for (auto it = callbacks.begin(); it != callbacks.end(); ++it) (*it)();
+}
+
+bool AssetGroup::StartExpanding(const std::string &filename) {
+  fplutil::MutexLock lock(expanding_mutex_);
+  return expanding_.insert(AssetIdFromName(filename).hash()).second;
 }
 
-bool FileAsset::IsValid() { return true; }
+// Finds the dependencies of an asset in a list given to LoadAssetList(), on
+// the loader's I/O threads, so the dependencies of the whole list are found
+// in parallel. Mesh and material files are read for the materials and
+// textures they use, which are queued right away, and the size of every
+// file is measured for the group's progress. Finalize() adds what was found
+// to the group.
+class AssetListScan : public AsyncAsset {
+ public:
+  typedef AssetManager::RecordedLoad RecordedLoad;
+
+  AssetListScan(AssetManager *manager, const AssetGroupHandle &group,
+                const RecordedLoad &load, int priority)
+      : AsyncAsset(load.filename.c_str()),
+        manager_(manager),
+        group_(group),
+        load_(load),
+        priority_(priority) {}
+
+  virtual void Load() { Read(); }
+
+  virtual void Read() {
+    size_t size = 0;
+    switch (load_.type) {
+      case manifestdef::AssetType_Mesh:
+        ExpandMesh();
+        break;
+      case manifestdef::AssetType_Material:
+        ExpandMaterial(load_);
+        break;
+      case manifestdef::AssetType_Shader: {
+        size_t fragment_size = 0;
+        FileSize((filename_ + ".glslv").c_str(), &size);
+        FileSize((filename_ + ".glslf").c_str(), &fragment_size);
+        Found(load_, size + fragment_size);
+        break;
+      }
+      default:
+        FileSize(filename_.c_str(), &size);
+        Found(load_, size);
+        break;
+    }
+  }
+
+  // There is nothing to decode; the files are only looked at.
+  virtual void Decode() {}
+
+  virtual bool Finalize() {
+    for (auto it = found_.begin(); it != found_.end(); ++it) {
+      // Only finds the asset, unless it was unloaded in the meantime.
+      AsyncAsset *asset = manager_->LoadListedAsset(it->first, priority_);
+      if (asset) group_->Add(asset, it->second);
+    }
+    found_.clear();
+    --group_->num_pending_scans_;
+    group_->CheckFinalized();
+    CallFinalizeCallback();
+    return true;
+  }
+
+  virtual bool IsValid() { return true; }
+
+ private:
+  void Found(const RecordedLoad &load, size_t file_size) {
+    found_.push_back(std::make_pair(load, file_size));
+  }
+
+  void ExpandMesh() {
+    FileView view = LoadFileView(filename_.c_str());
+    Found(load_, view ? view->size() : 0);
+    if (!view) return;
+    flatbuffers::Verifier verifier(view->data(), view->size());
+    if (!meshdef::VerifyMeshBuffer(verifier)) return;
+    auto surfaces = meshdef::GetMesh(view->data())->surfaces();
+    if (!surfaces) return;
+    for (auto it = surfaces->begin(); it != surfaces->end(); ++it) {
+      if (IsLoadCancelled()) return;
+      if (it->material_info()) {
+        ExpandTextures(it->material_info());
+        continue;
+      }
+      RecordedLoad material;
+      material.type = manifestdef::AssetType_Material;
+      material.filename = it->material()->str();
+      material.format = 0;
+      material.flags = 0;
+      if (!group_->StartExpanding(material.filename)) continue;
+      manager_->LoadListedAsset(material, priority_);
+      ExpandMaterial(material);
+    }
+  }
+
+  void ExpandMaterial(const RecordedLoad &material) {
+    FileView view = LoadFileView(material.filename.c_str());
+    Found(material, view ? view->size() : 0);
+    if (!view) return;
+    flatbuffers::Verifier verifier(view->data(), view->size());
+    if (!matdef::VerifyMaterialBuffer(verifier)) return;
+    ExpandTextures(matdef::GetMaterial(view->data()));
+  }
+
+  void ExpandTextures(const matdef::Material *def) {
+    Material::ForEachTexture(def, [this](const char *filename,
+                                         TextureFormat format,
+                                         TextureFlags flags) {
+      if (!group_->StartExpanding(filename)) return;
+      RecordedLoad texture;
+      texture.type = manifestdef::AssetType_Texture;
+      texture.filename = filename;
+      texture.format = format;
+      texture.flags = flags;
+      manager_->LoadListedAsset(texture, priority_);
+      size_t size = 0;
+      FileSize(filename, &size);
+      Found(texture, size);
+    });
+  }
+
+  AssetManager *manager_;
+  AssetGroupHandle group_;
+  RecordedLoad load_;
+  int priority_;
+  // The assets found, with the sizes of their files.
+  std::vector<std::pair<RecordedLoad, size_t>> found_;
+};
+
+// The name an embedded material is kept under in material_map_. It spells
+// out every field of the matdef, so its AssetId is a structural hash of the
+// material, and only identical materials share a name. The prefix can't
+// start a file name that LoadMaterial() is given.
+static std::string EmbeddedMaterialName(const matdef::Material *def) {
+  char field[64];
+  snprintf(field, sizeof(field), "<embedded> blend=%d mipmaps=%d wrap=%d",
+           static_cast<int>(def->blendmode()), def->mipmaps() ? 1 : 0,
+           static_cast<int>(def->wrapmode()));
+  std::string name = field;
+  const auto filenames = def->texture_filenames();
+  const size_t num_textures = filenames ? filenames->size() : 0;
+  for (size_t i = 0; i < num_textures; ++i) {
+    const flatbuffers::uoffset_t index = static_cast<flatbuffers::uoffset_t>(i);
+    const int format =
+        def->desired_format() && i < def->desired_format()->size()
+            ? def->desired_format()->Get(index)
+            : 0;
+    const bool cube_map =
+        def->is_cubemap() && i < def->is_cubemap()->size() &&
+        def->is_cubemap()->Get(index);
+    int width = 0, height = 0;
+    if (def->original_size() && i < def->original_size()->size()) {
+      width = def->original_size()->Get(index)->x();
+      height = def->original_size()->Get(index)->y();
+    }
+    snprintf(field, sizeof(field), " [%d %d %dx%d ", format, cube_map ? 1 : 0,
+             width, height);
+    name += field;
+    name += filenames->Get(index)->str();
+    name += ']';
+  }
+  return name;
+}
 
 template <typename T>
-T FindInMap(const std::map<std::string, T> &map, const char *name) {
-  auto it = map.find(name);
-  return it != map.end() ? it->second : 0;
+void DestructAssetsInMap(AssetTable<T> &map) {
+  map.ForEach([](const std::string &, T asset) { delete asset; });
+  map.Clear();
 }
 
 template <typename T>
-void DestructAssetsInMap(std::map<std::string, T> &map) {
-  for (auto it = map.begin(); it != map.end(); ++it) {
-    delete it->second;
+void CollectLoadStats(const AssetTable<T *> &map, const char *type,
+                      std::vector<AssetLoadStats> *stats) {
+  const size_t begin = stats->size();
+  map.ForEach([type, stats](const std::string &name, T *asset) {
+    if (!asset->IsFinalized()) return;
+    AssetLoadStats asset_stats;
+    asset_stats.type = type;
+    asset_stats.name = name;
+    asset_stats.stats = asset->load_stats();
+    stats->push_back(asset_stats);
+  });
+  std::sort(stats->begin() + begin, stats->end(),
+            [](const AssetLoadStats &a, const AssetLoadStats &b) {
+              return a.name < b.name;
+            });
+}
+
+// Nearest-rank percentiles of `values`.
+static LoadStatPercentiles Percentiles(std::vector<double> values) {
+  LoadStatPercentiles result;
+  if (values.empty()) return result;
+  std::sort(values.begin(), values.end());
+  auto rank = [&values](double p) {
+    const size_t i = static_cast<size_t>(ceil(p * values.size()));
+    return values[i > 0 ? i - 1 : 0];
+  };
+  result.p50 = rank(0.50);
+  result.p95 = rank(0.95);
+  result.p99 = rank(0.99);
+  return result;
+}
+
+static void AppendJsonString(const std::string &str, std::string *json) {
+  *json += '"';
+  for (auto it = str.begin(); it != str.end(); ++it) {
+    const unsigned char c = static_cast<unsigned char>(*it);
+    if (c == '"' || c == '\\') {
+      *json += '\\';
+      *json += static_cast<char>(c);
+    } else if (c < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      *json += escaped;
+    } else {
+      *json += static_cast<char>(c);
+    }
   }
-  map.clear();
+  *json += '"';
+}
+
+static void AppendJsonNumber(const char *name, double value,
+                             std::string *json) {
+  char number[64];
+  snprintf(number, sizeof(number), "\"%s\": %.9g", name, value);
+  *json += number;
+}
+
+static void AppendJsonPercentiles(const char *name,
+                                  const LoadStatPercentiles &percentiles,
+                                  std::string *json) {
+  *json += "\"";
+  *json += name;
+  *json += "\": {";
+  AppendJsonNumber("p50", percentiles.p50, json);
+  *json += ", ";
+  AppendJsonNumber("p95", percentiles.p95, json);
+  *json += ", ";
+  AppendJsonNumber("p99", percentiles.p99, json);
+  *json += "}";
 }
 
 AssetManager::AssetManager(Renderer &renderer)
-    : renderer_(renderer), texture_scale_(mathfu::kOnes2f) {
+    : renderer_(renderer),
+      render_thread_(std::this_thread::get_id()),
+      texture_scale_(mathfu::kOnes2f),
+      recording_loads_(false),
+      residency_budget_(0),
+      resident_gpu_bytes_(0),
+      resident_cpu_bytes_(0),
+      deduplicate_textures_(false) {
   // Empty material for default case.
-  material_map_[""] = new Material();
+  material_map_.Insert("", new Material());
 }
 
 void AssetManager::ClearAllAssets() {
-  DestructAssetsInMap(material_map_);
-  DestructAssetsInMap(texture_atlas_map_);
-  DestructAssetsInMap(mesh_map_);
-  DestructAssetsInMap(shader_map_);
-  DestructAssetsInMap(texture_map_);
+  for (auto it = scans_.begin(); it != scans_.end(); ++it) {
+    if (loader_.AbortJob(*it)) delete *it;
+  }
+  scans_.clear();
+  {
+    fplutil::MutexLock lock(material_mutex_);
+    DestructAssetsInMap(material_map_);
+  }
+  {
+    fplutil::MutexLock lock(atlas_mutex_);
+    DestructAssetsInMap(texture_atlas_map_);
+  }
+  {
+    fplutil::MutexLock lock(resident_mutex_);
+    DestructAssetsInMap(mesh_map_);
+    DestructAssetsInMap(texture_map_);
+    released_.clear();
+    resident_gpu_bytes_ = 0;
+    resident_cpu_bytes_ = 0;
+    texture_contents_.clear();
+    shared_textures_.clear();
+  }
+  {
+    fplutil::MutexLock lock(shader_mutex_);
+    DestructAssetsInMap(shader_map_);
+  }
+  fplutil::MutexLock lock(file_mutex_);
   DestructAssetsInMap(file_map_);
 }
 
+bool AssetManager::IsSyncLoading(const SyncLoad &sync_load) {
+  std::lock_guard<std::mutex> lock(sync_load_mutex_);
+  return sync_loads_.count(sync_load) != 0;
+}
+
+void AssetManager::StartSyncLoad(const SyncLoad &sync_load) {
+  std::lock_guard<std::mutex> lock(sync_load_mutex_);
+  sync_loads_.insert(sync_load);
+}
+
+void AssetManager::FinishSyncLoad(const SyncLoad &sync_load) {
+  {
+    std::lock_guard<std::mutex> lock(sync_load_mutex_);
+    sync_loads_.erase(sync_load);
+  }
+  sync_load_done_.notify_all();
+}
+
+void AssetManager::WaitForSyncLoad(const SyncLoad &sync_load) {
+  std::unique_lock<std::mutex> lock(sync_load_mutex_);
+  sync_load_done_.wait(
+      lock, [this, &sync_load]() { return !sync_loads_.count(sync_load); });
+}
+
 Shader *AssetManager::FindShader(const char *basename) {
-  return FindInMap(shader_map_, basename);
+  return FindShader(AssetIdFromName(basename));
+}
+
+Shader *AssetManager::FindShader(AssetId id) {
+  fplutil::MutexLock lock(shader_mutex_);
+  return shader_map_.Find(id);
 }
 
 Shader *AssetManager::LoadShaderHelper(
     const char *basename, const std::vector<std::string> &local_defines,
-    const char *alias, bool async) {
-  auto shader = FindShader(alias != nullptr ? alias : basename);
-  const bool found = shader != nullptr;
-  if (!found) {
-    shader = new Shader(basename, local_defines, &renderer_);
+    const char *alias, bool async, int priority) {
+  const char *name = alias != nullptr ? alias : basename;
+  Shader *shader;
+  bool found;
+  {
+    fplutil::MutexLock lock(shader_mutex_);
+    shader = shader_map_.Find(name);
+    found = shader != nullptr;
+    if (!found) {
+      shader = new Shader(basename, local_defines, &renderer_);
+      shader_map_.Insert(name, shader);
+    }
+    // Other threads may be using a shader that was found; leave updating
+    // its defines to the render thread.
+    if (!found || OnRenderThread()) {
+      shader->UpdateGlobalDefines(defines_to_add_, defines_to_omit_);
+    }
   }
-  shader->UpdateGlobalDefines(defines_to_add_, defines_to_omit_);
-  return found ? shader : LoadOrQueue(shader, shader_map_, async, alias);
+  if (!found) return LoadOrQueue(shader, async, priority);
+  RaisePriority(shader, priority);
+  return shader;
 }
 
 Shader *AssetManager::LoadShader(const char *basename,
                                  const std::vector<std::string> &local_defines,
-                                 bool async, const char *alias) {
-  return LoadShaderHelper(basename, local_defines, alias, async);
+                                 bool async, const char *alias,
+                                 int priority) {
+  if (alias == nullptr) {
+    RecordLoad(manifestdef::AssetType_Shader, basename, 0, 0, &local_defines);
+  }
+  return LoadShaderHelper(basename, local_defines, alias, async, priority);
 }
 
 Shader *AssetManager::LoadShader(const char *basename, bool async,
-                                 const char *alias) {
+                                 const char *alias, int priority) {
   static const std::vector<std::string> empty_defines;
-  return LoadShader(basename, empty_defines, async, alias);
+  return LoadShader(basename, empty_defines, async, alias, priority);
 }
 
 void AssetManager::ResetGlobalShaderDefines(
     const std::vector<std::string> &defines_to_add,
     const std::vector<std::string> &defines_to_omit) {
+  fplutil::MutexLock lock(shader_mutex_);
   defines_to_add_ = defines_to_add;
   defines_to_omit_ = defines_to_omit;
-  for (auto iter = shader_map_.begin(); iter != shader_map_.end(); ++iter) {
-    Shader *shader = iter->second;
+  shader_map_.ForEach([this](const std::string &, Shader *shader) {
     shader->UpdateGlobalDefines(defines_to_add_, defines_to_omit_);
-  }
+  });
 }
 
 void AssetManager::ForEachShaderWithDefine(const char *define,
     const std::function<void(Shader *)> &func) {
-  // Use a simple for loop to visit all shaders with 'define' specified, since
-  // we only have limited shaders currently. TODO(yifengh): optimize this if
+  // Visit all shaders to find the ones with 'define' specified, since we
+  // only have limited shaders currently. TODO(yifengh): optimize this if
   // there is a growing number of shaders.
-  for (auto iter = shader_map_.begin(); iter != shader_map_.end(); ++iter) {
-    Shader *shader = iter->second;
-    if (ValidShaderHandle(shader->program()) && shader->HasDefine(define)) {
-      func(shader);
-    }
+  std::vector<Shader *> shaders;
+  {
+    fplutil::MutexLock lock(shader_mutex_);
+    shader_map_.ForEach([define, &shaders](const std::string &,
+                                           Shader *shader) {
+      if (ValidShaderHandle(shader->program()) && shader->HasDefine(define)) {
+        shaders.push_back(shader);
+      }
+    });
   }
+  // Outside the lock, so `func` may load shaders.
+  for (auto it = shaders.begin(); it != shaders.end(); ++it) func(*it);
 }
 
-Shader *AssetManager::LoadShaderDef(const char *filename) {
-  auto shader = FindShader(filename);
-  if (shader) return shader;
-  shader = Shader::LoadFromShaderDef(filename);
-  if (!shader) return nullptr;
-  shader_map_[filename] = shader;
-  return shader;
+Shader *AssetManager::LoadShaderDef(const char *filename, bool async,
+                                    int priority) {
+  return FindOrLoad(shader_mutex_, shader_map_, filename, async, priority,
+                    [this, filename]() {
+                      static const std::vector<std::string> empty_defines;
+                      auto shader =
+                          new Shader(filename, empty_defines, &renderer_);
+                      shader->set_from_shader_def(true);
+                      return shader;
+                    });
 }
 
 void AssetManager::UnloadShader(const char *filename) {
-  auto shader = FindShader(filename);
-  if (!shader || shader->DecreaseRefCount()) return;
-  loader_.AbortJob(shader);
-  shader_map_.erase(filename);
-  delete shader;
+  Shader *shader;
+  {
+    fplutil::MutexLock lock(shader_mutex_);
+    shader = shader_map_.Find(filename);
+    if (!shader || shader->DecreaseRefCount()) return;
+    shader_map_.Erase(filename);
+  }
+  // If it is still loading, the loader deletes it once it is done with it.
+  if (loader_.AbortJob(shader)) delete shader;
 }
 
 Texture *AssetManager::FindTexture(const char *filename) {
-  return FindInMap(texture_map_, filename);
+  return FindTexture(AssetIdFromName(filename));
+}
+
+Texture *AssetManager::FindTexture(AssetId id) {
+  fplutil::MutexLock lock(resident_mutex_);
+  return Revive(texture_map_.Find(id));
 }
 
 Texture *AssetManager::LoadTexture(const char *filename, TextureFormat format,
-                                   TextureFlags flags) {
-  auto tex = FindTexture(filename);
-  if (tex) return tex;
-  tex = new Texture(filename, format, flags);
-  return LoadOrQueue(tex, texture_map_, (flags & kTextureFlagsLoadAsync) != 0,
-                     nullptr /* alias */);
+                                   TextureFlags flags, int priority) {
+  RecordLoad(manifestdef::AssetType_Texture, filename, format, flags);
+  return LoadTextureHelper(filename, format, flags, priority);
+}
+
+Texture *AssetManager::LoadTextureHelper(const char *filename,
+                                         TextureFormat format,
+                                         TextureFlags flags, int priority) {
+  Texture *tex;
+  bool found;
+  {
+    // Finding and adding under one lock makes concurrent requests for the
+    // same texture share a single load.
+    fplutil::MutexLock lock(resident_mutex_);
+    tex = Revive(texture_map_.Find(filename));
+    found = tex != nullptr;
+    if (!found) {
+      tex = new Texture(filename, format, flags);
+      TrackResidency(tex);
+      if (deduplicate_textures_) DeduplicateTexture(tex);
+      texture_map_.Insert(filename, tex);
+    }
+  }
+  if (found) {
+    RaisePriority(tex, priority);
+    return tex;
+  }
+  LoadOrQueue(tex, (flags & kTextureFlagsLoadAsync) != 0, priority);
+  EnforceResidencyBudget();
+  return tex;
 }
 
 void AssetManager::StartLoadingTextures() { loader_.StartLoading(); }
 
 void AssetManager::StopLoadingTextures() { loader_.PauseLoading(); }
 
-bool AssetManager::TryFinalize() { return loader_.TryFinalize(); }
+bool AssetManager::TryFinalize() {
+  const bool done = loader_.TryFinalize();
+  DeleteFinishedScans();
+  EnforceResidencyBudget();
+  return done;
+}
+
+bool AssetManager::TryFinalize(double max_seconds, size_t max_bytes) {
+  const bool done = loader_.TryFinalize(max_seconds, max_bytes);
+  DeleteFinishedScans();
+  EnforceResidencyBudget();
+  return done;
+}
+
+void AssetManager::DeleteFinishedScans() {
+  auto end = std::remove_if(scans_.begin(), scans_.end(),
+                            [](AsyncAsset *scan) {
+                              if (!scan->IsFinalized()) return false;
+                              delete scan;
+                              return true;
+                            });
+  scans_.erase(end, scans_.end());
+}
+
+void AssetManager::SetResidencyBudget(size_t max_bytes) {
+  {
+    fplutil::MutexLock lock(resident_mutex_);
+    residency_budget_ = max_bytes;
+  }
+  EnforceResidencyBudget();
+}
+
+void AssetManager::ReviveReleased(AsyncAsset *asset) {
+  asset->refcount_ = 1;
+  for (auto it = released_.begin(); it != released_.end(); ++it) {
+    if (it->asset == asset) {
+      released_.erase(it);
+      break;
+    }
+  }
+}
+
+void AssetManager::TrackResidency(AsyncAsset *asset) {
+  asset->AddFinalizeCallback([this, asset]() {
+    fplutil::MutexLock lock(resident_mutex_);
+    asset->resident_gpu_bytes_ = asset->GpuMemorySize();
+    asset->resident_cpu_bytes_ = asset->CpuMemorySize();
+    resident_gpu_bytes_ += asset->resident_gpu_bytes_;
+    resident_cpu_bytes_ += asset->resident_cpu_bytes_;
+  });
+}
+
+void AssetManager::ForgetResidency(AsyncAsset *asset) {
+  resident_gpu_bytes_ -= asset->resident_gpu_bytes_;
+  resident_cpu_bytes_ -= asset->resident_cpu_bytes_;
+  asset->resident_gpu_bytes_ = 0;
+  asset->resident_cpu_bytes_ = 0;
+  if (asset->refcount_ == 0) ReviveReleased(asset);
+}
+
+bool AssetManager::ReleaseAsset(AsyncAsset *asset, bool is_mesh) {
+  if (residency_budget_ == 0) return true;
+  ReleasedAsset released;
+  released.asset = asset;
+  released.is_mesh = is_mesh;
+  released_.push_back(released);
+  return false;
+}
+
+void AssetManager::EnforceResidencyBudget() {
+  // Deleting talks to OpenGL; other threads leave it to the next
+  // TryFinalize().
+  if (!OnRenderThread()) return;
+  std::vector<AsyncAsset *> evicted;
+  std::vector<Texture *> unshared;
+  {
+    fplutil::MutexLock lock(resident_mutex_);
+    while (!released_.empty() &&
+           (residency_budget_ == 0 ||
+            resident_gpu_bytes_ + resident_cpu_bytes_ > residency_budget_)) {
+      const ReleasedAsset oldest = released_.front();
+      released_.pop_front();
+      AsyncAsset *asset = oldest.asset;
+      if (oldest.is_mesh) {
+        mesh_map_.Erase(asset->filename());
+      } else {
+        texture_map_.Erase(asset->filename());
+        ForgetSharing(static_cast<Texture *>(asset), &unshared);
+      }
+      resident_gpu_bytes_ -= asset->resident_gpu_bytes_;
+      resident_cpu_bytes_ -= asset->resident_cpu_bytes_;
+      evicted.push_back(asset);
+    }
+  }
+  for (auto it = evicted.begin(); it != evicted.end(); ++it) {
+    // If it is still loading, the loader deletes it once it is done with it.
+    if (loader_.AbortJob(*it)) delete *it;
+  }
+  UnloadUnshared(unshared);
+}
+
+template <typename T>
+void AssetManager::UnloadResidentAsset(AssetTable<T *> &map,
+                                       const char *filename, bool is_mesh) {
+  T *asset;
+  std::vector<Texture *> unshared;
+  {
+    fplutil::MutexLock lock(resident_mutex_);
+    asset = map.Find(filename);
+    // A reference count of zero means it was already unloaded, and is only
+    // kept for the residency budget.
+    if (!asset || asset->refcount_ == 0 || asset->DecreaseRefCount()) return;
+    if (ReleaseAsset(asset, is_mesh)) {
+      map.Erase(filename);
+      ForgetResidency(asset);
+      ForgetSharing(asset, &unshared);
+    } else {
+      asset = nullptr;
+    }
+  }
+  if (!asset) {
+    EnforceResidencyBudget();
+    return;
+  }
+  // If it is still loading, the loader deletes it once it is done with it.
+  if (loader_.AbortJob(asset)) delete asset;
+  UnloadUnshared(unshared);
+}
+
+void AssetManager::SetTextureDeduplication(bool enabled) {
+  fplutil::MutexLock lock(resident_mutex_);
+  deduplicate_textures_ = enabled;
+}
+
+TextureDeduplicationStats AssetManager::GetTextureDeduplicationStats() const {
+  TextureDeduplicationStats stats;
+  fplutil::MutexLock lock(resident_mutex_);
+  for (auto it = shared_textures_.begin(); it != shared_textures_.end();
+       ++it) {
+    ++stats.shared_textures;
+    stats.bytes_saved += it->second->GpuMemorySize();
+  }
+  return stats;
+}
+
+void AssetManager::DeduplicateTexture(Texture *tex) {
+  tex->set_find_duplicate(
+      [this](Texture *texture) { return FindDuplicateTexture(texture); });
+  // Offer it for sharing once it has a GPU texture of its own.
+  tex->AddFinalizeCallback([this, tex]() {
+    if (!tex->content_hash() || tex->shared_texture() || !tex->IsValid()) {
+      return;
+    }
+    fplutil::MutexLock lock(resident_mutex_);
+    texture_contents_.insert(std::make_pair(tex->content_hash(), tex));
+  });
+}
+
+Texture *AssetManager::FindDuplicateTexture(Texture *tex) {
+  fplutil::MutexLock lock(resident_mutex_);
+  // Don't share anything with a texture that was unloaded while it was read.
+  if (texture_map_.Find(tex->filename().c_str()) != tex) return nullptr;
+  auto range = texture_contents_.equal_range(tex->content_hash());
+  for (auto it = range.first; it != range.second; ++it) {
+    Texture *other = it->second;
+    // Whether to load async doesn't change the texture.
+    const int flags_differ =
+        (other->flags() ^ tex->flags()) & ~kTextureFlagsLoadAsync;
+    // Textures only kept for the residency budget may be evicted at any
+    // time, so leave those be.
+    if (other == tex || other->refcount_ == 0 || flags_differ ||
+        other->content_size() != tex->content_size() ||
+        other->desired_format() != tex->desired_format() ||
+        other->scale().x != tex->scale().x ||
+        other->scale().y != tex->scale().y) {
+      continue;
+    }
+    // Keep it loaded for as long as `tex` shares it.
+    other->IncreaseRefCount();
+    shared_textures_[tex] = other;
+    return other;
+  }
+  return nullptr;
+}
+
+void AssetManager::ForgetSharing(Texture *tex,
+                                 std::vector<Texture *> *unshared) {
+  // Only finalized textures are offered for sharing, and reading the hash
+  // of one that is still loading would race with the loader.
+  if (tex->IsFinalized()) {
+    auto range = texture_contents_.equal_range(tex->content_hash());
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->second == tex) {
+        texture_contents_.erase(it);
+        break;
+      }
+    }
+  }
+  auto shared = shared_textures_.find(tex);
+  if (shared != shared_textures_.end()) {
+    unshared->push_back(shared->second);
+    shared_textures_.erase(shared);
+  }
+}
+
+void AssetManager::UnloadUnshared(const std::vector<Texture *> &unshared) {
+  for (auto it = unshared.begin(); it != unshared.end(); ++it) {
+    UnloadTexture((*it)->filename().c_str());
+  }
+}
+
+template <typename T>
+bool AssetManager::HasResidentAsset(const AssetTable<T *> &map,
+                                    const char *filename) {
+  fplutil::MutexLock lock(resident_mutex_);
+  return map.Find(filename) != nullptr;
+}
+
+void AssetManager::GetLoadStats(std::vector<AssetLoadStats> *stats) const {
+  stats->clear();
+  {
+    fplutil::MutexLock lock(resident_mutex_);
+    CollectLoadStats(texture_map_, "texture", stats);
+    CollectLoadStats(mesh_map_, "mesh", stats);
+  }
+  {
+    fplutil::MutexLock lock(shader_mutex_);
+    CollectLoadStats(shader_map_, "shader", stats);
+  }
+  fplutil::MutexLock lock(file_mutex_);
+  CollectLoadStats(file_map_, "file", stats);
+}
+
+void AssetManager::GetLoadStatsByType(
+    std::vector<AssetTypeLoadStats> *stats) const {
+  std::vector<AssetLoadStats> assets;
+  GetLoadStats(&assets);
+  stats->clear();
+  // GetLoadStats() returns the assets grouped by type.
+  for (auto begin = assets.begin(); begin != assets.end();) {
+    auto end = begin;
+    std::vector<double> queue, read, decode, finalize, bytes_read, uploaded;
+    for (; end != assets.end() && end->type == begin->type; ++end) {
+      queue.push_back(end->stats.queue_seconds);
+      read.push_back(end->stats.read_seconds);
+      decode.push_back(end->stats.decode_seconds);
+      finalize.push_back(end->stats.finalize_seconds);
+      bytes_read.push_back(static_cast<double>(end->stats.bytes_read));
+      uploaded.push_back(static_cast<double>(end->stats.bytes_uploaded));
+    }
+    AssetTypeLoadStats type_stats;
+    type_stats.type = begin->type;
+    type_stats.count = static_cast<int>(end - begin);
+    type_stats.queue_seconds = Percentiles(queue);
+    type_stats.read_seconds = Percentiles(read);
+    type_stats.decode_seconds = Percentiles(decode);
+    type_stats.finalize_seconds = Percentiles(finalize);
+    type_stats.bytes_read = Percentiles(bytes_read);
+    type_stats.bytes_uploaded = Percentiles(uploaded);
+    stats->push_back(type_stats);
+    begin = end;
+  }
+}
+
+std::string AssetManager::LoadStatsToJson() const {
+  std::vector<AssetTypeLoadStats> types;
+  std::vector<AssetLoadStats> assets;
+  GetLoadStatsByType(&types);
+  GetLoadStats(&assets);
+
+  std::string json = "{\n  \"types\": [";
+  for (auto it = types.begin(); it != types.end(); ++it) {
+    json += it == types.begin() ? "\n    {" : ",\n    {";
+    json += "\"type\": ";
+    AppendJsonString(it->type, &json);
+    json += ", ";
+    AppendJsonNumber("count", it->count, &json);
+    json += ", ";
+    AppendJsonPercentiles("queue_seconds", it->queue_seconds, &json);
+    json += ", ";
+    AppendJsonPercentiles("read_seconds", it->read_seconds, &json);
+    json += ", ";
+    AppendJsonPercentiles("decode_seconds", it->decode_seconds, &json);
+    json += ", ";
+    AppendJsonPercentiles("finalize_seconds", it->finalize_seconds, &json);
+    json += ", ";
+    AppendJsonPercentiles("bytes_read", it->bytes_read, &json);
+    json += ", ";
+    AppendJsonPercentiles("bytes_uploaded", it->bytes_uploaded, &json);
+    json += "}";
+  }
+  json += "\n  ],\n  \"assets\": [";
+  for (auto it = assets.begin(); it != assets.end(); ++it) {
+    json += it == assets.begin() ? "\n    {" : ",\n    {";
+    json += "\"type\": ";
+    AppendJsonString(it->type, &json);
+    json += ", \"name\": ";
+    AppendJsonString(it->name, &json);
+    json += ", ";
+    AppendJsonNumber("queue_seconds", it->stats.queue_seconds, &json);
+    json += ", ";
+    AppendJsonNumber("read_seconds", it->stats.read_seconds, &json);
+    json += ", ";
+    AppendJsonNumber("decode_seconds", it->stats.decode_seconds, &json);
+    json += ", ";
+    AppendJsonNumber("finalize_seconds", it->stats.finalize_seconds, &json);
+    json += ", ";
+    AppendJsonNumber("bytes_read", static_cast<double>(it->stats.bytes_read),
+                     &json);
+    json += ", ";
+    AppendJsonNumber("bytes_uploaded",
+                     static_cast<double>(it->stats.bytes_uploaded), &json);
+    json += "}";
+  }
+  const TextureDeduplicationStats dedup = GetTextureDeduplicationStats();
+  json += "\n  ],\n  \"texture_deduplication\": {";
+  AppendJsonNumber("shared_textures", dedup.shared_textures, &json);
+  json += ", ";
+  AppendJsonNumber("bytes_saved", static_cast<double>(dedup.bytes_saved),
+                   &json);
+  json += "}\n}\n";
+  return json;
+}
+
+void AssetManager::StartRecordingLoads() {
+  fplutil::MutexLock lock(record_mutex_);
+  recorded_loads_.clear();
+  recorded_names_.clear();
+  recording_loads_ = true;
+}
+
+void AssetManager::StopRecordingLoads() {
+  fplutil::MutexLock lock(record_mutex_);
+  recording_loads_ = false;
+}
+
+void AssetManager::RecordLoad(int type, const std::string &filename,
+                              int format, int flags,
+                              const std::vector<std::string> *defines) {
+  fplutil::MutexLock lock(record_mutex_);
+  if (!recording_loads_ ||
+      !recorded_names_.insert(std::make_pair(type, filename)).second) {
+    return;
+  }
+  RecordedLoad load;
+  load.type = type;
+  load.filename = filename;
+  load.format = format;
+  // Whether to load async is up to the replay.
+  load.flags = flags & ~kTextureFlagsLoadAsync;
+  if (defines) load.defines = *defines;
+  recorded_loads_.push_back(load);
+}
+
+bool AssetManager::SaveLoadManifest(const char *filename) const {
+  fplutil::MutexLock lock(record_mutex_);
+  flatbuffers::FlatBufferBuilder fbb;
+  std::vector<flatbuffers::Offset<manifestdef::AssetLoad>> loads;
+  for (auto it = recorded_loads_.begin(); it != recorded_loads_.end(); ++it) {
+    flatbuffers::Offset<
+        flatbuffers::Vector<flatbuffers::Offset<flatbuffers::String>>>
+        defines;
+    if (!it->defines.empty()) defines = fbb.CreateVectorOfStrings(it->defines);
+    loads.push_back(manifestdef::CreateAssetLoad(
+        fbb, static_cast<manifestdef::AssetType>(it->type),
+        fbb.CreateString(it->filename), it->format, it->flags, defines));
+  }
+  auto manifest = manifestdef::CreateLoadManifest(
+      fbb, kLoadManifestVersion, fbb.CreateVector(loads));
+  manifestdef::FinishLoadManifestBuffer(fbb, manifest);
+  return SaveFile(filename, fbb.GetBufferPointer(), fbb.GetSize());
+}
+
+int AssetManager::PrefetchLoadManifest(const char *filename) {
+  std::string flatbuf;
+  // Not having a manifest yet is normal, e.g. on the first run.
+  if (!FileExistsRaw(filename) || !LoadFile(filename, &flatbuf)) return 0;
+  flatbuffers::Verifier verifier(
+      reinterpret_cast<const uint8_t *>(flatbuf.c_str()), flatbuf.length());
+  if (!manifestdef::VerifyLoadManifestBuffer(verifier)) {
+    LogError(kApplication, "%s is not a valid load manifest", filename);
+    return 0;
+  }
+  auto manifest = manifestdef::GetLoadManifest(flatbuf.c_str());
+  if (manifest->version() != kLoadManifestVersion) {
+    LogInfo(kApplication, "Ignoring %s, which has version %u instead of %u",
+            filename, manifest->version(), kLoadManifestVersion);
+    return 0;
+  }
+  if (!manifest->loads()) return 0;
+
+  int num_queued = 0;
+  for (auto it = manifest->loads()->begin(); it != manifest->loads()->end();
+       ++it) {
+    if (!it->filename()) continue;
+    const char *name = it->filename()->c_str();
+    switch (it->type()) {
+      case manifestdef::AssetType_Texture:
+        // Don't take back unloaded textures kept for the residency budget.
+        if (HasResidentAsset(texture_map_, name) || !FileExistsRaw(name)) {
+          continue;
+        }
+        break;
+      case manifestdef::AssetType_Mesh:
+        if (HasResidentAsset(mesh_map_, name) || !FileExistsRaw(name)) {
+          continue;
+        }
+        break;
+      case manifestdef::AssetType_Material:
+        if (FindMaterial(name) || !FileExistsRaw(name)) continue;
+        break;
+      case manifestdef::AssetType_Shader:
+        if (FindShader(name) ||
+            !FileExistsRaw((std::string(name) + ".glslv").c_str()) ||
+            !FileExistsRaw((std::string(name) + ".glslf").c_str())) {
+          continue;
+        }
+        break;
+      default:
+        break;
+    }
+    // Only record what the game asks for, so assets it stopped using drop
+    // out of the next manifest.
+    if (LoadListedAsset(ReadListedLoad(**it), kLoadPriorityLow, false)) {
+      ++num_queued;
+    }
+  }
+  return num_queued;
+}
+
+AssetManager::RecordedLoad AssetManager::ReadListedLoad(
+    const manifestdef::AssetLoad &load) {
+  RecordedLoad listed;
+  listed.type = load.type();
+  listed.filename = load.filename()->str();
+  listed.format = load.format();
+  listed.flags = load.flags();
+  if (load.defines()) {
+    for (auto it = load.defines()->begin(); it != load.defines()->end();
+         ++it) {
+      listed.defines.push_back(it->str());
+    }
+  }
+  return listed;
+}
+
+AsyncAsset *AssetManager::LoadListedAsset(const RecordedLoad &load,
+                                          int priority, bool record) {
+  // Records the same way the public Load*() functions do.
+  const char *name = load.filename.c_str();
+  switch (load.type) {
+    case manifestdef::AssetType_Texture:
+      if (record) {
+        RecordLoad(load.type, load.filename, load.format, load.flags);
+      }
+      return LoadTextureHelper(
+          name, static_cast<TextureFormat>(load.format),
+          static_cast<TextureFlags>(load.flags | kTextureFlagsLoadAsync),
+          priority);
+    case manifestdef::AssetType_Mesh:
+      if (record) RecordLoad(load.type, load.filename);
+      return LoadMeshHelper(name, true, priority);
+    case manifestdef::AssetType_Material:
+      if (record) RecordLoad(load.type, load.filename);
+      return LoadMaterialHelper(name, true, true, priority);
+    case manifestdef::AssetType_Shader:
+      if (record) RecordLoad(load.type, load.filename, 0, 0, &load.defines);
+      return LoadShaderHelper(name, load.defines, nullptr, true, priority);
+    default:
+      // A kind of asset this AssetManager doesn't know how to load.
+      return nullptr;
+  }
+}
+
+AssetGroupHandle AssetManager::LoadAssetList(const char *filename,
+                                             int priority) {
+  FileView list = LoadFileView(filename);
+  if (!list) return nullptr;
+  return LoadAssetList(list->data(), list->size(), priority);
+}
+
+AssetGroupHandle AssetManager::LoadAssetList(const uint8_t *data, size_t size,
+                                             int priority) {
+  flatbuffers::Verifier verifier(data, size);
+  if (!manifestdef::VerifyLoadManifestBuffer(verifier)) {
+    LogError(kApplication, "Not a valid asset list");
+    return nullptr;
+  }
+  auto manifest = manifestdef::GetLoadManifest(data);
+  // Hand-written lists may leave the version out.
+  if (manifest->version() != 0 &&
+      manifest->version() != kLoadManifestVersion) {
+    LogError(kApplication, "Asset list has version %u instead of %u",
+             manifest->version(), kLoadManifestVersion);
+    return nullptr;
+  }
+
+  AssetGroupHandle group(new AssetGroup());
+  group->self_ = group;
+  std::vector<RecordedLoad> loads;
+  if (manifest->loads()) {
+    for (auto it = manifest->loads()->begin();
+         it != manifest->loads()->end(); ++it) {
+      if (!it->filename()) continue;
+      loads.push_back(ReadListedLoad(**it));
+      // Listed assets are expanded by their own scans.
+      group->StartExpanding(loads.back().filename);
+    }
+  }
+  for (auto it = loads.begin(); it != loads.end(); ++it) {
+    AsyncAsset *asset = LoadListedAsset(*it, priority);
+    if (!asset) continue;
+    // Counted first, so the group doesn't finalize while it is being filled.
+    ++group->num_pending_scans_;
+    group->Add(asset, 0);
+    AssetListScan *scan = new AssetListScan(this, group, *it, priority);
+    scans_.push_back(scan);
+    // Ahead of the loads, since the scans queue more of them.
+    loader_.QueueJob(scan, priority + 1);
+  }
+  group->CheckFinalized();
+  return group;
+}
 
 void AssetManager::UnloadTexture(const char *filename) {
-  auto tex = FindTexture(filename);
-  if (!tex || tex->DecreaseRefCount()) return;
-  loader_.AbortJob(tex);
-  texture_map_.erase(filename);
-  delete tex;
+  UnloadResidentAsset(texture_map_, filename, false);
 }
 
 Material *AssetManager::FindMaterial(const char *filename) {
-  return FindInMap(material_map_, filename);
+  return FindMaterial(AssetIdFromName(filename));
+}
+
+Material *AssetManager::FindMaterial(AssetId id) {
+  fplutil::MutexLock lock(material_mutex_);
+  return material_map_.Find(id);
 }
 
 Material *AssetManager::LoadMaterial(const char *filename,
-                                     bool async_resources) {
-  auto mat = FindMaterial(filename);
-  if (mat) return mat;
-  mat = Material::LoadFromMaterialDef(filename,
-    [&](const char *filename, TextureFormat format,
-        TextureFlags flags) -> Texture* {
-      auto tex = LoadTexture(filename, format, flags |
-        (async_resources ? kTextureFlagsLoadAsync : kTextureFlagsNone));
-      tex->set_scale(texture_scale_);
-      return tex;
-    });
-  if (!mat) return nullptr;
-  material_map_[filename] = mat;
+                                     bool async_resources, bool async,
+                                     int priority) {
+  RecordLoad(manifestdef::AssetType_Material, filename);
+  return LoadMaterialHelper(filename, async_resources, async, priority);
+}
+
+Material *AssetManager::LoadMaterialHelper(const char *filename,
+                                           bool async_resources, bool async,
+                                           int priority) {
+  auto async_flags = (async_resources || async ? kTextureFlagsLoadAsync
+                                               : kTextureFlagsNone);
+  auto load_texture_fn = [this, async_flags, priority](
+      const char *filename, TextureFormat format,
+      TextureFlags flags) -> Texture * {
+    auto tex = LoadTexture(filename, format, flags | async_flags, priority);
+    tex->set_scale(texture_scale_);
+    return tex;
+  };
+  return FindOrLoad(material_mutex_, material_map_, filename, async, priority,
+                    [filename, &load_texture_fn]() {
+                      return new Material(filename, load_texture_fn);
+                    });
+}
+
+Material *AssetManager::LoadEmbeddedMaterial(
+    const matdef::Material *def, const TextureLoaderFn &load_texture_fn) {
+  const std::string name = EmbeddedMaterialName(def);
+  // Like FindOrLoad(), creates the material outside the lock, since it may
+  // load its textures synchronously. Other threads asking for the same one
+  // wait for it.
+  const SyncLoad sync_load(&material_map_, name);
+  for (;;) {
+    bool loading;
+    {
+      fplutil::MutexLock lock(material_mutex_);
+      auto mat = material_map_.Find(name.c_str());
+      if (mat) return mat;
+      loading = IsSyncLoading(sync_load);
+      if (!loading) StartSyncLoad(sync_load);
+    }
+    if (!loading) break;
+    WaitForSyncLoad(sync_load);
+  }
+  auto mat = Material::LoadFromMaterialDef(def, load_texture_fn);
+  {
+    fplutil::MutexLock lock(material_mutex_);
+    if (mat) material_map_.Insert(name, mat);
+    FinishSyncLoad(sync_load);
+  }
   return mat;
 }
 
 void AssetManager::UnloadMaterial(const char *filename) {
-  auto mat = FindMaterial(filename);
+  fplutil::MutexLock lock(material_mutex_);
+  auto mat = material_map_.Find(filename);
   if (!mat || mat->DecreaseRefCount()) return;
   mat->DeleteTextures();
-  material_map_.erase(filename);
-  for (auto it = mat->textures().begin(); it != mat->textures().end(); ++it) {
-    texture_map_.erase((*it)->filename());
+  material_map_.Erase(filename);
+  std::vector<Texture *> unshared;
+  {
+    fplutil::MutexLock resident_lock(resident_mutex_);
+    for (auto it = mat->textures().begin(); it != mat->textures().end();
+         ++it) {
+      texture_map_.Erase((*it)->filename());
+      ForgetResidency(*it);
+      ForgetSharing(*it, &unshared);
+    }
+  }
+  UnloadUnshared(unshared);
+  // A material whose file is still loading has no textures yet. Drop it; if
+  // it is part way through, the loader deletes it once it is done with it.
+  if (!mat->IsFinalized() && mat->textures().empty() &&
+      loader_.AbortJob(mat)) {
+    delete mat;
   }
 }
 
 Mesh *AssetManager::FindMesh(const char *filename) {
-  return FindInMap(mesh_map_, filename);
+  return FindMesh(AssetIdFromName(filename));
 }
 
-Mesh *AssetManager::LoadMesh(const char *filename, bool async) {
-  auto mesh = FindMesh(filename);
-  if (mesh) return mesh;
+Mesh *AssetManager::FindMesh(AssetId id) {
+  fplutil::MutexLock lock(resident_mutex_);
+  return Revive(mesh_map_.Find(id));
+}
 
+Mesh *AssetManager::LoadMesh(const char *filename, bool async, int priority) {
+  RecordLoad(manifestdef::AssetType_Mesh, filename);
+  return LoadMeshHelper(filename, async, priority);
+}
+
+Mesh *AssetManager::LoadMeshHelper(const char *filename, bool async,
+                                   int priority) {
   auto async_flags = (async ? kTextureFlagsLoadAsync : kTextureFlagsNone);
-  auto load_texture_fn = [this, async_flags](const char *filename,
-                                             TextureFormat format,
-                                             TextureFlags flags) -> Texture * {
-    auto tex = LoadTexture(filename, format, flags | async_flags);
+  auto load_texture_fn = [this, async_flags, priority](
+      const char *filename, TextureFormat format,
+      TextureFlags flags) -> Texture * {
+    auto tex = LoadTexture(filename, format, flags | async_flags, priority);
     tex->set_scale(texture_scale_);
     return tex;
   };
 
-  mesh =
-      new Mesh(filename, [this, async, load_texture_fn](const char *filename,
-                                                 const matdef::Material *def) {
+  Mesh *mesh;
+  bool found;
+  {
+    // See LoadTexture().
+    fplutil::MutexLock lock(resident_mutex_);
+    mesh = Revive(mesh_map_.Find(filename));
+    found = mesh != nullptr;
+    if (!found) {
+      mesh = new Mesh(filename, [this, async, priority, load_texture_fn](
+                                    const char *filename,
+                                    const matdef::Material *def) {
         if (def) {
-          return Material::LoadFromMaterialDef(def, load_texture_fn);
+          return LoadEmbeddedMaterial(def, load_texture_fn);
         } else {
-          return LoadMaterial(filename, async);
+          return LoadMaterial(filename, async, async, priority);
         }
       });
-  return LoadOrQueue(mesh, mesh_map_, async, nullptr /* alias */);
+      TrackResidency(mesh);
+      mesh_map_.Insert(filename, mesh);
+    }
+  }
+  if (found) {
+    RaisePriority(mesh, priority);
+    return mesh;
+  }
+  LoadOrQueue(mesh, async, priority);
+  EnforceResidencyBudget();
+  return mesh;
 }
 
 void AssetManager::UnloadMesh(const char *filename) {
-  auto mesh = FindMesh(filename);
-  if (!mesh || mesh->DecreaseRefCount()) return;
-  loader_.AbortJob(mesh);
-  mesh_map_.erase(filename);
-  delete mesh;
+  UnloadResidentAsset(mesh_map_, filename, true);
 }
 
 TextureAtlas *AssetManager::FindTextureAtlas(const char *filename) {
-  return FindInMap(texture_atlas_map_, filename);
+  return FindTextureAtlas(AssetIdFromName(filename));
+}
+
+TextureAtlas *AssetManager::FindTextureAtlas(AssetId id) {
+  fplutil::MutexLock lock(atlas_mutex_);
+  return texture_atlas_map_.Find(id);
 }
 
 TextureAtlas *AssetManager::LoadTextureAtlas(const char *filename,
                                              TextureFormat format,
-                                             TextureFlags flags) {
-  auto atlas = FindTextureAtlas(filename);
-  if (atlas) return atlas;
-  atlas = TextureAtlas::LoadTextureAtlas(filename, format, flags,
-    [&](const char *filename, TextureFormat format, TextureFlags flags) {
-      return LoadTexture(filename, format, flags);
-    });
-  if (!atlas) return nullptr;
-  texture_atlas_map_[filename] = atlas;
-  return atlas;
+                                             TextureFlags flags, bool async,
+                                             int priority) {
+  auto load_texture_fn = [this, priority](const char *filename,
+                                          TextureFormat format,
+                                          TextureFlags flags) {
+    return LoadTexture(filename, format, flags, priority);
+  };
+  return FindOrLoad(atlas_mutex_, texture_atlas_map_, filename, async,
+                    priority, [=]() {
+                      return new TextureAtlas(filename, format, flags,
+                                              load_texture_fn);
+                    });
 }
 
 void AssetManager::UnloadTextureAtlas(const char *filename) {
-  auto atlas = FindTextureAtlas(filename);
-  if (!atlas || atlas->DecreaseRefCount()) return;
-  texture_atlas_map_.erase(filename);
-  delete atlas;
+  TextureAtlas *atlas;
+  {
+    fplutil::MutexLock lock(atlas_mutex_);
+    atlas = texture_atlas_map_.Find(filename);
+    if (!atlas || atlas->DecreaseRefCount()) return;
+    texture_atlas_map_.Erase(filename);
+  }
+  // If it is still loading, the loader deletes it once it is done with it.
+  if (loader_.AbortJob(atlas)) delete atlas;
 }
 
 FileAsset *AssetManager::FindFileAsset(const char *filename) {
-  return FindInMap(file_map_, filename);
+  return FindFileAsset(AssetIdFromName(filename));
 }
 
-FileAsset *AssetManager::LoadFileAsset(const char *filename) {
-  auto file = FindFileAsset(filename);
-  if (file) return file;
-  file = new FileAsset();
-  if (LoadFile(filename, &file->contents)) {
-    file_map_[filename] = file;
-    return file;
-  }
-  delete file;
-  return nullptr;
+FileAsset *AssetManager::FindFileAsset(AssetId id) {
+  fplutil::MutexLock lock(file_mutex_);
+  return file_map_.Find(id);
+}
+
+FileAsset *AssetManager::LoadFileAsset(const char *filename, bool async,
+                                       int priority) {
+  return FindOrLoad(file_mutex_, file_map_, filename, async, priority,
+                    [filename]() {
+                      auto file = new FileAsset();
+                      file->set_filename(filename);
+                      return file;
+                    });
 }
 
 void AssetManager::UnloadFileAsset(const char *filename) {
-  auto file = FindFileAsset(filename);
-  if (!file || file->DecreaseRefCount()) return;
-  file_map_.erase(filename);
-  delete file;
+  FileAsset *file;
+  {
+    fplutil::MutexLock lock(file_mutex_);
+    file = file_map_.Find(filename);
+    if (!file || file->DecreaseRefCount()) return;
+    file_map_.Erase(filename);
+  }
+  // If it is still loading, the loader deletes it once it is done with it.
+  if (loader_.AbortJob(file)) delete file;
 }
 
 }  // namespace fplbase
@@ -0,0 +1,150 @@
+// Copyright 2017 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "asset_pack_generated.h"
+#include "fplbase/asset_pack.h"
+#include "fplbase/utilities.h"
+
+namespace fplbase {
+
+// The size of the table of contents, and 4 bytes of padding.
+static const size_t kPackHeaderSize = 8;
+
+AssetPack::AssetPack()
+    : mapped_(nullptr), toc_(nullptr), mounted_(false) {}
+
+bool AssetPack::Open(const char *filename) {
+  Close();
+  int32_t size = 0;
+  auto mapped = static_cast<const uint8_t *>(MapFile(filename, 0, &size));
+  if (!mapped) return false;
+  const size_t mapped_size = static_cast<size_t>(size);
+
+  const packdef::Pack *toc = nullptr;
+  if (mapped_size >= kPackHeaderSize) {
+    const size_t toc_size = flatbuffers::ReadScalar<uint32_t>(mapped);
+    if (toc_size <= mapped_size - kPackHeaderSize) {
+      flatbuffers::Verifier verifier(mapped + kPackHeaderSize, toc_size);
+      if (packdef::VerifyPackBuffer(verifier)) {
+        toc = packdef::GetPack(mapped + kPackHeaderSize);
+      }
+    }
+  }
+  if (!toc) {
+    LogError(kError, "%s is not an asset pack", filename);
+    UnmapFile(mapped, size);
+    return false;
+  }
+  if (toc->version() != kAssetPackVersion) {
+    LogError(kError, "%s has version %u instead of %u, rebuild it", filename,
+             toc->version(), kAssetPackVersion);
+    UnmapFile(mapped, size);
+    return false;
+  }
+  // Check once here, so View() can trust the offsets.
+  if (toc->entries()) {
+    for (auto it = toc->entries()->begin(); it != toc->entries()->end();
+         ++it) {
+      if (it->offset() > mapped_size ||
+          it->size() > mapped_size - it->offset()) {
+        LogError(kError, "%s is truncated", filename);
+        UnmapFile(mapped, size);
+        return false;
+      }
+    }
+  }
+  mapped_ = mapped;
+  mapping_ = std::shared_ptr<const void>(
+      mapped, [size](const void *mapping) { UnmapFile(mapping, size); });
+  toc_ = toc;
+  return true;
+}
+
+void AssetPack::Close() {
+  if (!mapped_) return;
+  Unmount();
+  mapping_.reset();
+  mapped_ = nullptr;
+  toc_ = nullptr;
+}
+
+bool AssetPack::Contains(const char *name) const {
+  return toc_ && toc_->entries() &&
+         toc_->entries()->LookupByKey(name) != nullptr;
+}
+
+bool AssetPack::View(const char *name, const uint8_t **data,
+                     size_t *size) const {
+  if (!toc_ || !toc_->entries()) return false;
+  auto entry = toc_->entries()->LookupByKey(name);
+  if (!entry) return false;
+  *data = mapped_ + entry->offset();
+  *size = static_cast<size_t>(entry->size());
+  return true;
+}
+
+bool AssetPack::Load(const char *name, std::string *dest) const {
+  const uint8_t *data;
+  size_t size;
+  if (!View(name, &data, &size)) return false;
+  dest->assign(reinterpret_cast<const char *>(data), size);
+  return true;
+}
+
+size_t AssetPack::num_files() const {
+  return toc_ && toc_->entries() ? toc_->entries()->size() : 0;
+}
+
+void AssetPack::AddToIndex(FileIndex *index) const {
+  if (!toc_ || !toc_->entries()) return;
+  for (auto it = toc_->entries()->begin(); it != toc_->entries()->end();
+       ++it) {
+    index->AddFile(it->name()->c_str());
+  }
+}
+
+void AssetPack::Mount() {
+  if (!toc_ || mounted_) return;
+  // Fetch the current functions first, so the new ones can hold on to them.
+  previous_load_file_ = SetLoadFileFunction(nullptr);
+  previous_view_file_ = SetViewFileFunction(nullptr);
+  const LoadFileFunction load_file = previous_load_file_;
+  const ViewFileFunction view_file = previous_view_file_;
+  SetLoadFileFunction([this, load_file](const char *filename,
+                                        std::string *dest) {
+    return Load(filename, dest) || load_file(filename, dest);
+  });
+  SetViewFileFunction([this, view_file](const char *filename,
+                                        const uint8_t **data, size_t *size,
+                                        std::shared_ptr<const void> *owner) {
+    if (View(filename, data, size)) {
+      if (owner) *owner = mapping_;
+      return true;
+    }
+    return view_file && view_file(filename, data, size, owner);
+  });
+  mounted_ = true;
+}
+
+void AssetPack::Unmount() {
+  if (!mounted_) return;
+  SetLoadFileFunction(previous_load_file_);
+  SetViewFileFunction(previous_view_file_);
+  previous_load_file_ = nullptr;
+  previous_view_file_ = nullptr;
+  mounted_ = false;
+}
+
+}  // namespace fplbase
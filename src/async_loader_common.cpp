@@ -0,0 +1,205 @@
+// Copyright 2017 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include <memory>
+#include <thread>
+
+#include "fplbase/async_loader.h"
+
+namespace fplbase {
+
+bool AsyncAsset::LoadNow() {
+  load_stats_ = AsyncLoadStats();
+  const double read_start = AsyncLoader::CurrentTime();
+  Read();
+  const double decode_start = AsyncLoader::CurrentTime();
+  Decode();
+  const double finalize_start = AsyncLoader::CurrentTime();
+  load_stats_.read_seconds = decode_start - read_start;
+  load_stats_.decode_seconds = finalize_start - decode_start;
+  load_stats_.bytes_uploaded = UploadSize();
+  bool ok = data_ != nullptr;
+  // Call this even if data_ is null, to enforce Finalize() checking for it.
+  ok = Finalize() && ok;
+  load_stats_.finalize_seconds = AsyncLoader::CurrentTime() - finalize_start;
+  return ok;
+}
+
+FileView AsyncAsset::LoadReadFile(const char *filename) {
+  if (read_ahead_ && read_ahead_name_ == filename) {
+    FileView file;
+    file.swap(read_ahead_);
+    return file;
+  }
+  return LoadFileView(filename);
+}
+
+// static
+void AsyncLoader::ReadJob(AsyncAsset *job) {
+  job->Read();
+  // Read() may have loaded a different file than the one read ahead, e.g. a
+  // texture in a format the renderer doesn't support.
+  job->read_ahead_.reset();
+  job->read_ahead_name_.clear();
+}
+
+void AsyncLoader::PushCompleted(AsyncAsset *job) {
+  AsyncAsset *head = completed_.load(std::memory_order_relaxed);
+  do {
+    job->next_completed_ = head;
+  } while (!completed_.compare_exchange_weak(
+      head, job, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void AsyncLoader::PopCompleted() {
+  AsyncAsset *head = completed_.exchange(nullptr, std::memory_order_acquire);
+
+  // The stack is newest first, so reverse it to finalize jobs in the order
+  // they finished.
+  AsyncAsset *oldest = nullptr;
+  while (head) {
+    AsyncAsset *next = head->next_completed_;
+    head->next_completed_ = oldest;
+    oldest = head;
+    head = next;
+  }
+  for (; oldest; oldest = oldest->next_completed_) {
+    done_.push_back(oldest);
+    done_bytes_ += oldest->upload_size_;
+  }
+}
+
+void AsyncLoader::ClearCompleted() {
+  PopCompleted();
+  for (auto it = done_.begin(); it != done_.end(); ++it) {
+    if ((*it)->load_cancelled_) delete *it;
+  }
+  done_.clear();
+  done_bytes_ = 0;
+  decoded_bytes_ = 0;
+}
+
+bool AsyncLoader::TryFinalize() { return TryFinalize(0.0, 0); }
+
+bool AsyncLoader::TryFinalize(double max_seconds, size_t max_bytes) {
+  const double start_time = max_seconds > 0.0 ? CurrentTime() : 0.0;
+  size_t bytes = 0;
+  for (;;) {
+    if (done_.empty()) PopCompleted();
+    if (done_.empty()) break;
+
+    AsyncAsset *res = done_.front();
+    done_.pop_front();
+    const size_t upload_size = res->upload_size_;
+    done_bytes_ -= upload_size;
+    if (res->load_cancelled_) {
+      // AbortJob() gave us this one while it was loading.
+      delete res;
+      ReleaseDecodedBytes(upload_size);
+      continue;
+    }
+
+    finalizing_ = res;
+    const double finalize_start = CurrentTime();
+    bool ok = res->Finalize();
+    if (!ok) {
+      // Can't do much here, since res is already constructed. Caller has to
+      // check IsValid() to know if resource can be used.
+    }
+    res->load_stats_.finalize_seconds = CurrentTime() - finalize_start;
+    finalizing_ = nullptr;
+    if (res->load_cancelled_) {
+      // Aborted by its own finalize callbacks, which already updated the
+      // count.
+      delete res;
+    } else {
+      --num_pending_requests_;
+    }
+    ReleaseDecodedBytes(upload_size);
+
+    bytes += upload_size;
+    if (max_bytes > 0 && bytes >= max_bytes) break;
+    if (max_seconds > 0.0 && CurrentTime() - start_time >= max_seconds) break;
+  }
+  return num_pending_requests_ == 0;
+}
+
+void AsyncLoader::WaitForFinalize(AsyncAsset *res) {
+  if (res->IsFinalized()) return;
+  PrioritizeJob(res, kLoadPriorityUrgent);
+  StartLoading();
+  while (!res->IsFinalized()) {
+    // Nothing left to finalize means `res` isn't one of ours; don't spin
+    // forever on it.
+    if (TryFinalize()) break;
+    std::this_thread::yield();
+  }
+}
+
+void AsyncLoader::SetMaxDecodedBytes(size_t max_bytes) {
+  max_decoded_bytes_ = max_bytes;
+  WakeThrottledWorkers();
+}
+
+void AsyncLoader::ReleaseDecodedBytes(size_t bytes) {
+  if (bytes == 0) return;
+  decoded_bytes_ -= bytes;
+  if (num_throttled_workers_ > 0) WakeThrottledWorkers();
+}
+
+int AsyncLoader::NumPendingFinalizes() {
+  PopCompleted();
+  return static_cast<int>(done_.size());
+}
+
+size_t AsyncLoader::PendingFinalizeBytes() {
+  PopCompleted();
+  return done_bytes_;
+}
+
+void AsyncAsset::CallFinalizeCallbackAfter(
+    const std::vector<AsyncAsset *> &assets) {
+  if (!self_) self_ = std::make_shared<AsyncAsset *>(this);
+  std::weak_ptr<AsyncAsset *> self = self_;
+  WhenAllFinalized(assets, [self]() {
+    auto asset = self.lock();
+    if (asset) (*asset)->CallFinalizeCallback();
+  });
+}
+
+void WhenAllFinalized(const std::vector<AsyncAsset *> &assets,
+                      AsyncAsset::AssetFinalizedCallback callback) {
+  // Shared by the callbacks added to each asset, so `callback` itself is
+  // only stored once.
+  struct Pending {
+    size_t remaining;
+    AsyncAsset::AssetFinalizedCallback callback;
+  };
+  auto pending = std::make_shared<Pending>();
+  // Hold one count until all callbacks are added, so that assets which are
+  // already finalized can't call `callback` early.
+  pending->remaining = 1;
+  pending->callback = std::move(callback);
+  auto finalized = [pending]() {
+    if (--pending->remaining == 0) pending->callback();
+  };
+  for (auto it = assets.begin(); it != assets.end(); ++it) {
+    ++pending->remaining;
+    if (!(*it)->AddFinalizeCallback(finalized)) --pending->remaining;
+  }
+  finalized();
+}
+
+}  // namespace fplbase
@@ -37,21 +37,84 @@ class BookendAsyncResource : public AsyncAsset {
 const char *BookendAsyncResource::kBookendFileName = "bookend";
 
 AsyncLoader::AsyncLoader()
-    : loading_(nullptr), num_pending_requests_(0), worker_thread_(nullptr) {
+    : next_sequence_(0),
+      completed_(nullptr),
+      done_bytes_(0),
+      finalizing_(nullptr),
+      num_pending_requests_(0),
+      decoded_bytes_(0),
+      max_decoded_bytes_(0),
+      num_throttled_workers_(0),
+      num_worker_threads_(0),
+      num_io_threads_(0),
+      num_running_readers_(0),
+      stopping_(false) {
   mutex_ = SDL_CreateMutex();
   job_semaphore_ = SDL_CreateSemaphore(0);
-  assert(mutex_ && job_semaphore_);
+  decode_semaphore_ = SDL_CreateSemaphore(0);
+  memory_semaphore_ = SDL_CreateSemaphore(0);
+  assert(mutex_ && job_semaphore_ && decode_semaphore_ && memory_semaphore_);
+  SetNumWorkerThreads(0);
+  SetNumIOThreads(0);
 }
 
 AsyncLoader::~AsyncLoader() {
   Stop();
+  ClearCompleted();
+}
+
+// static
+double AsyncLoader::CurrentTime() {
+  return static_cast<double>(SDL_GetPerformanceCounter()) /
+         static_cast<double>(SDL_GetPerformanceFrequency());
+}
+
+// static
+int AsyncLoader::DefaultNumWorkerThreads() {
+  // Leave one core for the main thread.
+  return std::max(SDL_GetCPUCount() - 1, 1);
+}
+
+void AsyncLoader::SetNumWorkerThreads(int num_threads) {
+  if (!workers_.empty() && workers_[0].thread) {
+    LogError(kApplication, "Can't change the number of loader threads "
+                           "while loading.");
+    return;
+  }
+  num_worker_threads_ =
+      num_threads > 0 ? num_threads : DefaultNumWorkerThreads();
+  Worker idle = {this, nullptr, nullptr, false};
+  workers_.assign(num_worker_threads_, idle);
+}
+
+void AsyncLoader::SetNumIOThreads(int num_threads) {
+  if (!readers_.empty() && readers_[0].thread) {
+    LogError(kApplication, "Can't change the number of loader threads "
+                           "while loading.");
+    return;
+  }
+  num_io_threads_ = num_threads > 0 ? num_threads : kDefaultNumIOThreads;
+  Worker idle = {this, nullptr, nullptr, true};
+  readers_.assign(num_io_threads_, idle);
+}
+
+void AsyncLoader::SetReadAheadFunction(ReadAheadFunction read_ahead) {
+  // Kept for the interface only: this backend reads every file on its I/O
+  // threads.
+  read_ahead_ = std::move(read_ahead);
 }
 
 void AsyncLoader::Stop() {
-  if (worker_thread_) {
+  if (!workers_.empty() && workers_[0].thread) {
     StopLoadingWhenComplete();
-    SDL_WaitThread(static_cast<SDL_Thread *>(worker_thread_), nullptr);
-    worker_thread_ = nullptr;
+    for (auto it = readers_.begin(); it != readers_.end(); ++it) {
+      SDL_WaitThread(static_cast<SDL_Thread *>(it->thread), nullptr);
+      it->thread = nullptr;
+    }
+    for (auto it = workers_.begin(); it != workers_.end(); ++it) {
+      SDL_WaitThread(static_cast<SDL_Thread *>(it->thread), nullptr);
+      it->thread = nullptr;
+    }
 
     if (mutex_) {
       SDL_DestroyMutex(static_cast<SDL_mutex *>(mutex_));
@@ -61,103 +124,248 @@ void AsyncLoader::Stop() {
       SDL_DestroySemaphore(static_cast<SDL_semaphore *>(job_semaphore_));
       job_semaphore_ = nullptr;
     }
+    if (decode_semaphore_) {
+      SDL_DestroySemaphore(static_cast<SDL_semaphore *>(decode_semaphore_));
+      decode_semaphore_ = nullptr;
+    }
+    if (memory_semaphore_) {
+      SDL_DestroySemaphore(static_cast<SDL_semaphore *>(memory_semaphore_));
+      memory_semaphore_ = nullptr;
+    }
   }
 }
 
-void AsyncLoader::QueueJob(AsyncAsset *res) {
-  Lock([this, res]() {
-    queue_.push_back(res);
+void AsyncLoader::QueueJob(AsyncAsset *res, int priority, double deadline) {
+  Lock([this, res, priority, deadline]() {
+    SetSchedule(res, priority, deadline);
+    res->load_sequence_ = next_sequence_++;
+    res->load_cancelled_ = false;
+    res->load_stats_ = AsyncLoadStats();
+    res->upload_size_ = 0;
+    res->load_queued_time_ = CurrentTime();
+    InsertSorted(&queue_, res);
     ++num_pending_requests_;
   });
   SDL_SemPost(static_cast<SDL_semaphore *>(job_semaphore_));
 }
 
-void AsyncLoader::AbortJob(AsyncAsset *res) {
-  const bool was_loading =
-      LockReturn<bool>([this, res]() { return loading_ == res; });
+void AsyncLoader::PrioritizeJob(AsyncAsset *res, int priority,
+                                double deadline) {
+  Lock([this, res, priority, deadline]() {
+    auto iter = std::find(queue_.begin(), queue_.end(), res);
+    if (iter != queue_.end()) {
+      queue_.erase(iter);
+      SetSchedule(res, priority, deadline);
+      InsertSorted(&queue_, res);
+      return;
+    }
+    iter = std::find(decode_queue_.begin(), decode_queue_.end(), res);
+    if (iter != decode_queue_.end()) {
+      decode_queue_.erase(iter);
+      SetSchedule(res, priority, deadline);
+      InsertSorted(&decode_queue_, res);
+    }
+  });
+}
 
-  if (was_loading) {
-    PauseLoading();
+bool AsyncLoader::AbortJob(AsyncAsset *res) {
+  if (res == finalizing_) {
+    // TryFinalize() deletes it once Finalize() returns.
+    res->load_cancelled_ = true;
+    --num_pending_requests_;
+    return false;
   }
 
-  Lock([this, res]() {
+  bool found = false;
+  const bool loading = LockReturn<bool>([this, res, &found]() {
     auto iter = std::find(queue_.begin(), queue_.end(), res);
     if (iter != queue_.end()) {
       queue_.erase(iter);
       --num_pending_requests_;
+      found = true;
+      return false;
+    }
+
+    iter = std::find(decode_queue_.begin(), decode_queue_.end(), res);
+    if (iter != decode_queue_.end()) {
+      decode_queue_.erase(iter);
+      --num_pending_requests_;
+      found = true;
+      return false;
     }
 
-    iter = std::find(done_.begin(), done_.end(), res);
-    if (iter != done_.end()) {
-      done_.erase(iter);
+    bool busy = false;
+    for (auto it = readers_.begin(); it != readers_.end(); ++it) {
+      busy = busy || it->loading == res;
+    }
+    for (auto it = workers_.begin(); it != workers_.end(); ++it) {
+      busy = busy || it->loading == res;
+    }
+    if (busy) {
+      // The worker checks this when it is done with its current stage, and
+      // hands the job straight to TryFinalize() to delete.
+      res->load_cancelled_ = true;
       --num_pending_requests_;
     }
+    return busy;
   });
+  if (loading) return false;
+  if (found) return true;
 
-  if (was_loading) {
-    StartLoading();
+  // Workers push a job to completed_ before clearing their `loading` slot, so
+  // a job that isn't loading anymore is found here.
+  PopCompleted();
+  auto iter = std::find(done_.begin(), done_.end(), res);
+  if (iter != done_.end()) {
+    done_bytes_ -= res->upload_size_;
+    done_.erase(iter);
+    --num_pending_requests_;
+    ReleaseDecodedBytes(res->upload_size_);
   }
+  return true;
 }
 
-void AsyncLoader::LoaderWorker() {
+void AsyncLoader::ReaderWorker(Worker *worker) {
+  AsyncAsset *job = nullptr;
   for (;;) {
-    Lock([this]() { loading_ = queue_.empty() ? nullptr : queue_.front(); });
-    if (!loading_) {
+    bool bookend = false;
+    job = nullptr;
+    Lock([this, worker, &job, &bookend]() {
+      if (queue_.empty()) return;
+      job = queue_.front();
+      // Stop reading once we reach the bookend enqueued by
+      // StopLoadingWhenComplete(). It stays in the queue so that every worker
+      // sees it. To start loading again, call StartLoading().
+      bookend = BookendAsyncResource::IsBookend(*job);
+      if (bookend) return;
+      queue_.pop_front();
+      worker->loading = job;
+    });
+    if (bookend) {
+      // Wake up the next worker so it finds the bookend as well.
+      SDL_SemPost(static_cast<SDL_semaphore *>(job_semaphore_));
+      break;
+    }
+    if (!job) {
       SDL_SemWait(static_cast<SDL_semaphore *>(job_semaphore_));
       continue;
     }
-    // Stop loading once we reach the bookend enqueued by
-    // StopLoadingWhenComplete(). To start loading again, call StartLoading().
-    if (BookendAsyncResource::IsBookend(*loading_)) break;
-    LogInfo(kApplication, "async load: %s", loading_->filename_.c_str());
-    loading_->Load();
-    Lock([this]() {
-      queue_.pop_front();
-      done_.push_back(loading_);
-      loading_ = nullptr;
+    LogInfo(kApplication, "async load: %s", job->filename_.c_str());
+    const double read_start = CurrentTime();
+    job->load_stats_.queue_seconds = read_start - job->load_queued_time_;
+    job->Read();
+    job->load_stats_.read_seconds = CurrentTime() - read_start;
+    Lock([this, worker, job]() {
+      if (job->load_cancelled_) {
+        PushCompleted(job);
+      } else {
+        job->load_queued_time_ = CurrentTime();
+        InsertSorted(&decode_queue_, job);
+      }
+      worker->loading = nullptr;
     });
+    SDL_SemPost(static_cast<SDL_semaphore *>(decode_semaphore_));
+  }
+
+  // Once every job has been read, the last I/O thread passes the bookend on
+  // to the decode threads. It sorts after the jobs still waiting there.
+  AsyncAsset *bookend = job;
+  const bool last_reader =
+      LockReturn<bool>([this]() { return --num_running_readers_ == 0; });
+  if (last_reader) {
+    Lock([this, bookend]() { InsertSorted(&decode_queue_, bookend); });
+    SDL_SemPost(static_cast<SDL_semaphore *>(decode_semaphore_));
+  }
+}
+
+void AsyncLoader::LoaderWorker(Worker *worker) {
+  for (;;) {
+    // Wait for TryFinalize() to release some decoded data. Nobody finalizes
+    // while Stop() waits for the workers, so ignore the limit then.
+    while (OverDecodeBudget() && !stopping_) {
+      ++num_throttled_workers_;
+      if (OverDecodeBudget() && !stopping_) {
+        SDL_SemWait(static_cast<SDL_semaphore *>(memory_semaphore_));
+      }
+      --num_throttled_workers_;
+    }
+    AsyncAsset *job = nullptr;
+    bool bookend = false;
+    Lock([this, worker, &job, &bookend]() {
+      if (decode_queue_.empty()) return;
+      job = decode_queue_.front();
+      bookend = BookendAsyncResource::IsBookend(*job);
+      if (bookend) return;
+      decode_queue_.pop_front();
+      worker->loading = job;
+    });
+    if (bookend) {
+      // Wake up the next worker so it finds the bookend as well.
+      SDL_SemPost(static_cast<SDL_semaphore *>(decode_semaphore_));
+      break;
+    }
+    if (!job) {
+      SDL_SemWait(static_cast<SDL_semaphore *>(decode_semaphore_));
+      continue;
+    }
+    const double decode_start = CurrentTime();
+    job->load_stats_.queue_seconds += decode_start - job->load_queued_time_;
+    job->Decode();
+    job->load_stats_.decode_seconds = CurrentTime() - decode_start;
+    job->upload_size_ = job->UploadSize();
+    job->load_stats_.bytes_uploaded = job->upload_size_;
+    decoded_bytes_ += job->upload_size_;
+    // Clear `loading` only after pushing, so AbortJob() always finds the job
+    // in one or the other.
+    PushCompleted(job);
+    Lock([worker]() { worker->loading = nullptr; });
   }
 }
 
 int AsyncLoader::LoaderThread(void *user_data) {
-  reinterpret_cast<AsyncLoader *>(user_data)->LoaderWorker();
+  Worker *worker = reinterpret_cast<Worker *>(user_data);
+  if (worker->reader) {
+    worker->loader->ReaderWorker(worker);
+  } else {
+    worker->loader->LoaderWorker(worker);
+  }
   return 0;
 }
 
 void AsyncLoader::StartLoading() {
-  worker_thread_ =
-      SDL_CreateThread(AsyncLoader::LoaderThread, "FPL Loader Thread", this);
-  assert(worker_thread_);
+  stopping_ = false;
+  for (auto it = readers_.begin(); it != readers_.end(); ++it) {
+    if (it->thread) continue;
+    Lock([this]() { ++num_running_readers_; });
+    it->thread =
+        SDL_CreateThread(AsyncLoader::LoaderThread, "FPL Reader Thread", &*it);
+    assert(it->thread);
+  }
+  for (auto it = workers_.begin(); it != workers_.end(); ++it) {
+    if (it->thread) continue;
+    it->thread =
+        SDL_CreateThread(AsyncLoader::LoaderThread, "FPL Loader Thread", &*it);
+    assert(it->thread);
+  }
 }
 
 void AsyncLoader::PauseLoading() { assert(false); }
 
 void AsyncLoader::StopLoadingWhenComplete() {
-  // When the loader thread hits the bookend, it will exit.
+  // When the loader threads hit the bookend, they will exit. The lowest
+  // priority sorts it after all the jobs that are already queued.
   static BookendAsyncResource bookend;
-  QueueJob(&bookend);
+  QueueJob(&bookend, std::numeric_limits<int>::min());
+  stopping_ = true;
+  WakeThrottledWorkers();
 }
 
-bool AsyncLoader::TryFinalize() {
-  for (;;) {
-    auto res = LockReturn<AsyncAsset *>(
-        [this]() { return done_.empty() ? nullptr : done_.front(); });
-    if (!res) break;
-    bool ok = res->Finalize();
-    if (!ok) {
-      // Can't do much here, since res is already constructed. Caller has to
-      // check IsValid() to know if resource can be used.
-    }
-    Lock([this, res]() {
-      // It's possible that the resource was destroyed during its finalize
-      // callbacks, so ensure that it's still the first item in done_.
-      if (done_.size() > 0 && done_.front() == res) {
-        done_.pop_front();
-      }
-      --num_pending_requests_;
-    });
+void AsyncLoader::WakeThrottledWorkers() {
+  // A semaphore remembers posts nobody waited for yet, so a worker about to
+  // wait can't miss this. Extra posts only cause an extra check.
+  for (int i = num_throttled_workers_; i > 0; --i) {
+    SDL_SemPost(static_cast<SDL_semaphore *>(memory_semaphore_));
   }
-  return LockReturn<bool>([this]() { return num_pending_requests_ == 0; });
 }
 
 void AsyncLoader::Lock(const std::function<void()> &body) {
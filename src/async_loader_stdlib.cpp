@@ -12,143 +12,520 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <chrono>
+
 #include "fplbase/async_loader.h"
 #include "fplbase/utilities.h"
 #include "precompiled.h"
 
 namespace fplbase {
 
-AsyncLoader::AsyncLoader() : loading_(nullptr), num_pending_requests_(0) {
+// How many jobs per decode thread the I/O threads may read ahead of decoding.
+// Keeps fast storage from reading every queued file into memory while the
+// decode threads are busy.
+static const int kReadAheadPerWorker = 2;
+
+AsyncLoader::AsyncLoader()
+    : next_sequence_(0),
+      completed_(nullptr),
+      done_bytes_(0),
+      finalizing_(nullptr),
+      num_pending_requests_(0),
+      decoded_bytes_(0),
+      max_decoded_bytes_(0),
+      num_throttled_workers_(0),
+      num_worker_threads_(0),
+      num_io_threads_(0),
+      next_worker_(0),
+      num_queued_jobs_(0),
+      num_reading_(0),
+      pause_(false),
+      stop_when_complete_(false) {
+  SetNumWorkerThreads(0);
+  SetNumIOThreads(0);
 }
 
 AsyncLoader::~AsyncLoader() {
   {
     std::lock_guard<std::mutex> lock(mutex_);
     queue_.clear();
+    for (auto it = workers_.begin(); it != workers_.end(); ++it) {
+      std::lock_guard<std::mutex> worker_lock((*it)->mutex);
+      num_queued_jobs_ -= static_cast<int>((*it)->jobs.size());
+      (*it)->jobs.clear();
+    }
   }
   Stop();
+  ClearCompleted();
+}
+
+// static
+double AsyncLoader::CurrentTime() {
+  return std::chrono::duration<double>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// static
+int AsyncLoader::DefaultNumWorkerThreads() {
+  // Leave one core for the main thread. hardware_concurrency() may return 0
+  // if it can't tell.
+  const int num_cores = static_cast<int>(std::thread::hardware_concurrency());
+  return std::max(num_cores - 1, 1);
+}
+
+bool AsyncLoader::IsRunning() const {
+  for (auto it = workers_.begin(); it != workers_.end(); ++it) {
+    if ((*it)->thread.joinable()) return true;
+  }
+  for (auto it = readers_.begin(); it != readers_.end(); ++it) {
+    if ((*it)->thread.joinable()) return true;
+  }
+  return false;
+}
+
+void AsyncLoader::SetNumWorkerThreads(int num_threads) {
+  if (IsRunning()) {
+    LogError(kApplication, "Can't change the number of loader threads while "
+                           "loading.");
+    return;
+  }
+  num_worker_threads_ =
+      num_threads > 0 ? num_threads : DefaultNumWorkerThreads();
+
+  // Hand any previously queued jobs to the new set of workers.
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::deque<AsyncAsset *> jobs;
+  for (auto it = workers_.begin(); it != workers_.end(); ++it) {
+    jobs.insert(jobs.end(), (*it)->jobs.begin(), (*it)->jobs.end());
+  }
+  workers_.clear();
+  for (int i = 0; i < num_worker_threads_; ++i) {
+    workers_.push_back(std::unique_ptr<Worker>(
+        new Worker(this, static_cast<size_t>(i), false)));
+  }
+  next_worker_ = 0;
+  for (auto it = jobs.begin(); it != jobs.end(); ++it) {
+    InsertSorted(&workers_[next_worker_++ % workers_.size()]->jobs, *it);
+  }
+}
+
+void AsyncLoader::SetNumIOThreads(int num_threads) {
+  if (IsRunning()) {
+    LogError(kApplication, "Can't change the number of loader threads while "
+                           "loading.");
+    return;
+  }
+  num_io_threads_ = num_threads > 0 ? num_threads : kDefaultNumIOThreads;
+  readers_.clear();
+  for (int i = 0; i < num_io_threads_; ++i) {
+    readers_.push_back(std::unique_ptr<Worker>(
+        new Worker(this, static_cast<size_t>(i), true)));
+  }
+}
+
+void AsyncLoader::SetReadAheadFunction(ReadAheadFunction read_ahead) {
+  if (IsRunning()) {
+    LogError(kApplication, "Can't change the read-ahead function while "
+                           "loading.");
+    return;
+  }
+  read_ahead_ = std::move(read_ahead);
 }
 
 void AsyncLoader::Stop() {
-  if (worker_thread_.joinable()) {
+  if (IsRunning()) {
     StopLoadingWhenComplete();
-    worker_thread_.join();
+    for (auto it = readers_.begin(); it != readers_.end(); ++it) {
+      if ((*it)->thread.joinable()) (*it)->thread.join();
+    }
+    for (auto it = workers_.begin(); it != workers_.end(); ++it) {
+      if ((*it)->thread.joinable()) (*it)->thread.join();
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_when_complete_ = false;
   }
 }
 
-void AsyncLoader::QueueJob(AsyncAsset *res) {
+void AsyncLoader::QueueJob(AsyncAsset *res, int priority, double deadline) {
   {
     std::lock_guard<std::mutex> lock(mutex_);
-    queue_.push_back(res);
+    SetSchedule(res, priority, deadline);
+    res->load_sequence_ = next_sequence_++;
+    res->load_cancelled_ = false;
+    res->load_stats_ = AsyncLoadStats();
+    res->upload_size_ = 0;
+    res->load_queued_time_ = CurrentTime();
+    InsertSorted(&queue_, res);
     ++num_pending_requests_;
   }
-  job_cv_.notify_one();
+  read_cv_.notify_one();
 }
 
-void AsyncLoader::AbortJob(AsyncAsset *res) {
-  bool was_loading = false;
-  {
-    std::lock_guard<std::mutex> lock(mutex_);
-    was_loading = loading_ == res;
+void AsyncLoader::PrioritizeJob(AsyncAsset *res, int priority,
+                                double deadline) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto iter = std::find(queue_.begin(), queue_.end(), res);
+  if (iter != queue_.end()) {
+    queue_.erase(iter);
+    SetSchedule(res, priority, deadline);
+    InsertSorted(&queue_, res);
+    return;
+  }
+  for (auto it = workers_.begin(); it != workers_.end(); ++it) {
+    Worker &worker = **it;
+    std::lock_guard<std::mutex> worker_lock(worker.mutex);
+    auto iter = std::find(worker.jobs.begin(), worker.jobs.end(), res);
+    if (iter != worker.jobs.end()) {
+      worker.jobs.erase(iter);
+      SetSchedule(res, priority, deadline);
+      InsertSorted(&worker.jobs, res);
+      return;
+    }
+  }
+}
+
+// Removes `res` from the read queue or the decode deques, if it is waiting in
+// one of them. Must be called while holding mutex_.
+bool AsyncLoader::RemoveQueuedJob(AsyncAsset *res) {
+  auto iter = std::find(queue_.begin(), queue_.end(), res);
+  if (iter != queue_.end()) {
+    queue_.erase(iter);
+    --num_pending_requests_;
+    return true;
+  }
+  for (auto it = workers_.begin(); it != workers_.end(); ++it) {
+    Worker &worker = **it;
+    std::lock_guard<std::mutex> worker_lock(worker.mutex);
+    iter = std::find(worker.jobs.begin(), worker.jobs.end(), res);
+    if (iter != worker.jobs.end()) {
+      worker.jobs.erase(iter);
+      --num_queued_jobs_;
+      --num_pending_requests_;
+      // The I/O threads may be waiting for room to read ahead.
+      read_cv_.notify_all();
+      return true;
+    }
   }
+  return false;
+}
 
-  if (was_loading) {
-    PauseLoading();
+bool AsyncLoader::AbortJob(AsyncAsset *res) {
+  if (res == finalizing_) {
+    // TryFinalize() deletes it once Finalize() returns.
+    res->load_cancelled_ = true;
+    --num_pending_requests_;
+    return false;
   }
 
   {
+    // Holding mutex_ stops workers from moving `res` between the queues and
+    // their `loading` slots.
     std::lock_guard<std::mutex> lock(mutex_);
-    auto iter = std::find(queue_.begin(), queue_.end(), res);
-    if (iter != queue_.end()) {
-      queue_.erase(iter);
-      --num_pending_requests_;
-    }
+    if (RemoveQueuedJob(res)) return true;
 
-    iter = std::find(done_.begin(), done_.end(), res);
-    if (iter != done_.end()) {
-      done_.erase(iter);
+    bool loading = std::find(reading_ahead_.begin(), reading_ahead_.end(),
+                             res) != reading_ahead_.end();
+    for (auto it = readers_.begin(); it != readers_.end(); ++it) {
+      loading = loading || (*it)->loading == res;
+    }
+    for (auto it = workers_.begin(); it != workers_.end(); ++it) {
+      loading = loading || (*it)->loading == res;
+    }
+    if (loading) {
+      // The worker checks this when it is done with its current stage, and
+      // hands the job straight to TryFinalize() to delete.
+      res->load_cancelled_ = true;
       --num_pending_requests_;
+      return false;
     }
   }
 
-  if (was_loading) {
-    StartLoading();
+  // Workers push a job to completed_ before clearing their `loading` slot, so
+  // a job that isn't loading anymore is found here.
+  PopCompleted();
+  auto iter = std::find(done_.begin(), done_.end(), res);
+  if (iter != done_.end()) {
+    done_bytes_ -= res->upload_size_;
+    done_.erase(iter);
+    --num_pending_requests_;
+    ReleaseDecodedBytes(res->upload_size_);
   }
+  return true;
 }
 
 void AsyncLoader::StartLoading() {
-  if (!worker_thread_.joinable()) {
-    worker_thread_ = std::thread(AsyncLoader::LoaderThread, this);
+  if (!IsRunning()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      pause_ = false;
+      stop_when_complete_ = false;
+    }
+    for (auto it = readers_.begin(); it != readers_.end(); ++it) {
+      (*it)->thread = std::thread(AsyncLoader::LoaderThread, it->get());
+    }
+    for (auto it = workers_.begin(); it != workers_.end(); ++it) {
+      (*it)->thread = std::thread(AsyncLoader::LoaderThread, it->get());
+    }
   }
 }
 
 void AsyncLoader::PauseLoading() {
   {
     std::lock_guard<std::mutex> lock(mutex_);
-    queue_.push_front(nullptr);
+    pause_ = true;
+  }
+  read_cv_.notify_all();
+  job_cv_.notify_all();
+  for (auto it = readers_.begin(); it != readers_.end(); ++it) {
+    if ((*it)->thread.joinable()) (*it)->thread.join();
   }
-  job_cv_.notify_one();
-  worker_thread_.join();
+  for (auto it = workers_.begin(); it != workers_.end(); ++it) {
+    if ((*it)->thread.joinable()) (*it)->thread.join();
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  // Reads started ahead complete on the read-ahead function's threads, and
+  // call back into the loader, so wait for them too.
+  read_cv_.wait(lock, [this]() { return reading_ahead_.empty(); });
+  pause_ = false;
 }
 
-void AsyncLoader::StopLoadingWhenComplete() { QueueJob(nullptr); }
+void AsyncLoader::StopLoadingWhenComplete() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_when_complete_ = true;
+  }
+  read_cv_.notify_all();
+  job_cv_.notify_all();
+}
 
-bool AsyncLoader::TryFinalize() {
-  for (;;) {
-    AsyncAsset *resource = nullptr;
-    {
-      std::lock_guard<std::mutex> lock(mutex_);
-      if (done_.size() > 0) resource = done_[0];
-    }
+void AsyncLoader::WakeThrottledWorkers() {
+  {
+    // Throttled workers check OverDecodeBudget() while holding mutex_, so
+    // they can't miss this.
+    std::lock_guard<std::mutex> lock(mutex_);
+  }
+  job_cv_.notify_all();
+}
 
-    if (!resource) break;
-    bool ok = resource->Finalize();
-    if (!ok) {
-      // Can't do much here, since res is already constructed. Caller has to
-      // check IsValid() to know if resource can be used.
+// Pops the front of the worker's own deque. Once that runs dry, steals the
+// most important job at the front of the other deques, which keeps idle
+// workers busy without locking every deque for every job.
+AsyncAsset *AsyncLoader::PopJob(Worker *worker) {
+  AsyncAsset *job = nullptr;
+  int num_queued = 0;
+  {
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    if (!worker->jobs.empty()) {
+      job = worker->jobs.front();
+      worker->jobs.pop_front();
+      // Publish the job before releasing the deque lock, so AbortJob() always
+      // finds it in either a deque or a worker's `loading` slot.
+      worker->loading = job;
+      num_queued = num_queued_jobs_--;
     }
+  }
 
-    {
-      std::lock_guard<std::mutex> lock(mutex_);
-      // It's possible that the resource was destroyed during its finalize
-      // callbacks, so ensure that it's still the first item in done_.
-      if (done_.size() > 0 && done_.front() == resource) {
-        done_.pop_front();
+  const size_t num_workers = workers_.size();
+  while (!job) {
+    Worker *victim = nullptr;
+    AsyncAsset *best = nullptr;
+    for (size_t i = 1; i < num_workers; ++i) {
+      Worker *candidate = workers_[(worker->index + i) % num_workers].get();
+      std::lock_guard<std::mutex> lock(candidate->mutex);
+      if (candidate->jobs.empty()) continue;
+      if (!best || LoadsBefore(candidate->jobs.front(), best)) {
+        best = candidate->jobs.front();
+        victim = candidate;
       }
-      --num_pending_requests_;
     }
+    if (!best) return nullptr;
+
+    std::lock_guard<std::mutex> lock(victim->mutex);
+    // Another worker may have taken or rescheduled it in the meantime.
+    if (victim->jobs.empty() || victim->jobs.front() != best) continue;
+    victim->jobs.pop_front();
+    worker->loading = best;
+    num_queued = num_queued_jobs_--;
+    job = best;
   }
-  bool finished;
+
+  if (num_queued <= kReadAheadPerWorker * num_worker_threads_) {
+    // The I/O threads may be waiting for room to read ahead. Take mutex_
+    // so they can't miss this. Checking for the exact limit isn't enough,
+    // as RemoveQueuedJob() may have lowered the count in the meantime.
+    std::lock_guard<std::mutex> lock(mutex_);
+    read_cv_.notify_all();
+  }
+  return job;
+}
+
+bool AsyncLoader::StartReadAhead(Worker *reader, AsyncAsset *job) {
+  if (!read_ahead_) return false;
+  const char *filename = job->ReadAheadFile();
+  const uint8_t *data;
+  size_t size;
+  // Files that can be viewed in place don't need reading.
+  if (!filename || ViewFile(filename, &data, &size)) return false;
+
+  job->read_ahead_name_ = filename;
+  job->read_deferred_ = true;
   {
-    std::unique_lock<std::mutex> lock(mutex_);
-    finished = num_pending_requests_ == 0;
+    // Move the job from `loading` to reading_ahead_ in one go, so AbortJob()
+    // always finds it.
+    std::lock_guard<std::mutex> lock(mutex_);
+    reading_ahead_.push_back(job);
+    reader->loading = nullptr;
+  }
+  // The callback may run on another thread before this returns, and the job
+  // may be finalized and deleted by then, so don't touch it once it started.
+  const double read_start = CurrentTime();
+  const bool started = read_ahead_(
+      job->read_ahead_name_.c_str(), &job->read_ahead_contents_,
+      [this, job, read_start](bool success) {
+        job->load_stats_.read_seconds = CurrentTime() - read_start;
+        if (success) {
+          job->read_ahead_ = MakeFileView(std::move(job->read_ahead_contents_));
+        }
+        job->read_ahead_contents_.clear();
+        QueueDecode(nullptr, job);
+      });
+  if (started) return true;
+
+  // Read() will report the error, if there is one.
+  job->read_ahead_name_.clear();
+  job->read_deferred_ = false;
+  std::lock_guard<std::mutex> lock(mutex_);
+  reading_ahead_.erase(
+      std::find(reading_ahead_.begin(), reading_ahead_.end(), job));
+  reader->loading = job;
+  return false;
+}
+
+// Hands a job that has been read to the decode threads.
+void AsyncLoader::QueueDecode(Worker *reader, AsyncAsset *job) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (job->load_cancelled_) {
+    PushCompleted(job);
+  } else {
+    Worker &worker = *workers_[next_worker_++ % workers_.size()];
+    std::lock_guard<std::mutex> worker_lock(worker.mutex);
+    job->load_queued_time_ = CurrentTime();
+    InsertSorted(&worker.jobs, job);
+    ++num_queued_jobs_;
+  }
+  --num_reading_;
+  if (reader) {
+    reader->loading = nullptr;
+  } else {
+    reading_ahead_.erase(
+        std::find(reading_ahead_.begin(), reading_ahead_.end(), job));
+    // There is room to read another job ahead. PauseLoading() and Stop() may
+    // return, and the loader be destroyed, as soon as the last read ahead is
+    // done, so finish notifying before unlocking.
+    read_cv_.notify_all();
+  }
+  const bool reads_finished =
+      stop_when_complete_ && queue_.empty() && num_reading_ == 0;
+  if (reader) lock.unlock();
+  // Once the last read is done, the idle decode threads have to wake up to
+  // see that they can stop.
+  if (reads_finished) {
+    job_cv_.notify_all();
+  } else {
+    job_cv_.notify_one();
   }
-  return finished;
 }
 
-void AsyncLoader::LoaderWorker() {
+void AsyncLoader::ReaderWorker(Worker *worker) {
+  const int max_read_ahead = kReadAheadPerWorker * num_worker_threads_;
   for (;;) {
+    AsyncAsset *job;
     {
       std::unique_lock<std::mutex> lock(mutex_);
-      job_cv_.wait(lock, [this]() { return queue_.size() > 0; });
-      loading_ = queue_.front();
+      // Jobs being read ahead count towards the limit too, since their
+      // files end up in memory just the same.
+      read_cv_.wait(lock, [this, max_read_ahead]() {
+        return pause_ || (stop_when_complete_ && queue_.empty()) ||
+               (!queue_.empty() &&
+                num_queued_jobs_ + static_cast<int>(reading_ahead_.size()) <
+                    max_read_ahead);
+      });
+      if (pause_ || queue_.empty()) break;
+      job = queue_.front();
       queue_.pop_front();
+      // Publish the job while holding mutex_, so AbortJob() always finds it.
+      worker->loading = job;
+      ++num_reading_;
     }
 
-    if (!loading_) {
-      break;
+    const double read_start = CurrentTime();
+    job->load_stats_.queue_seconds = read_start - job->load_queued_time_;
+    if (StartReadAhead(worker, job)) continue;
+    job->Read();
+    job->load_stats_.read_seconds = CurrentTime() - read_start;
+    QueueDecode(worker, job);
+  }
+}
+
+void AsyncLoader::LoaderWorker(Worker *worker) {
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      job_cv_.wait(lock, [this]() {
+        return num_queued_jobs_ > 0 || pause_ ||
+               (stop_when_complete_ && queue_.empty() && num_reading_ == 0);
+      });
+      if (pause_ || (stop_when_complete_ && num_queued_jobs_ == 0 &&
+                     queue_.empty() && num_reading_ == 0)) {
+        break;
+      }
+      if (OverDecodeBudget() && !stop_when_complete_) {
+        // Wait for TryFinalize() to release some decoded data. Nobody
+        // finalizes while Stop() waits for the workers, so ignore the limit
+        // then.
+        ++num_throttled_workers_;
+        job_cv_.wait(lock, [this]() {
+          return !OverDecodeBudget() || pause_ || stop_when_complete_;
+        });
+        --num_throttled_workers_;
+        continue;
+      }
     }
 
-    loading_->Load();
-    std::lock_guard<std::mutex> lock(mutex_);
-    done_.push_back(loading_);
-    loading_ = nullptr;
+    AsyncAsset *job = PopJob(worker);
+    if (!job) continue;
+
+    double decode_start = CurrentTime();
+    job->load_stats_.queue_seconds += decode_start - job->load_queued_time_;
+    if (job->read_deferred_) {
+      // Its file was read ahead, so Read() only has to pick it up.
+      job->read_deferred_ = false;
+      ReadJob(job);
+      const double read_end = CurrentTime();
+      job->load_stats_.read_seconds += read_end - decode_start;
+      decode_start = read_end;
+    }
+    job->Decode();
+    job->load_stats_.decode_seconds = CurrentTime() - decode_start;
+    job->upload_size_ = job->UploadSize();
+    job->load_stats_.bytes_uploaded = job->upload_size_;
+    decoded_bytes_ += job->upload_size_;
+    // Clear `loading` only after pushing, so AbortJob() always finds the job
+    // in one or the other.
+    PushCompleted(job);
+    worker->loading = nullptr;
   }
 }
 
 // static
 int AsyncLoader::LoaderThread(void *user_data) {
-  reinterpret_cast<AsyncLoader *>(user_data)->LoaderWorker();
+  Worker *worker = reinterpret_cast<Worker *>(user_data);
+  if (worker->reader) {
+    worker->loader->ReaderWorker(worker);
+  } else {
+    worker->loader->LoaderWorker(worker);
+  }
   return 0;
 }
 }  // namespace fplbase
@@ -0,0 +1,556 @@
+// Copyright 2017 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "fplbase/batch_file_reader.h"
+
+#if !defined(_WIN32) && !defined(__ANDROID__)
+#define FPLBASE_BATCH_READ_POSIX 1
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+// io_uring is driven with raw system calls, so there is no dependency on
+// liburing; only the kernel headers are needed to build it.
+#if defined(FPLBASE_BATCH_READ_POSIX) && defined(__linux__) && \
+    defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define FPLBASE_BATCH_READ_IO_URING 1
+#endif
+#endif  // __has_include(<linux/io_uring.h>)
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <vector>
+
+#include "fplbase/logging.h"
+
+namespace fplbase {
+
+struct BatchRead;
+
+// Interface to the ways of issuing reads. Destroying a backend waits for the
+// reads it was given to complete.
+class BatchFileReaderBackend {
+ public:
+  virtual ~BatchFileReaderBackend() {}
+  virtual BatchFileReader::Backend type() const = 0;
+#if defined(FPLBASE_BATCH_READ_POSIX)
+  virtual void Submit(BatchRead *read) = 0;
+#endif
+};
+
+#if defined(FPLBASE_BATCH_READ_POSIX)
+
+// Files are read in chunks of this size, so that one large file keeps several
+// reads in flight, and small files queued behind it don't wait for all of it.
+static const size_t kChunkSize = 256 * 1024;
+
+// One read of part of a file. `iov` covers what is left to read, and `offset`
+// is where that starts in the file.
+struct BatchChunk {
+  BatchRead *read;
+  off_t offset;
+  struct iovec iov;
+};
+
+// A file being read, which is done once all of its chunks are.
+struct BatchRead {
+  std::string filename;
+  int fd;
+  BatchReadCallback callback;
+  std::vector<BatchChunk> chunks;
+  std::atomic<size_t> pending_chunks;
+  std::atomic<bool> failed;
+};
+
+// Opens a file and splits it into chunks, or returns null if it can't be read.
+static BatchRead *OpenBatchRead(const char *filename, std::string *dest,
+                                const BatchReadCallback &callback) {
+  if (!FileMayExist(filename)) return nullptr;
+  const int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    LogError(kError, "LoadFile fail on %s", filename);
+    return nullptr;
+  }
+  struct stat sb;
+  if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode) || sb.st_size <= 0) {
+    // Like LoadFileRaw(), treat empty files as failures.
+    close(fd);
+    return nullptr;
+  }
+  const size_t size = static_cast<size_t>(sb.st_size);
+  dest->assign(size, 0);
+
+  BatchRead *read = new BatchRead();
+  read->filename = filename;
+  read->fd = fd;
+  read->callback = callback;
+  read->chunks.resize((size + kChunkSize - 1) / kChunkSize);
+  read->pending_chunks = read->chunks.size();
+  read->failed = false;
+  for (size_t i = 0; i < read->chunks.size(); ++i) {
+    BatchChunk &chunk = read->chunks[i];
+    const size_t offset = i * kChunkSize;
+    chunk.read = read;
+    chunk.offset = static_cast<off_t>(offset);
+    chunk.iov.iov_base = &(*dest)[offset];
+    chunk.iov.iov_len = std::min(kChunkSize, size - offset);
+  }
+  return read;
+}
+
+// Called once per chunk. The last chunk of a file closes it and reports the
+// result.
+static void FinishChunk(BatchChunk *chunk, bool success) {
+  BatchRead *read = chunk->read;
+  if (!success) read->failed = true;
+  if (read->pending_chunks.fetch_sub(1) != 1) return;
+  close(read->fd);
+  const bool failed = read->failed;
+  if (failed) LogError(kError, "LoadFile fail on %s", read->filename.c_str());
+  read->callback(!failed);
+  delete read;
+}
+
+// Issues reads from a pool of threads, each blocking on one `pread()` at a
+// time.
+class ThreadPoolBackend : public BatchFileReaderBackend {
+ public:
+  explicit ThreadPoolBackend(int num_threads) : stopping_(false) {
+    for (int i = 0; i < num_threads; ++i) {
+      threads_.push_back(std::thread(&ThreadPoolBackend::ReadChunks, this));
+    }
+  }
+
+  virtual ~ThreadPoolBackend() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    queued_.notify_all();
+    for (auto it = threads_.begin(); it != threads_.end(); ++it) it->join();
+  }
+
+  virtual BatchFileReader::Backend type() const {
+    return BatchFileReader::kBackendThreadPool;
+  }
+
+  virtual void Submit(BatchRead *read) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (auto it = read->chunks.begin(); it != read->chunks.end(); ++it) {
+        queue_.push_back(&*it);
+      }
+    }
+    queued_.notify_all();
+  }
+
+ private:
+  // Thread function. Runs until stopped and the queue is empty.
+  void ReadChunks() {
+    for (;;) {
+      BatchChunk *chunk;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        queued_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+        if (queue_.empty()) return;
+        chunk = queue_.front();
+        queue_.pop_front();
+      }
+      FinishChunk(chunk, ReadChunk(chunk));
+    }
+  }
+
+  static bool ReadChunk(BatchChunk *chunk) {
+    char *dest = static_cast<char *>(chunk->iov.iov_base);
+    size_t left = chunk->iov.iov_len;
+    off_t offset = chunk->offset;
+    while (left) {
+      const ssize_t n = pread(chunk->read->fd, dest, left, offset);
+      if (n < 0 && errno == EINTR) continue;
+      // The file shrank, or can't be read.
+      if (n <= 0) return false;
+      dest += n;
+      left -= static_cast<size_t>(n);
+      offset += n;
+    }
+    return true;
+  }
+
+  std::mutex mutex_;
+  std::condition_variable queued_;
+  std::deque<BatchChunk *> queue_;
+  std::vector<std::thread> threads_;
+  bool stopping_;
+};
+
+#endif  // defined(FPLBASE_BATCH_READ_POSIX)
+
+#if defined(FPLBASE_BATCH_READ_IO_URING)
+
+// Submits reads to an io_uring from any thread, and reaps them on a thread of
+// its own. The submission queue is shared by every thread that reads, so the
+// device sees all of their reads at once.
+class IoUringBackend : public BatchFileReaderBackend {
+ public:
+  // Returns null if the kernel doesn't support io_uring, or won't let us use
+  // it.
+  static IoUringBackend *Create(unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    const int ring_fd =
+        static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (ring_fd < 0) return nullptr;
+    IoUringBackend *backend = new IoUringBackend(ring_fd, params);
+    if (!backend->Map(params)) {
+      delete backend;
+      return nullptr;
+    }
+    backend->reaper_ = std::thread(&IoUringBackend::ReapCompletions, backend);
+    return backend;
+  }
+
+  virtual ~IoUringBackend() {
+    if (reaper_.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+      }
+      submitted_.notify_all();
+      reaper_.join();
+    }
+    if (sqes_) munmap(sqes_, sqes_size_);
+    if (cq_ring_ && cq_ring_ != sq_ring_) munmap(cq_ring_, cq_ring_size_);
+    if (sq_ring_) munmap(sq_ring_, sq_ring_size_);
+    close(ring_fd_);
+  }
+
+  virtual BatchFileReader::Backend type() const {
+    return BatchFileReader::kBackendIoUring;
+  }
+
+  virtual void Submit(BatchRead *read) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (auto it = read->chunks.begin(); it != read->chunks.end(); ++it) {
+        queue_.push_back(&*it);
+      }
+      SubmitQueued();
+    }
+    submitted_.notify_one();
+  }
+
+ private:
+  IoUringBackend(int ring_fd, const io_uring_params &params)
+      : ring_fd_(ring_fd),
+        sq_entries_(params.sq_entries),
+        sq_ring_(nullptr),
+        sq_ring_size_(0),
+        cq_ring_(nullptr),
+        cq_ring_size_(0),
+        sqes_(nullptr),
+        sqes_size_(0),
+        sq_tail_(0),
+        in_flight_(0),
+        stopping_(false) {}
+
+  static void *MapRing(int ring_fd, size_t size, off_t offset) {
+    void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring_fd, offset);
+    return p == MAP_FAILED ? nullptr : p;
+  }
+
+  bool Map(const io_uring_params &params) {
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = false;
+#if defined(IORING_FEAT_SINGLE_MMAP)
+    single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+#endif
+    if (single_mmap) {
+      sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+    sq_ring_ = MapRing(ring_fd_, sq_ring_size_, IORING_OFF_SQ_RING);
+    if (!sq_ring_) return false;
+    cq_ring_ = single_mmap
+                   ? sq_ring_
+                   : MapRing(ring_fd_, cq_ring_size_, IORING_OFF_CQ_RING);
+    if (!cq_ring_) return false;
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe *>(
+        MapRing(ring_fd_, sqes_size_, IORING_OFF_SQES));
+    if (!sqes_) return false;
+
+    uint8_t *sq = static_cast<uint8_t *>(sq_ring_);
+    sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sq_tail_ptr_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    sq_tail_ = *sq_tail_ptr_;
+    uint8_t *cq = static_cast<uint8_t *>(cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+    return true;
+  }
+
+  int Enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd_, to_submit,
+                                    min_complete, flags, nullptr, 0));
+  }
+
+  // The number of entries in the submission queue that the kernel hasn't
+  // taken yet. Call with mutex_ held.
+  unsigned NumUnsubmitted() const {
+    return sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  }
+
+  // Moves as many queued chunks into the submission queue as it has room
+  // for, and tells the kernel about them. Call with mutex_ held.
+  void SubmitQueued() {
+    // Never have more reads in flight than the completion queue can hold.
+    unsigned added = 0;
+    while (!queue_.empty() && in_flight_ < sq_entries_) {
+      BatchChunk *chunk = queue_.front();
+      queue_.pop_front();
+      const unsigned index = sq_tail_ & sq_mask_;
+      io_uring_sqe *sqe = &sqes_[index];
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = IORING_OP_READV;
+      sqe->fd = chunk->read->fd;
+      sqe->addr = reinterpret_cast<uint64_t>(&chunk->iov);
+      sqe->len = 1;
+      sqe->off = static_cast<uint64_t>(chunk->offset);
+      sqe->user_data = reinterpret_cast<uint64_t>(chunk);
+      sq_array_[index] = index;
+      ++sq_tail_;
+      ++in_flight_;
+      ++added;
+    }
+    if (!added) return;
+    __atomic_store_n(sq_tail_ptr_, sq_tail_, __ATOMIC_RELEASE);
+    // If this fails, the entries stay in the queue, and the reaper thread
+    // submits them the next time it waits.
+    Enter(NumUnsubmitted(), 0, 0);
+  }
+
+  // Thread function. Waits for reads to complete, resubmits the ones that
+  // came up short, and finishes the rest.
+  void ReapCompletions() {
+    std::vector<std::pair<BatchChunk *, bool>> finished;
+    for (;;) {
+      unsigned to_submit;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        submitted_.wait(lock,
+                        [this]() { return stopping_ || in_flight_ != 0; });
+        if (in_flight_ == 0) return;
+        to_submit = NumUnsubmitted();
+      }
+      const int result = Enter(to_submit, 1, IORING_ENTER_GETEVENTS);
+      if (result < 0 && errno != EINTR && errno != EAGAIN &&
+          errno != EBUSY) {
+        LogError(kError, "io_uring_enter failed: %s", strerror(errno));
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        unsigned head = __atomic_load_n(cq_head_, __ATOMIC_RELAXED);
+        const unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+          const io_uring_cqe &cqe = cqes_[head & cq_mask_];
+          BatchChunk *chunk = reinterpret_cast<BatchChunk *>(cqe.user_data);
+          --in_flight_;
+          if (cqe.res == -EAGAIN || cqe.res == -EINTR) {
+            queue_.push_front(chunk);
+          } else if (cqe.res <= 0) {
+            // Failed, or the file shrank.
+            finished.push_back(std::make_pair(chunk, false));
+          } else if (static_cast<size_t>(cqe.res) < chunk->iov.iov_len) {
+            // Short read: read the rest next.
+            chunk->offset += cqe.res;
+            chunk->iov.iov_base = static_cast<char *>(chunk->iov.iov_base) +
+                                  cqe.res;
+            chunk->iov.iov_len -= static_cast<size_t>(cqe.res);
+            queue_.push_front(chunk);
+          } else {
+            finished.push_back(std::make_pair(chunk, true));
+          }
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+        SubmitQueued();
+      }
+
+      // Callbacks may start new reads, so call them without the lock.
+      for (auto it = finished.begin(); it != finished.end(); ++it) {
+        FinishChunk(it->first, it->second);
+      }
+      finished.clear();
+    }
+  }
+
+  const int ring_fd_;
+  const unsigned sq_entries_;
+  void *sq_ring_;
+  size_t sq_ring_size_;
+  void *cq_ring_;
+  size_t cq_ring_size_;
+  io_uring_sqe *sqes_;
+  size_t sqes_size_;
+
+  // Pointers into the rings shared with the kernel.
+  unsigned *sq_head_;
+  unsigned *sq_tail_ptr_;
+  unsigned sq_mask_;
+  unsigned *sq_array_;
+  unsigned *cq_head_;
+  unsigned *cq_tail_;
+  unsigned cq_mask_;
+  io_uring_cqe *cqes_;
+
+  // Guards everything below, and the submission queue.
+  std::mutex mutex_;
+  std::condition_variable submitted_;
+  // Our copy of the submission queue tail.
+  unsigned sq_tail_;
+  // Reads in the submission or completion queue.
+  unsigned in_flight_;
+  // Chunks waiting for room in the submission queue.
+  std::deque<BatchChunk *> queue_;
+  bool stopping_;
+  std::thread reaper_;
+};
+
+#endif  // defined(FPLBASE_BATCH_READ_IO_URING)
+
+BatchFileReader::BatchFileReader() : num_submitting_(0), mounted_(false) {}
+
+BatchFileReader::~BatchFileReader() {
+  Unmount();
+  Stop();
+}
+
+bool BatchFileReader::Start(int queue_depth, bool allow_io_uring) {
+  Stop();
+  if (queue_depth < 1) queue_depth = kDefaultQueueDepth;
+  BatchFileReaderBackend *backend = nullptr;
+#if defined(FPLBASE_BATCH_READ_IO_URING)
+  if (allow_io_uring) {
+    backend = IoUringBackend::Create(static_cast<unsigned>(queue_depth));
+  }
+#else
+  (void)allow_io_uring;
+#endif
+#if defined(FPLBASE_BATCH_READ_POSIX)
+  if (!backend) backend = new ThreadPoolBackend(queue_depth);
+#endif
+  std::lock_guard<std::mutex> lock(mutex_);
+  backend_.reset(backend);
+  return backend != nullptr;
+}
+
+void BatchFileReader::Stop() {
+  std::unique_ptr<BatchFileReaderBackend> backend;
+  {
+    // New reads go to LoadFileRaw() from here on. Wait for the ones that are
+    // being handed to the backend.
+    std::unique_lock<std::mutex> lock(mutex_);
+    backend.swap(backend_);
+    submitted_.wait(lock, [this]() { return num_submitting_ == 0; });
+  }
+  // Waits for the reads in flight.
+  backend.reset();
+}
+
+BatchFileReader::Backend BatchFileReader::backend() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return backend_ ? backend_->type() : kBackendNone;
+}
+
+bool BatchFileReader::Read(const char *filename, std::string *dest,
+                           BatchReadCallback callback) {
+#if defined(FPLBASE_BATCH_READ_POSIX)
+  BatchFileReaderBackend *backend;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    backend = backend_.get();
+    if (backend) ++num_submitting_;
+  }
+  if (backend) {
+    // Open the file without the lock, since that may wait on the disk too.
+    BatchRead *read = OpenBatchRead(filename, dest, callback);
+    if (read) backend->Submit(read);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      --num_submitting_;
+    }
+    submitted_.notify_all();
+    return read != nullptr;
+  }
+#endif  // defined(FPLBASE_BATCH_READ_POSIX)
+  if (!LoadFileRaw(filename, dest)) return false;
+  callback(true);
+  return true;
+}
+
+bool BatchFileReader::LoadFile(const char *filename, std::string *dest) {
+  std::mutex mutex;
+  std::condition_variable done_condition;
+  bool done = false;
+  bool success = false;
+  const bool started = Read(filename, dest, [&](bool read_success) {
+    // Notify with the lock held, so the waiting thread can't return and
+    // destroy the condition variable first.
+    std::lock_guard<std::mutex> lock(mutex);
+    success = read_success;
+    done = true;
+    done_condition.notify_one();
+  });
+  if (!started) return false;
+  std::unique_lock<std::mutex> lock(mutex);
+  done_condition.wait(lock, [&]() { return done; });
+  return success;
+}
+
+void BatchFileReader::Mount() {
+  if (mounted_) return;
+  previous_load_file_ =
+      SetLoadFileFunction([this](const char *filename, std::string *dest) {
+        return LoadFile(filename, dest);
+      });
+  mounted_ = true;
+}
+
+void BatchFileReader::Unmount() {
+  if (!mounted_) return;
+  SetLoadFileFunction(previous_load_file_);
+  previous_load_file_ = nullptr;
+  mounted_ = false;
+}
+
+}  // namespace fplbase
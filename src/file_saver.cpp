@@ -0,0 +1,246 @@
+// Copyright 2017 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <stdio.h>
+#include <deque>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "fplbase/file_utilities.h"
+#include "fplbase/logging.h"
+
+namespace fplbase {
+
+#if defined(_WIN32)
+static bool WriteAndSync(const std::string &path, const char *data,
+                         size_t size) {
+  const int fd = _open(path.c_str(),
+                       _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY,
+                       _S_IREAD | _S_IWRITE);
+  if (fd == -1) return false;
+  bool ok = true;
+  while (ok && size) {
+    const size_t kMaxWrite = 1 << 30;
+    const unsigned int n =
+        static_cast<unsigned int>(size < kMaxWrite ? size : kMaxWrite);
+    const int written = _write(fd, data, n);
+    ok = written > 0;
+    if (ok) {
+      data += written;
+      size -= static_cast<size_t>(written);
+    }
+  }
+  ok = _commit(fd) == 0 && ok;
+  return _close(fd) == 0 && ok;
+}
+
+static bool RenameOverFile(const std::string &from, const char *to) {
+  return MoveFileExA(from.c_str(), to,
+                     MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+}
+#else
+static bool WriteAndSync(const std::string &path, const char *data,
+                         size_t size) {
+  const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                      0644);
+  if (fd == -1) return false;
+  bool ok = true;
+  while (ok && size) {
+    const ssize_t written = write(fd, data, size);
+    if (written < 0 && errno == EINTR) continue;
+    ok = written > 0;
+    if (ok) {
+      data += written;
+      size -= static_cast<size_t>(written);
+    }
+  }
+  ok = fsync(fd) == 0 && ok;
+  return close(fd) == 0 && ok;
+}
+
+static bool RenameOverFile(const std::string &from, const char *to) {
+  if (rename(from.c_str(), to) != 0) return false;
+  // Flush the directory too, so that the rename itself survives a crash.
+  std::string dir = to;
+  const size_t slash = dir.find_last_of('/');
+  if (slash == std::string::npos) {
+    dir = ".";
+  } else {
+    dir.erase(slash == 0 ? 1 : slash);
+  }
+  const int dir_fd = open(dir.c_str(), O_RDONLY | O_CLOEXEC);
+  if (dir_fd != -1) {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+  return true;
+}
+#endif  // defined(_WIN32)
+
+bool SaveFileAtomic(const char *filename, const void *data, size_t size) {
+  const std::string temp = std::string(filename) + ".tmp";
+  if (!WriteAndSync(temp, static_cast<const char *>(data), size) ||
+      !RenameOverFile(temp, filename)) {
+    LogError(kError, "SaveFile fail on %s", filename);
+    remove(temp.c_str());
+    return false;
+  }
+  AddToFileIndex(filename);
+  return true;
+}
+
+bool FileSave::done() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return done_;
+}
+
+bool FileSave::success() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return success_;
+}
+
+bool FileSave::Wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  finished_.wait(lock, [this]() { return done_; });
+  return success_;
+}
+
+void FileSave::Finish(bool success) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  success_ = success;
+  done_ = true;
+  finished_.notify_all();
+}
+
+// Writes the files passed to SaveFileAsync() on a thread of its own, which is
+// started by the first save.
+class FileSaver {
+ public:
+  FileSaver() : writing_(false), stopping_(false) {}
+
+  // Finishes the saves that are waiting, so none are lost at exit.
+  ~FileSaver() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    queued_.notify_all();
+    if (thread_.joinable()) thread_.join();
+  }
+
+  static FileSaver &Get() {
+    static FileSaver saver;
+    return saver;
+  }
+
+  FileSaveHandle Queue(const char *filename, std::string &&data) {
+    FileSaveHandle handle(new FileSave());
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!thread_.joinable()) {
+        thread_ = std::thread(&FileSaver::WriteFiles, this);
+      }
+      auto it = pending_.find(filename);
+      if (it == pending_.end()) {
+        it = pending_.insert(std::make_pair(std::string(filename),
+                                            PendingSave())).first;
+        order_.push_back(it->first);
+      }
+      // Replace any contents that haven't been written yet.
+      it->second.data.swap(data);
+      it->second.handles.push_back(handle);
+    }
+    queued_.notify_one();
+    return handle;
+  }
+
+  void Flush() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this]() { return order_.empty() && !writing_; });
+  }
+
+ private:
+  struct PendingSave {
+    std::string data;
+    std::vector<FileSaveHandle> handles;
+  };
+
+  // Thread function. Runs until stopped and there is nothing left to write.
+  void WriteFiles() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      queued_.wait(lock, [this]() { return stopping_ || !order_.empty(); });
+      if (order_.empty()) return;
+      const std::string filename = order_.front();
+      order_.pop_front();
+      auto it = pending_.find(filename);
+      PendingSave save;
+      std::swap(save, it->second);
+      pending_.erase(it);
+      writing_ = true;
+
+      lock.unlock();
+      const bool success =
+          SaveFileAtomic(filename.c_str(), save.data.c_str(), save.data.size());
+      for (auto h = save.handles.begin(); h != save.handles.end(); ++h) {
+        (*h)->Finish(success);
+      }
+      lock.lock();
+
+      writing_ = false;
+      if (order_.empty()) idle_.notify_all();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable queued_;
+  std::condition_variable idle_;
+  // The files waiting to be written, in the order they were first saved.
+  std::deque<std::string> order_;
+  std::unordered_map<std::string, PendingSave> pending_;
+  // Whether the thread is writing a file, with mutex_ released.
+  bool writing_;
+  bool stopping_;
+  std::thread thread_;
+};
+
+FileSaveHandle SaveFileAsync(const char *filename, std::string data) {
+  return FileSaver::Get().Queue(filename, std::move(data));
+}
+
+FileSaveHandle SaveFileAsync(const char *filename, const void *data,
+                             size_t size) {
+  return SaveFileAsync(filename,
+                       std::string(static_cast<const char *>(data), size));
+}
+
+void FlushFileSaves() { FileSaver::Get().Flush(); }
+
+}  // namespace fplbase
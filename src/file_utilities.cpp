@@ -14,8 +14,12 @@
 
 #ifdef _WIN32
 #include <direct.h>
+#include <io.h>
 #else
+#include <dirent.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #endif
 
@@ -29,6 +33,7 @@
 #include <assert.h>
 #include <algorithm>
 #include <mutex>
+#include "fplbase/asset_id.h"
 #include "fplbase/file_utilities.h"
 #include "fplbase/logging.h"
 
@@ -59,6 +64,115 @@ bool LoadFile(const char *filename, std::string *dest) {
   return load_file_function(filename, dest);
 }
 
+// Whether LoadFile() reads straight from the file system, so that files can
+// be mapped or measured there without bypassing a custom load function.
+static bool LoadsFromFileSystem() {
+  std::unique_lock<std::mutex> lock(g_load_file_function_mutex_);
+  auto target =
+      g_load_file_function.target<bool (*)(const char *, std::string *)>();
+  return target && *target == LoadFileRaw;
+}
+
+static ViewFileFunction g_view_file_function;
+
+ViewFileFunction SetViewFileFunction(ViewFileFunction view_file_function) {
+  std::unique_lock<std::mutex> lock(g_load_file_function_mutex_);
+  ViewFileFunction previous_function = g_view_file_function;
+  g_view_file_function = view_file_function;
+  return previous_function;
+}
+
+bool ViewFile(const char *filename, const uint8_t **data, size_t *size,
+              std::shared_ptr<const void> *owner) {
+  ViewFileFunction view_file_function;
+  {
+    std::unique_lock<std::mutex> lock(g_load_file_function_mutex_);
+    view_file_function = g_view_file_function;
+  }
+  return view_file_function &&
+         view_file_function(filename, data, size, owner);
+}
+
+#if !defined(_WIN32) && !defined(__ANDROID__)
+#define FPLBASE_MAP_FILE_VIEWS 1
+
+// Files smaller than this are read rather than mapped, since for them the
+// extra system calls and page faults cost more than the copy they save.
+static const size_t kMinMappedFileSize = 16 * 1024;
+
+// Maps all of `filename` into memory, or returns null if it is too small or
+// can't be mapped. The pages are read in now, rather than when first touched,
+// so that loader threads rather than the render thread wait on the disk.
+static const uint8_t *MapWholeFile(const char *filename, size_t *size) {
+  const int fd = open(filename, O_RDONLY);
+  if (fd == -1) return nullptr;
+  const uint8_t *mapped = nullptr;
+  struct stat sb;
+  if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) &&
+      static_cast<size_t>(sb.st_size) >= kMinMappedFileSize) {
+    const size_t len = static_cast<size_t>(sb.st_size);
+    int flags = MAP_PRIVATE;
+#if defined(MAP_POPULATE)
+    flags |= MAP_POPULATE;
+#endif
+    void *p = mmap(nullptr, len, PROT_READ, flags, fd, 0);
+    if (p != MAP_FAILED) {
+#if !defined(MAP_POPULATE)
+      madvise(p, len, MADV_WILLNEED);
+#endif
+      mapped = static_cast<const uint8_t *>(p);
+      *size = len;
+    }
+  }
+  close(fd);
+  return mapped;
+}
+#endif  // !defined(_WIN32) && !defined(__ANDROID__)
+
+FileBuffer::~FileBuffer() {
+#if defined(FPLBASE_MAP_FILE_VIEWS)
+  if (mapped_size_) munmap(const_cast<uint8_t *>(data_), mapped_size_);
+#endif
+}
+
+FileView LoadFileView(const char *filename) {
+  std::shared_ptr<FileBuffer> buffer(new FileBuffer());
+  if (ViewFile(filename, &buffer->data_, &buffer->size_, &buffer->owner_)) {
+    return buffer;
+  }
+
+#if defined(FPLBASE_MAP_FILE_VIEWS)
+  // Only map files that LoadFile() would have read from the file system, so
+  // that custom load functions still see every file.
+  if (LoadsFromFileSystem() && FileMayExist(filename)) {
+    buffer->data_ = MapWholeFile(filename, &buffer->size_);
+    if (buffer->data_) {
+      buffer->mapped_size_ = buffer->size_;
+      return buffer;
+    }
+  }
+#endif  // defined(FPLBASE_MAP_FILE_VIEWS)
+
+  if (!LoadFile(filename, &buffer->storage_)) return nullptr;
+  buffer->data_ = reinterpret_cast<const uint8_t *>(buffer->storage_.c_str());
+  buffer->size_ = buffer->storage_.length();
+  return buffer;
+}
+
+FileView MakeFileView(std::string &&contents) {
+  std::shared_ptr<FileBuffer> buffer(new FileBuffer());
+  buffer->storage_ = std::move(contents);
+  buffer->data_ = reinterpret_cast<const uint8_t *>(buffer->storage_.c_str());
+  buffer->size_ = buffer->storage_.length();
+  return buffer;
+}
+
+bool FileSize(const char *filename, size_t *size) {
+  const uint8_t *data;
+  if (ViewFile(filename, &data, size)) return true;
+  return LoadsFromFileSystem() && FileSizeRaw(filename, size);
+}
+
 bool SaveFile(const char *filename, const std::string &src) {
   return SaveFile(filename, static_cast<const void *>(src.c_str()),
                   src.length());  // don't include the '\0'
@@ -101,6 +215,200 @@ inline std::string ConCatPathFileName(const std::string &path,
   return filepath;
 }
 
+// The index consulted by the raw file functions, if any.
+static std::mutex g_file_index_mutex;
+static std::unique_ptr<FileIndex> g_file_index;
+
+// Subdirectories deeper than this aren't indexed, in case of symlink loops.
+static const int kMaxIndexDepth = 32;
+
+// Puts `path` in the form the index keeps names in: slashes rather than
+// backslashes, no empty or "." components, and on platforms whose file systems
+// ignore case, lower case. Returns false for paths the index can't resolve,
+// i.e. those with a ".." after a directory, since that directory may be a
+// symlink, or after the root.
+static bool NormalizePath(const char *path, std::string *normalized) {
+  normalized->clear();
+  const char *c = path;
+  // Whether a ".." may still come next.
+  bool leading = true;
+  if (*c == '/' || *c == '\\') {
+    normalized->push_back('/');
+    leading = false;
+  }
+  for (;;) {
+    while (*c == '/' || *c == '\\') ++c;
+    if (!*c) break;
+    const char *end = c;
+    while (*end && *end != '/' && *end != '\\') ++end;
+    const size_t length = static_cast<size_t>(end - c);
+    const bool parent = length == 2 && c[0] == '.' && c[1] == '.';
+    if (parent && !leading) return false;
+    if (!(length == 1 && c[0] == '.')) {
+      leading = leading && parent;
+      if (!normalized->empty() && string_back(*normalized) != '/') {
+        normalized->push_back('/');
+      }
+      normalized->append(c, length);
+    }
+    c = end;
+  }
+#if defined(_WIN32) || defined(__APPLE__)
+  std::transform(normalized->begin(), normalized->end(), normalized->begin(),
+                 [](char ch) {
+                   return ch >= 'A' && ch <= 'Z' ? ch - 'A' + 'a' : ch;
+                 });
+#endif
+  return true;
+}
+
+static bool IsAbsolutePath(const std::string &normalized) {
+  return (!normalized.empty() && normalized[0] == '/') ||
+         (normalized.length() >= 2 && normalized[1] == ':');
+}
+
+uint64_t FileIndex::HashFileName(const std::string &normalized) {
+  // The same hash as AssetIdFromName().
+  uint64_t hash = internal::kAssetIdOffsetBasis;
+  for (auto it = normalized.begin(); it != normalized.end(); ++it) {
+    hash = (hash ^ static_cast<uint8_t>(*it)) * internal::kAssetIdPrime;
+  }
+  return hash;
+}
+
+bool FileIndex::Covers(const std::string &normalized) const {
+  for (auto it = roots_.begin(); it != roots_.end(); ++it) {
+    if (it->empty()) {
+      // The working directory has every relative path that doesn't go up.
+      if (!IsAbsolutePath(normalized) && normalized != ".." &&
+          normalized.compare(0, 3, "../") != 0) {
+        return true;
+      }
+    } else if (normalized.compare(0, it->length(), *it) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void FileIndex::AddFile(const char *filename) {
+  std::string normalized;
+  if (NormalizePath(filename, &normalized)) {
+    hashes_.insert(HashFileName(normalized));
+  }
+}
+
+void FileIndex::AddRoot(const char *dir) {
+  std::string root;
+  if (!NormalizePath(dir, &root)) return;
+  if (!root.empty() && string_back(root) != '/') root += '/';
+  if (std::find(roots_.begin(), roots_.end(), root) == roots_.end()) {
+    roots_.push_back(root);
+  }
+}
+
+bool FileIndex::Contains(const char *filename) const {
+  std::string normalized;
+  return NormalizePath(filename, &normalized) &&
+         hashes_.count(HashFileName(normalized)) != 0;
+}
+
+bool FileIndex::MayExist(const char *filename) const {
+  std::string normalized;
+  return !NormalizePath(filename, &normalized) || !Covers(normalized) ||
+         hashes_.count(HashFileName(normalized)) != 0;
+}
+
+#if defined(_WIN32)
+static bool IndexDirectory(const std::string &dir, const std::string &prefix,
+                           int depth, FileIndex *index) {
+  _finddata_t entry;
+  const intptr_t find = _findfirst((dir + "/*").c_str(), &entry);
+  if (find == -1) return false;
+  do {
+    const std::string name = entry.name;
+    if (name == "." || name == "..") continue;
+    if (entry.attrib & _A_SUBDIR) {
+      if (depth < kMaxIndexDepth) {
+        IndexDirectory(dir + "/" + name, prefix + name + "/", depth + 1,
+                       index);
+      }
+    } else {
+      index->AddFile((prefix + name).c_str());
+    }
+  } while (_findnext(find, &entry) == 0);
+  _findclose(find);
+  return true;
+}
+#elif !defined(__ANDROID__)
+static bool IndexDirectory(const std::string &dir, const std::string &prefix,
+                           int depth, FileIndex *index) {
+  DIR *d = opendir(dir.c_str());
+  if (!d) return false;
+  while (const struct dirent *entry = readdir(d)) {
+    const std::string name = entry->d_name;
+    if (name == "." || name == "..") continue;
+    const std::string path = dir + "/" + name;
+    bool is_dir = false;
+#if defined(DT_DIR)
+    if (entry->d_type != DT_UNKNOWN && entry->d_type != DT_LNK) {
+      is_dir = entry->d_type == DT_DIR;
+    } else
+#endif
+    {
+      struct stat sb;
+      is_dir = stat(path.c_str(), &sb) == 0 && S_ISDIR(sb.st_mode);
+    }
+    if (is_dir) {
+      if (depth < kMaxIndexDepth) {
+        IndexDirectory(path, prefix + name + "/", depth + 1, index);
+      }
+    } else {
+      index->AddFile((prefix + name).c_str());
+    }
+  }
+  closedir(d);
+  return true;
+}
+#endif  // !defined(__ANDROID__)
+
+bool FileIndex::AddDirectory(const char *root) {
+#if defined(__ANDROID__)
+  (void)root;
+  LogError(kError, "FileIndex::AddDirectory is unimplemented on Android.");
+  return false;
+#else
+  std::string dir = PosixPath(root);
+  if (dir.empty()) dir = ".";
+  while (dir.length() > 1 && string_back(dir) == '/') {
+    dir.erase(dir.length() - 1);
+  }
+  const std::string prefix =
+      dir == "." ? "" : string_back(dir) == '/' ? dir : dir + "/";
+  if (!IndexDirectory(dir, prefix, 0, this)) {
+    LogError(kError, "Can't index directory %s", root);
+    return false;
+  }
+  AddRoot(dir.c_str());
+  return true;
+#endif
+}
+
+void SetFileIndex(std::unique_ptr<FileIndex> index) {
+  std::lock_guard<std::mutex> lock(g_file_index_mutex);
+  g_file_index = std::move(index);
+}
+
+bool FileMayExist(const char *filename) {
+  std::lock_guard<std::mutex> lock(g_file_index_mutex);
+  return !g_file_index || g_file_index->MayExist(filename);
+}
+
+void AddToFileIndex(const char *filename) {
+  std::lock_guard<std::mutex> lock(g_file_index_mutex);
+  if (g_file_index) g_file_index->AddFile(filename);
+}
+
 // Search up the directory tree from binary_dir for target_dir, changing the
 // working directory to the target_dir and returning true if it's found,
 // false otherwise.
@@ -19,6 +19,7 @@
 namespace fplbase {
 
 bool FileExistsRaw(const char *filename) {
+  if (!FileMayExist(filename)) return false;
   auto handle = SDL_RWFromFile(filename, "rb");
   if (!handle) {
     return false;
@@ -28,6 +29,7 @@ bool FileExistsRaw(const char *filename) {
 }
 
 bool LoadFileRaw(const char *filename, std::string *dest) {
+  if (!FileMayExist(filename)) return false;
   auto handle = SDL_RWFromFile(filename, "rb");
   if (!handle) {
     LogError(kError, "LoadFile fail on %s", filename);
@@ -41,6 +43,19 @@ bool LoadFileRaw(const char *filename, std::string *dest) {
   return len == rlen && len > 0;
 }
 
+bool FileSizeRaw(const char *filename, size_t *size) {
+  if (!FileMayExist(filename)) return false;
+  auto handle = SDL_RWFromFile(filename, "rb");
+  if (!handle) {
+    return false;
+  }
+  auto len = SDL_RWsize(handle);
+  SDL_RWclose(handle);
+  if (len < 0) return false;
+  *size = static_cast<size_t>(len);
+  return true;
+}
+
 bool SaveFile(const char *filename, const void *data, size_t size) {
   auto handle = SDL_RWFromFile(filename, "wb");
   if (!handle) {
@@ -49,6 +64,7 @@ bool SaveFile(const char *filename, const void *data, size_t size) {
   }
   size_t wlen = static_cast<size_t>(SDL_RWwrite(handle, data, 1, size));
   SDL_RWclose(handle);
+  AddToFileIndex(filename);
   return (wlen == size);
 }
 
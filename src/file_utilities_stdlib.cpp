@@ -18,6 +18,7 @@
 namespace fplbase {
 
 bool FileExistsRaw(const char *filename) {
+  if (!FileMayExist(filename)) return false;
 #if defined(__ANDROID__)
   if (!GetAAssetManager()) {
     LogError(kError,
@@ -42,6 +43,7 @@ bool FileExistsRaw(const char *filename) {
 }
 
 bool LoadFileRaw(const char *filename, std::string *dest) {
+  if (!FileMayExist(filename)) return false;
 #if defined(__ANDROID__)
   if (!GetAAssetManager()) {
     LogError(kError,
@@ -78,6 +80,34 @@ bool LoadFileRaw(const char *filename, std::string *dest) {
 #endif
 }
 
+bool FileSizeRaw(const char *filename, size_t *size) {
+  if (!FileMayExist(filename)) return false;
+#if defined(__ANDROID__)
+  if (!GetAAssetManager()) {
+    LogError(kError,
+             "Need to call SetAssetManager() once before calling FileSize()");
+    assert(false);
+  }
+  AAsset *asset =
+      AAssetManager_open(GetAAssetManager(), filename, AASSET_MODE_UNKNOWN);
+  if (!asset) {
+    return false;
+  }
+  *size = static_cast<size_t>(AAsset_getLength(asset));
+  AAsset_close(asset);
+  return true;
+#else
+  FILE *fd = fopen(filename, "rb");
+  if (fd == NULL) {
+    return false;
+  }
+  const bool ok = fseek(fd, 0, SEEK_END) == 0;
+  if (ok) *size = ftell(fd);
+  fclose(fd);
+  return ok;
+#endif
+}
+
 bool SaveFile(const char *filename, const void *data, size_t size) {
 #if defined(__ANDROID__)
   (void)filename;
@@ -93,6 +123,7 @@ bool SaveFile(const char *filename, const void *data, size_t size) {
   }
   size_t wlen = fwrite(data, 1, size, fd);
   fclose(fd);
+  AddToFileIndex(filename);
   return size == wlen && size > 0;
 #endif
 }
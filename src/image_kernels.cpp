@@ -0,0 +1,477 @@
+// Copyright 2017 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "fplbase/internal/image_kernels.h"
+
+#include <memory>
+
+// clang-format off
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FPLBASE_IMAGE_KERNELS_SSE2 1
+#include <emmintrin.h>
+#if defined(__GNUC__) || defined(__clang__) || defined(_MSC_VER)
+// SSSE3 and AVX2 are compiled a function at a time, and only used if the CPU
+// has them.
+#define FPLBASE_IMAGE_KERNELS_SSSE3 1
+#define FPLBASE_IMAGE_KERNELS_AVX2 1
+#include <immintrin.h>
+#include <tmmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define FPLBASE_TARGET_SSSE3
+#define FPLBASE_TARGET_AVX2
+#else
+#define FPLBASE_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define FPLBASE_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define FPLBASE_IMAGE_KERNELS_NEON 1
+#include <arm_neon.h>
+#endif
+// clang-format on
+
+namespace fplbase {
+
+typedef void (*MultiplyRgbByAlphaFunction)(uint8_t *rgba, size_t num_pixels);
+
+void MultiplyRgbByAlphaReference(uint8_t *rgba, size_t num_pixels) {
+  for (size_t i = 0; i < num_pixels; ++i, rgba += 4) {
+    const uint8_t alpha = rgba[3];
+    rgba[0] = PremultiplyChannel(rgba[0], alpha);
+    rgba[1] = PremultiplyChannel(rgba[1], alpha);
+    rgba[2] = PremultiplyChannel(rgba[2], alpha);
+  }
+}
+
+typedef void (*ConvertTo16BitFunction)(const uint8_t *src, int width,
+                                       int height, bool dither,
+                                       uint16_t *dest);
+
+static inline int DitherChannel(int c, int x, int y, int bits, bool dither) {
+  if (!dither) return c;
+  c += DitherOffset(x, y, bits);
+  return c < 255 ? c : 255;
+}
+
+// Converts pixels `x` to `width` - 1 of row `y`, starting at `src` and
+// `dest`.
+static void ConvertRowTo5551(const uint8_t *src, int x, int width, int y,
+                             bool dither, uint16_t *dest) {
+  for (; x < width; ++x, src += 4, ++dest) {
+    const int r = DitherChannel(src[0], x, y, 5, dither);
+    const int g = DitherChannel(src[1], x, y, 5, dither);
+    const int b = DitherChannel(src[2], x, y, 5, dither);
+    const int a = src[3];
+    *dest = static_cast<uint16_t>(((r >> 3) << 11) | ((g >> 3) << 6) |
+                                  ((b >> 3) << 1) | (a >> 7));
+  }
+}
+
+static void ConvertRowTo565(const uint8_t *src, int x, int width, int y,
+                            bool dither, uint16_t *dest) {
+  for (; x < width; ++x, src += 3, ++dest) {
+    const int r = DitherChannel(src[0], x, y, 5, dither);
+    const int g = DitherChannel(src[1], x, y, 6, dither);
+    const int b = DitherChannel(src[2], x, y, 5, dither);
+    *dest = static_cast<uint16_t>(((r >> 3) << 11) | ((g >> 2) << 5) |
+                                  (b >> 3));
+  }
+}
+
+void ConvertRgba8888ToRgba5551Reference(const uint8_t *src, int width,
+                                        int height, bool dither,
+                                        uint16_t *dest) {
+  for (int y = 0; y < height; ++y, src += width * 4, dest += width) {
+    ConvertRowTo5551(src, 0, width, y, dither, dest);
+  }
+}
+
+void ConvertRgb888ToRgb565Reference(const uint8_t *src, int width, int height,
+                                    bool dither, uint16_t *dest) {
+  for (int y = 0; y < height; ++y, src += width * 3, dest += width) {
+    ConvertRowTo565(src, 0, width, y, dither, dest);
+  }
+}
+
+// The dither offsets of pixels 0 to 3 of row `y`, laid out like four 32-bit
+// pixels, with `bits` giving the precision of the first three channels.
+static void DitherPattern(int y, bool dither, const int bits[3],
+                          uint8_t pattern[16]) {
+  for (int x = 0; x < 4; ++x) {
+    for (int c = 0; c < 3; ++c) {
+      pattern[x * 4 + c] = dither ? DitherOffset(x, y, bits[c]) : 0;
+    }
+    pattern[x * 4 + 3] = 0;
+  }
+}
+
+#if defined(FPLBASE_IMAGE_KERNELS_SSE2)
+
+// Premultiplies two RGBA pixels, widened to 16 bits per channel. The alpha
+// channel is multiplied by 255, which leaves it unchanged.
+static inline __m128i PremultiplyWide(__m128i pixels, __m128i alpha_mask,
+                                      __m128i alpha_255) {
+  __m128i alpha = _mm_shufflelo_epi16(pixels, _MM_SHUFFLE(3, 3, 3, 3));
+  alpha = _mm_shufflehi_epi16(alpha, _MM_SHUFFLE(3, 3, 3, 3));
+  alpha = _mm_or_si128(_mm_andnot_si128(alpha_mask, alpha), alpha_255);
+  // c * a + 128 fits in 16 bits, and (t * 257) >> 16 is its high half.
+  const __m128i t = _mm_add_epi16(_mm_mullo_epi16(pixels, alpha),
+                                  _mm_set1_epi16(128));
+  return _mm_mulhi_epu16(t, _mm_set1_epi16(257));
+}
+
+static void MultiplyRgbByAlphaSSE2(uint8_t *rgba, size_t num_pixels) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i alpha_mask = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+  const __m128i alpha_255 = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+  size_t i = 0;
+  for (; i + 4 <= num_pixels; i += 4, rgba += 16) {
+    __m128i *p = reinterpret_cast<__m128i *>(rgba);
+    const __m128i pixels = _mm_loadu_si128(p);
+    const __m128i lo = PremultiplyWide(_mm_unpacklo_epi8(pixels, zero),
+                                       alpha_mask, alpha_255);
+    const __m128i hi = PremultiplyWide(_mm_unpackhi_epi8(pixels, zero),
+                                       alpha_mask, alpha_255);
+    _mm_storeu_si128(p, _mm_packus_epi16(lo, hi));
+  }
+  MultiplyRgbByAlphaReference(rgba, num_pixels - i);
+}
+
+// Narrows 32-bit lanes that hold 16-bit values, so that packing them with
+// signed saturation keeps all 16 bits.
+static inline __m128i SignExtendLow16(__m128i v) {
+  return _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+}
+
+// Packs four RGBA pixels, each in a 32-bit lane, into 5551 in the low half of
+// the lane.
+static inline __m128i Pack5551(__m128i p) {
+  const __m128i r = _mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xF8)), 8);
+  const __m128i g =
+      _mm_srli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xF800)), 5);
+  const __m128i b =
+      _mm_srli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xF80000)), 18);
+  const __m128i a = _mm_srli_epi32(p, 31);
+  return SignExtendLow16(_mm_or_si128(_mm_or_si128(r, g), _mm_or_si128(b, a)));
+}
+
+static void ConvertRgba8888ToRgba5551SSE2(const uint8_t *src, int width,
+                                          int height, bool dither,
+                                          uint16_t *dest) {
+  static const int kBits[3] = {5, 5, 5};
+  for (int y = 0; y < height; ++y) {
+    uint8_t pattern[16];
+    DitherPattern(y, dither, kBits, pattern);
+    const __m128i offsets =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(pattern));
+    int x = 0;
+    // Both halves are loaded before anything is stored, so this also works
+    // in place.
+    for (; x + 8 <= width; x += 8, src += 32, dest += 8) {
+      const __m128i p0 = _mm_adds_epu8(
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(src)), offsets);
+      const __m128i p1 = _mm_adds_epu8(
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16)),
+          offsets);
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dest),
+                       _mm_packs_epi32(Pack5551(p0), Pack5551(p1)));
+    }
+    ConvertRowTo5551(src, x, width, y, dither, dest);
+    src += (width - x) * 4;
+    dest += width - x;
+  }
+}
+
+#endif  // defined(FPLBASE_IMAGE_KERNELS_SSE2)
+
+#if defined(FPLBASE_IMAGE_KERNELS_SSSE3)
+
+// Packs four RGB pixels, each in a 32-bit lane, into 565.
+static inline __m128i Pack565(__m128i p) {
+  const __m128i r = _mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xF8)), 8);
+  const __m128i g =
+      _mm_srli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xFC00)), 5);
+  const __m128i b =
+      _mm_srli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xF80000)), 19);
+  return SignExtendLow16(_mm_or_si128(_mm_or_si128(r, g), b));
+}
+
+FPLBASE_TARGET_SSSE3
+static void ConvertRgb888ToRgb565SSSE3(const uint8_t *src, int width,
+                                       int height, bool dither,
+                                       uint16_t *dest) {
+  static const int kBits[3] = {5, 6, 5};
+  // Spreads four 3-byte pixels out to 32 bits each.
+  const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1,
+                                       9, 10, 11, -1);
+  // Each load reads 4 bytes past the pixels it converts, so the last few
+  // pixels of the image are left to the scalar code.
+  const uint8_t *end = src + static_cast<size_t>(width) * height * 3;
+  for (int y = 0; y < height; ++y) {
+    uint8_t pattern[16];
+    DitherPattern(y, dither, kBits, pattern);
+    const __m128i offsets =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(pattern));
+    int x = 0;
+    for (; x + 8 <= width && end - src >= 28; x += 8, src += 24, dest += 8) {
+      const __m128i p0 = _mm_adds_epu8(
+          _mm_shuffle_epi8(
+              _mm_loadu_si128(reinterpret_cast<const __m128i *>(src)), spread),
+          offsets);
+      const __m128i p1 = _mm_adds_epu8(
+          _mm_shuffle_epi8(
+              _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 12)),
+              spread),
+          offsets);
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dest),
+                       _mm_packs_epi32(Pack565(p0), Pack565(p1)));
+    }
+    ConvertRowTo565(src, x, width, y, dither, dest);
+    src += (width - x) * 3;
+    dest += width - x;
+  }
+}
+
+static bool CpuHasSSSE3() {
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  return (info[2] & (1 << 9)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("ssse3") != 0;
+#endif
+}
+
+#endif  // defined(FPLBASE_IMAGE_KERNELS_SSSE3)
+
+#if defined(FPLBASE_IMAGE_KERNELS_AVX2)
+
+// The same as PremultiplyWide(), for four pixels.
+FPLBASE_TARGET_AVX2
+static inline __m256i PremultiplyWideAVX2(__m256i pixels, __m256i alpha_mask,
+                                          __m256i alpha_255) {
+  __m256i alpha = _mm256_shufflelo_epi16(pixels, _MM_SHUFFLE(3, 3, 3, 3));
+  alpha = _mm256_shufflehi_epi16(alpha, _MM_SHUFFLE(3, 3, 3, 3));
+  alpha = _mm256_or_si256(_mm256_andnot_si256(alpha_mask, alpha), alpha_255);
+  const __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(pixels, alpha),
+                                     _mm256_set1_epi16(128));
+  return _mm256_mulhi_epu16(t, _mm256_set1_epi16(257));
+}
+
+FPLBASE_TARGET_AVX2
+static void MultiplyRgbByAlphaAVX2(uint8_t *rgba, size_t num_pixels) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i alpha_mask =
+      _mm256_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0);
+  const __m256i alpha_255 = _mm256_set_epi16(255, 0, 0, 0, 255, 0, 0, 0, 255,
+                                             0, 0, 0, 255, 0, 0, 0);
+  size_t i = 0;
+  for (; i + 8 <= num_pixels; i += 8, rgba += 32) {
+    __m256i *p = reinterpret_cast<__m256i *>(rgba);
+    const __m256i pixels = _mm256_loadu_si256(p);
+    // Unpacking and packing both work within 128-bit lanes, so the pixels
+    // end up back where they started.
+    const __m256i lo = PremultiplyWideAVX2(_mm256_unpacklo_epi8(pixels, zero),
+                                           alpha_mask, alpha_255);
+    const __m256i hi = PremultiplyWideAVX2(_mm256_unpackhi_epi8(pixels, zero),
+                                           alpha_mask, alpha_255);
+    _mm256_storeu_si256(p, _mm256_packus_epi16(lo, hi));
+  }
+  MultiplyRgbByAlphaSSE2(rgba, num_pixels - i);
+}
+
+static bool CpuHasAVX2() {
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) return false;
+  // The OS must save the YMM registers, as well as the CPU having AVX2.
+  __cpuid(info, 1);
+  const bool osxsave = (info[2] & (1 << 27)) != 0;
+  if (!osxsave || (_xgetbv(0) & 6) != 6) return false;
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+#endif  // defined(FPLBASE_IMAGE_KERNELS_AVX2)
+
+#if defined(FPLBASE_IMAGE_KERNELS_NEON)
+
+// Premultiplies one channel of eight pixels.
+static inline uint8x8_t PremultiplyNEON(uint8x8_t c, uint8x8_t a) {
+  const uint16x8_t t = vaddq_u16(vmull_u8(c, a), vdupq_n_u16(128));
+  // (t + (t >> 8)) >> 8 is the same as (t * 257) >> 16.
+  return vshrn_n_u16(vsraq_n_u16(t, t, 8), 8);
+}
+
+static void MultiplyRgbByAlphaNEON(uint8_t *rgba, size_t num_pixels) {
+  size_t i = 0;
+  for (; i + 8 <= num_pixels; i += 8, rgba += 32) {
+    uint8x8x4_t pixels = vld4_u8(rgba);
+    pixels.val[0] = PremultiplyNEON(pixels.val[0], pixels.val[3]);
+    pixels.val[1] = PremultiplyNEON(pixels.val[1], pixels.val[3]);
+    pixels.val[2] = PremultiplyNEON(pixels.val[2], pixels.val[3]);
+    vst4_u8(rgba, pixels);
+  }
+  MultiplyRgbByAlphaReference(rgba, num_pixels - i);
+}
+
+// The dither offsets of pixels 0 to 7 of row `y`, for a `bits`-bit channel.
+static inline uint8x8_t DitherVector(int y, int bits, bool dither) {
+  uint8_t offsets[8];
+  for (int x = 0; x < 8; ++x) {
+    offsets[x] = dither ? DitherOffset(x, y, bits) : 0;
+  }
+  return vld1_u8(offsets);
+}
+
+// Widens `c` & `mask`, and shifts it left by `shift`.
+#define FPLBASE_WIDEN_CHANNEL(c, mask, shift) \
+  vshlq_n_u16(vmovl_u8(vand_u8((c), vdup_n_u8(mask))), shift)
+
+static void ConvertRgba8888ToRgba5551NEON(const uint8_t *src, int width,
+                                          int height, bool dither,
+                                          uint16_t *dest) {
+  for (int y = 0; y < height; ++y) {
+    const uint8x8_t offsets = DitherVector(y, 5, dither);
+    int x = 0;
+    for (; x + 8 <= width; x += 8, src += 32, dest += 8) {
+      const uint8x8x4_t p = vld4_u8(src);
+      uint16x8_t v =
+          FPLBASE_WIDEN_CHANNEL(vqadd_u8(p.val[0], offsets), 0xF8, 8);
+      v = vorrq_u16(
+          v, FPLBASE_WIDEN_CHANNEL(vqadd_u8(p.val[1], offsets), 0xF8, 3));
+      v = vorrq_u16(v, vshrq_n_u16(FPLBASE_WIDEN_CHANNEL(
+                                       vqadd_u8(p.val[2], offsets), 0xF8, 0),
+                                   2));
+      v = vorrq_u16(v, vmovl_u8(vshr_n_u8(p.val[3], 7)));
+      vst1q_u16(dest, v);
+    }
+    ConvertRowTo5551(src, x, width, y, dither, dest);
+    src += (width - x) * 4;
+    dest += width - x;
+  }
+}
+
+static void ConvertRgb888ToRgb565NEON(const uint8_t *src, int width,
+                                      int height, bool dither,
+                                      uint16_t *dest) {
+  for (int y = 0; y < height; ++y) {
+    const uint8x8_t offsets5 = DitherVector(y, 5, dither);
+    const uint8x8_t offsets6 = DitherVector(y, 6, dither);
+    int x = 0;
+    for (; x + 8 <= width; x += 8, src += 24, dest += 8) {
+      const uint8x8x3_t p = vld3_u8(src);
+      uint16x8_t v =
+          FPLBASE_WIDEN_CHANNEL(vqadd_u8(p.val[0], offsets5), 0xF8, 8);
+      v = vorrq_u16(
+          v, FPLBASE_WIDEN_CHANNEL(vqadd_u8(p.val[1], offsets6), 0xFC, 3));
+      v = vorrq_u16(v, vmovl_u8(vshr_n_u8(vqadd_u8(p.val[2], offsets5), 3)));
+      vst1q_u16(dest, v);
+    }
+    ConvertRowTo565(src, x, width, y, dither, dest);
+    src += (width - x) * 3;
+    dest += width - x;
+  }
+}
+
+#undef FPLBASE_WIDEN_CHANNEL
+
+#endif  // defined(FPLBASE_IMAGE_KERNELS_NEON)
+
+namespace {
+
+// The kernels picked for this CPU.
+struct ImageKernels {
+  ImageKernels()
+      : instruction_set("scalar"),
+        multiply_rgb_by_alpha(MultiplyRgbByAlphaReference),
+        convert_8888_to_5551(ConvertRgba8888ToRgba5551Reference),
+        convert_888_to_565(ConvertRgb888ToRgb565Reference) {
+#if defined(FPLBASE_IMAGE_KERNELS_SSE2)
+    instruction_set = "sse2";
+    multiply_rgb_by_alpha = MultiplyRgbByAlphaSSE2;
+    convert_8888_to_5551 = ConvertRgba8888ToRgba5551SSE2;
+#endif
+#if defined(FPLBASE_IMAGE_KERNELS_SSSE3)
+    if (CpuHasSSSE3()) {
+      instruction_set = "ssse3";
+      convert_888_to_565 = ConvertRgb888ToRgb565SSSE3;
+    }
+#endif
+#if defined(FPLBASE_IMAGE_KERNELS_AVX2)
+    if (CpuHasAVX2()) {
+      instruction_set = "avx2";
+      multiply_rgb_by_alpha = MultiplyRgbByAlphaAVX2;
+    }
+#endif
+#if defined(FPLBASE_IMAGE_KERNELS_NEON)
+    instruction_set = "neon";
+    multiply_rgb_by_alpha = MultiplyRgbByAlphaNEON;
+    convert_8888_to_5551 = ConvertRgba8888ToRgba5551NEON;
+    convert_888_to_565 = ConvertRgb888ToRgb565NEON;
+#endif
+  }
+
+  const char *instruction_set;
+  MultiplyRgbByAlphaFunction multiply_rgb_by_alpha;
+  ConvertTo16BitFunction convert_8888_to_5551;
+  ConvertTo16BitFunction convert_888_to_565;
+};
+
+const ImageKernels &GetImageKernels() {
+  static const ImageKernels kernels;
+  return kernels;
+}
+
+}  // namespace
+
+void MultiplyRgbByAlpha(uint8_t *rgba, size_t num_pixels) {
+  GetImageKernels().multiply_rgb_by_alpha(rgba, num_pixels);
+}
+
+void ConvertRgba8888ToRgba5551(const uint8_t *src, int width, int height,
+                               bool dither, uint16_t *dest) {
+  GetImageKernels().convert_8888_to_5551(src, width, height, dither, dest);
+}
+
+void ConvertRgb888ToRgb565(const uint8_t *src, int width, int height,
+                           bool dither, uint16_t *dest) {
+  GetImageKernels().convert_888_to_565(src, width, height, dither, dest);
+}
+
+void *ThreadScratchBuffer(size_t size) {
+  static thread_local std::unique_ptr<uint8_t[]> buffer;
+  static thread_local size_t capacity = 0;
+  if (size > capacity) {
+    // Nothing in the buffer needs keeping, so don't copy it.
+    buffer.reset();
+    buffer.reset(new uint8_t[size]);
+    capacity = size;
+  }
+  return buffer.get();
+}
+
+const char *ImageKernelsInstructionSet() {
+  return GetImageKernels().instruction_set;
+}
+
+}  // namespace fplbase
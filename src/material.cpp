@@ -60,60 +60,113 @@ void Material::DeleteTextures() {
   for (size_t i = 0; i < textures_.size(); i++) textures_[i]->Delete();
 }
 
+void Material::ForEachTexture(
+    const matdef::Material *matdef,
+    const std::function<void(const char *filename, TextureFormat format,
+                             TextureFlags flags)> &func) {
+  for (size_t i = 0; i < matdef->texture_filenames()->size(); i++) {
+    flatbuffers::uoffset_t index = static_cast<flatbuffers::uoffset_t>(i);
+    auto format =
+        matdef->desired_format() && i < matdef->desired_format()->size()
+            ? static_cast<TextureFormat>(matdef->desired_format()->Get(index))
+            : kFormatAuto;
+    func(matdef->texture_filenames()->Get(index)->c_str(), format,
+         (matdef->mipmaps() ? kTextureFlagsUseMipMaps : kTextureFlagsNone) |
+             (matdef->is_cubemap() && matdef->is_cubemap()->Get(index)
+                  ? kTextureFlagsIsCubeMap
+                  : kTextureFlagsNone) |
+             (matdef->wrapmode() == matdef::TextureWrap_CLAMP
+                  ? kTextureFlagsClampToEdge
+                  : kTextureFlagsNone));
+  }
+}
+
+bool Material::InitFromMaterialDef(const matdef::Material *matdef,
+                                   const TextureLoaderFn &tlf) {
+  if (!matdef) return false;
+  set_blend_mode(static_cast<BlendMode>(matdef->blendmode()));
+  bool ok = true;
+  ForEachTexture(matdef, [&](const char *filename, TextureFormat format,
+                             TextureFlags flags) {
+    if (!ok) return;
+    auto tex = tlf(filename, format, flags);
+    if (!tex) {
+      ok = false;
+      return;
+    }
+    flatbuffers::uoffset_t index =
+        static_cast<flatbuffers::uoffset_t>(textures_.size());
+    textures_.push_back(tex);
+    auto original_size =
+        matdef->original_size() && index < matdef->original_size()->size()
+            ? LoadVec2i(matdef->original_size()->Get(index))
+            : tex->size();
+    tex->set_original_size(original_size);
+  });
+  if (!ok) textures_.clear();
+  return ok;
+}
+
+void Material::FinalizeAfterTextures() {
+  std::vector<AsyncAsset *> textures(textures_.begin(), textures_.end());
+  CallFinalizeCallbackAfter(textures);
+}
+
 Material *Material::LoadFromMaterialDef(const matdef::Material *matdef,
                                         const TextureLoaderFn &tlf) {
-  if (matdef) {
-    auto mat = new Material();
-    mat->set_blend_mode(static_cast<BlendMode>(matdef->blendmode()));
-    for (size_t i = 0; i < matdef->texture_filenames()->size(); i++) {
-      flatbuffers::uoffset_t index = static_cast<flatbuffers::uoffset_t>(i);
-      auto format =
-          matdef->desired_format() && i < matdef->desired_format()->size()
-              ? static_cast<TextureFormat>(matdef->desired_format()->Get(index))
-              : kFormatAuto;
-      auto tex = tlf(
-          matdef->texture_filenames()->Get(index)->c_str(), format,
-          (matdef->mipmaps() ? kTextureFlagsUseMipMaps : kTextureFlagsNone) |
-              (matdef->is_cubemap() && matdef->is_cubemap()->Get(index)
-                   ? kTextureFlagsIsCubeMap
-                   : kTextureFlagsNone) |
-              (matdef->wrapmode() == matdef::TextureWrap_CLAMP
-                   ? kTextureFlagsClampToEdge
-                   : kTextureFlagsNone));
-      if (!tex) {
-        delete mat;
-        return nullptr;
-      }
-      mat->textures().push_back(tex);
-      auto original_size =
-          matdef->original_size() && index < matdef->original_size()->size()
-              ? LoadVec2i(matdef->original_size()->Get(index))
-              : tex->size();
-      tex->set_original_size(original_size);
-    }
-    return mat;
+  auto mat = new Material(tlf);
+  if (!mat->InitFromMaterialDef(matdef, tlf)) {
+    delete mat;
+    return nullptr;
   }
-  return nullptr;
+  mat->FinalizeAfterTextures();
+  return mat;
 }
 
 Material *Material::LoadFromMaterialDef(const char *filename,
                                         const TextureLoaderFn &tlf) {
-  const matdef::Material *def = nullptr;
-  std::string flatbuf;
-  if (LoadFile(filename, &flatbuf)) {
-    flatbuffers::Verifier verifier(
-        reinterpret_cast<const uint8_t *>(flatbuf.c_str()), flatbuf.length());
-    assert(matdef::VerifyMaterialBuffer(verifier));
-    def = matdef::GetMaterial(flatbuf.c_str());
-  }
-  Material *mat = LoadFromMaterialDef(def, tlf);
-  if (!mat) {
-    RendererBase::Get()->set_last_error(std::string("Couldn\'t load: ")
-                                      + filename);
-  } else {
-    mat->set_filename(filename);
+  Material *mat = new Material(filename, tlf);
+  if (!mat->LoadNow()) {
+    delete mat;
+    return nullptr;
   }
   return mat;
 }
 
+void Material::Load() {
+  Read();
+  if (!IsLoadCancelled()) Decode();
+}
+
+void Material::Read() {
+  file_ = LoadReadFile(filename_.c_str());
+  if (file_) {
+    load_stats_.bytes_read = file_->size();
+    data_ = file_->data();
+  }
+}
+
+void Material::Decode() {
+  if (!data_ || IsLoadCancelled()) return;
+  flatbuffers::Verifier verifier(data_, file_->size());
+  assert(matdef::VerifyMaterialBuffer(verifier));
+  (void)verifier;
+}
+
+bool Material::Finalize() {
+  if (data_) {
+    valid_ = InitFromMaterialDef(matdef::GetMaterial(data_), texture_loader_);
+    data_ = nullptr;
+  }
+  file_.reset();
+  if (!valid_) {
+    RendererBase::Get()->set_last_error(std::string("Couldn\'t load: ") +
+                                        filename_);
+    CallFinalizeCallback();
+    return false;
+  }
+  FinalizeAfterTextures();
+  return true;
+}
+
 }  // namespace fplbase
@@ -34,6 +34,12 @@ using mathfu::vec4i;
 namespace fplbase {
 namespace {
 
+// What Mesh::Read() hands on to Decode() and Finalize(): the mesh FlatBuffer,
+// which InitFromMeshDef() reads straight from the file's view.
+struct MeshFile {
+  FileView view;
+};
+
 static_assert(
     kEND == static_cast<Attribute>(meshdef::Attribute_END) &&
         kPosition3f == static_cast<Attribute>(meshdef::Attribute_Position3f) &&
@@ -157,30 +163,74 @@ size_t Mesh::VertexSize(const Attribute *attributes) {
 }
 
 void Mesh::Load() {
-  std::string *flatbuf = new std::string();
-  if (LoadFile(filename_.c_str(), flatbuf)) {
-    flatbuffers::Verifier verifier(
-        reinterpret_cast<const uint8_t *>(flatbuf->c_str()), flatbuf->length());
-    assert(meshdef::VerifyMeshBuffer(verifier));
-    data_ = reinterpret_cast<const uint8_t *>(flatbuf);
+  Read();
+  // Don't bother verifying a mesh that was unloaded while it was read.
+  if (!IsLoadCancelled()) Decode();
+}
+
+void Mesh::Read() {
+  FileView view = LoadReadFile(filename_.c_str());
+  if (view) {
+    load_stats_.bytes_read = view->size();
+    MeshFile *file = new MeshFile();
+    file->view = std::move(view);
+    data_ = reinterpret_cast<const uint8_t *>(file);
   } else {
     LogError(kError, "Couldn\'t load: %s", filename_.c_str());
-    delete flatbuf;
   }
 }
 
+void Mesh::Decode() {
+  if (!data_ || IsLoadCancelled()) return;
+  const MeshFile *file = reinterpret_cast<const MeshFile *>(data_);
+  flatbuffers::Verifier verifier(file->view->data(), file->view->size());
+  assert(meshdef::VerifyMeshBuffer(verifier));
+  (void)verifier;
+}
+
 bool Mesh::Finalize() {
   if (data_) {
-    const std::string *flatbuf = reinterpret_cast<const std::string *>(data_);
-    bool ok = InitFromMeshDef(flatbuf->c_str());
-    delete flatbuf;
+    const MeshFile *file = reinterpret_cast<const MeshFile *>(data_);
+    bool ok = InitFromMeshDef(file->view->data());
+    delete file;
     data_ = nullptr;
     if (!ok) Clear();
   }
-  CallFinalizeCallback();
+  // The materials may still be loading their textures. Only report the mesh
+  // as finalized once they are done, so it never renders without them.
+  std::vector<AsyncAsset *> materials;
+  for (auto it = indices_.begin(); it != indices_.end(); ++it) {
+    if (it->mat && std::find(materials.begin(), materials.end(), it->mat) ==
+                       materials.end()) {
+      materials.push_back(it->mat);
+    }
+  }
+  CallFinalizeCallbackAfter(materials);
   return IsValid();
 }
 
+size_t Mesh::UploadSize() const {
+  // Most of the FlatBuffer is vertex and index data.
+  return data_ ? reinterpret_cast<const MeshFile *>(data_)->view->size() : 0;
+}
+
+size_t Mesh::GpuMemorySize() const {
+  size_t size = vertex_size_ * num_vertices_;
+  for (auto it = indices_.begin(); it != indices_.end(); ++it) {
+    size += static_cast<size_t>(it->count) * it->index_size;
+  }
+  return size;
+}
+
+size_t Mesh::CpuMemorySize() const {
+  size_t size = UploadSize() + bone_parents_.size() +
+                shader_bone_indices_.size();
+  if (default_bone_transform_inverses_) {
+    size += num_bones() * sizeof(mathfu::AffineTransform);
+  }
+  return size;
+}
+
 void Mesh::ParseInterleavedVertexData(const void *meshdef_buffer,
                                       InterleavedVertexData *ivd) {
   auto meshdef = meshdef::GetMesh(meshdef_buffer);
@@ -389,7 +439,7 @@ void Mesh::Clear() {
   shader_bone_indices_.clear();
 
   if (data_ != nullptr) {
-    delete reinterpret_cast<const std::string *>(data_);
+    delete reinterpret_cast<const MeshFile *>(data_);
     data_ = nullptr;
   }
 }
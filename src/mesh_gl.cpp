@@ -121,6 +121,7 @@ void Mesh::AddIndices(const void *index_data, int count, Material *mat,
                    count * (is_32_bit ? sizeof(uint32_t) : sizeof(uint16_t)),
                    index_data, GL_STATIC_DRAW));
   idxs.index_type = (is_32_bit ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT);
+  idxs.index_size = is_32_bit ? sizeof(uint32_t) : sizeof(uint16_t);
   idxs.mat = mat;
   GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
 }
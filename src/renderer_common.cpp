@@ -41,6 +41,7 @@ RendererBase::RendererBase()
       supports_texture_npot_(false),
       supports_multiview_(false),
       supports_instancing_(false),
+      supports_mipmap_generation_16bpp_(true),
       force_shader_(nullptr),
       force_blend_mode_(kBlendModeCount),
       max_vertex_uniform_components_(0),
@@ -139,6 +140,10 @@ bool RendererBase::SupportsMultiview() const {
   return supports_multiview_;
 }
 
+bool RendererBase::SupportsMipmapGeneration16bpp() const {
+  return supports_mipmap_generation_16bpp_;
+}
+
 Shader *RendererBase::CompileAndLinkShader(const char *vs_source,
                                            const char *ps_source) {
   return CompileAndLinkShaderHelper(vs_source, ps_source, nullptr);
@@ -166,6 +166,9 @@ bool RendererBase::InitializeRenderingState() {
 
   supports_instancing_ = environment_.feature_level() >= kFeatureLevel30;
 
+  // Ask here, on the render thread, since on Android this calls into Java.
+  supports_mipmap_generation_16bpp_ = MipmapGeneration16bppSupported();
+
 // Check for ETC2:
 #ifdef FPLBASE_GLES
   if (environment_.feature_level() < kFeatureLevel30) {
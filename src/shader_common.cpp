@@ -52,6 +52,7 @@ void Shader::Init(ShaderHandle program, ShaderHandle vs, ShaderHandle ps,
 
   // If the shader has already been loaded, it's not dirty.
   dirty_ = !ValidShaderHandle(vs);
+  from_shader_def_ = false;
 }
 
 // Returns the set of `local_defines` union `global_defines_to_add` less
@@ -113,6 +114,8 @@ void Shader::Reset(ShaderHandle program, ShaderHandle vs, ShaderHandle ps) {
 void Shader::Load() {
   ShaderSourcePair *source_pair = LoadSourceFile();
   if (source_pair != nullptr) {
+    load_stats_.bytes_read = source_pair->vertex_shader.size() +
+                             source_pair->fragment_shader.size();
     data_ = reinterpret_cast<uint8_t *>(source_pair);
   }
 }
@@ -139,6 +142,7 @@ bool Shader::Finalize() {
 }
 
 Shader::ShaderSourcePair *Shader::LoadSourceFile() {
+  if (from_shader_def_) return LoadShaderDefFile();
   std::string filename = std::string(filename_) + ".glslv";
   std::string error_message;
 
@@ -157,6 +161,23 @@ Shader::ShaderSourcePair *Shader::LoadSourceFile() {
   return nullptr;
 }
 
+Shader::ShaderSourcePair *Shader::LoadShaderDefFile() {
+  FileView flatbuf = LoadFileView(filename_.c_str());
+  if (!flatbuf) {
+    LogError(kError, "Can\'t load shader file: %s", filename_.c_str());
+    renderer_->set_last_error(std::string("Couldn\'t load: ") + filename_);
+    return nullptr;
+  }
+  flatbuffers::Verifier verifier(flatbuf->data(), flatbuf->size());
+  assert(shaderdef::VerifyShaderBuffer(verifier));
+  (void)verifier;
+  auto shaderdef = shaderdef::GetShader(flatbuf->data());
+  ShaderSourcePair *source_pair = new ShaderSourcePair();
+  source_pair->vertex_shader = shaderdef->vertex_shader()->str();
+  source_pair->fragment_shader = shaderdef->fragment_shader()->str();
+  return source_pair;
+}
+
 static void BreakAndLogError(const char *cstr) {
   const size_t kMaxLength = 1024;  // Default Android log limit.
   std::string str = cstr;
@@ -173,12 +194,11 @@ static void BreakAndLogError(const char *cstr) {
 }
 
 Shader *Shader::LoadFromShaderDef(const char *filename) {
-  std::string flatbuf;
-  if (LoadFile(filename, &flatbuf)) {
-    flatbuffers::Verifier verifier(
-        reinterpret_cast<const uint8_t *>(flatbuf.c_str()), flatbuf.length());
+  FileView flatbuf = LoadFileView(filename);
+  if (flatbuf) {
+    flatbuffers::Verifier verifier(flatbuf->data(), flatbuf->size());
     assert(shaderdef::VerifyShaderBuffer(verifier));
-    auto shaderdef = shaderdef::GetShader(flatbuf.c_str());
+    auto shaderdef = shaderdef::GetShader(flatbuf->data());
     auto shader = RendererBase::Get()->CompileAndLinkShader(
         shaderdef->vertex_shader()->c_str(),
         shaderdef->fragment_shader()->c_str());
@@ -15,6 +15,7 @@
 #include "precompiled.h"
 
 #include "fplbase/flatbuffer_utils.h"
+#include "fplbase/internal/image_kernels.h"
 #include "fplbase/renderer.h"
 #include "fplbase/texture.h"
 #include "fplbase/texture_atlas.h"
@@ -59,22 +60,163 @@ namespace fplbase {
 // Returns true if the file has a Resource Interchange File Format (RIFF) header
 // whose first chunk has a WEBP FOURCC. This will not check chunks other than
 // the first one. https://developers.google.com/speed/webp/docs/riff_container
-static bool HasWebpHeader(const std::string &file) {
-  return file.size() > 12 && file.substr(0, 4) == "RIFF" &&
-         file.substr(8, 4) == "WEBP";
-}
-
-static void MultiplyRgbByAlpha(uint8_t *rgba_ptr, int width, int height) {
-  const int num_pixels = width * height;
-  for (int i = 0; i < num_pixels; ++i, rgba_ptr += 4) {
-    const auto alpha = static_cast<uint16_t>(rgba_ptr[3]);
-    rgba_ptr[0] = static_cast<uint8_t>(
-        (static_cast<uint16_t>(rgba_ptr[0]) * alpha) / 255);
-    rgba_ptr[1] = static_cast<uint8_t>(
-        (static_cast<uint16_t>(rgba_ptr[1]) * alpha) / 255);
-    rgba_ptr[2] = static_cast<uint8_t>(
-        (static_cast<uint16_t>(rgba_ptr[2]) * alpha) / 255);
+static bool HasWebpHeader(const FileBuffer &file) {
+  return file.size() > 12 && memcmp(file.data(), "RIFF", 4) == 0 &&
+         memcmp(file.data() + 8, "WEBP", 4) == 0;
+}
+
+// A fast 64-bit hash of `size` bytes, 8 at a time (MurmurHash64A). Never
+// returns 0, which means "not hashed".
+static uint64_t HashContents(const uint8_t *data, size_t size) {
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+  uint64_t h = 0x8445d61a4e774912ULL ^ (size * m);
+  const uint8_t *end = data + (size & ~static_cast<size_t>(7));
+  for (; data != end; data += 8) {
+    uint64_t k;
+    memcpy(&k, data, sizeof(k));
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+  uint64_t tail = 0;
+  for (size_t i = 0; i < (size & 7); ++i) {
+    tail |= static_cast<uint64_t>(data[i]) << (i * 8);
+  }
+  if (size & 7) {
+    h ^= tail;
+    h *= m;
+  }
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h ? h : 1;
+}
+
+// The approximate size of `size` pixels of the given format.
+static size_t PixelDataSize(TextureFormat format, const vec2i &size) {
+  const size_t num_pixels = static_cast<size_t>(size.x) * size.y;
+  switch (format) {
+    case kFormat8888:
+      return num_pixels * 4;
+    case kFormat888:
+      return num_pixels * 3;
+    case kFormat5551:
+    case kFormat565:
+    case kFormatLuminanceAlpha:
+      return num_pixels * 2;
+    default:
+      // Luminance, and the compressed formats at roughly 8 bits per pixel.
+      return num_pixels;
+  }
+}
+
+// Checks the header of an ASTC file, and reads its size.
+static bool ReadASTCHeader(const void *astc_buf, size_t size,
+                           TextureFlags flags, vec2i *dimensions,
+                           TextureFormat *texture_format) {
+  if (flags & kTextureFlagsPremultiplyAlpha) {
+    LogError(kApplication, "Premultipled alpha not supported for ASTC");
+  }
+  if (size < sizeof(ASTCHeader)) return false;
+  auto &header = *reinterpret_cast<const ASTCHeader *>(astc_buf);
+  static const uint8_t magic[] = {0x13, 0xab, 0xa1, 0x5c};
+  if (memcmp(header.magic, magic, sizeof(magic))) return false;
+
+  auto xsize =
+      header.xsize[0] | (header.xsize[1] << 8) | (header.xsize[2] << 16);
+  auto ysize =
+      header.ysize[0] | (header.ysize[1] << 8) | (header.ysize[2] << 16);
+  auto zsize =
+      header.zsize[0] | (header.zsize[1] << 8) | (header.zsize[2] << 16);
+
+  // TODO(wvo): Our pipeline currently doesn't support 3D textures.
+  if (zsize != 1) return false;
+
+  *dimensions = vec2i(xsize, ysize);
+  *texture_format = kFormatASTC;
+  return true;
+}
+
+// Checks the header of a PKM file, and reads its size.
+static bool ReadPKMHeader(const void *file_buf, size_t size,
+                          TextureFlags flags, vec2i *dimensions,
+                          TextureFormat *texture_format) {
+  if (flags & kTextureFlagsPremultiplyAlpha) {
+    LogError(kApplication, "Premultipled alpha not supported for PKM");
+  }
+  if (size < sizeof(PKMHeader)) return false;
+  auto &header = *reinterpret_cast<const PKMHeader *>(file_buf);
+  if (strncmp(header.magic, "PKM ", 4) && strncmp(header.version, "10", 2))
+    return false;
+
+  auto xsize = (header.width[0] << 8) | header.width[1];  // Big endian!
+  auto ysize = (header.height[0] << 8) | header.height[1];
+  *dimensions = vec2i(xsize, ysize);
+  *texture_format = kFormatPKM;
+  return true;
+}
+
+// Checks the header of a KTX file, and reads its size.
+static bool ReadKTXHeader(const void *file_buf, size_t size,
+                          TextureFlags flags, vec2i *dimensions,
+                          TextureFormat *texture_format) {
+  if (flags & kTextureFlagsPremultiplyAlpha) {
+    LogError(kApplication, "Premultipled alpha not supported for KTX");
+  }
+  if (size < sizeof(KTXHeader)) return false;
+  auto &header = *reinterpret_cast<const KTXHeader *>(file_buf);
+  auto magic = "\xABKTX 11\xBB\r\n\x1A\n";
+  auto v = memcmp(header.id, magic, sizeof(header.id));
+  // Note: a single Nx6N face and six NxN faces are both valid cubemaps
+  bool valid_face_count =
+      (flags & kTextureFlagsIsCubeMap)
+          ? (header.faces == 6 && header.width == header.height) ||
+                (header.faces == 1 && header.width * 6 == header.height)
+          : (header.faces == 1);
+  if (v != 0 || header.endian != 0x04030201 || header.depth != 0 ||
+      !valid_face_count) {
+    return false;
+  }
+
+  *dimensions = vec2i(header.width, header.height);
+  *texture_format = kFormatKTX;
+  return true;
+}
+
+// Reads the header of an ASTC, PKM or KTX file, as given by `ext`. These are
+// uploaded as they are, so there is nothing to unpack.
+static bool ReadCompressedHeader(const char *filename, const FileBuffer &file,
+                                 const std::string &ext, TextureFlags flags,
+                                 vec2i *dimensions,
+                                 TextureFormat *texture_format) {
+  if (ext == "astc") {
+    if (ReadASTCHeader(file.data(), file.size(), flags, dimensions,
+                       texture_format)) {
+      return true;
+    }
+    LogError(kApplication, "ASTC format problem: %s", filename);
+  } else if (ext == "pkm") {
+    if (ReadPKMHeader(file.data(), file.size(), flags, dimensions,
+                      texture_format)) {
+      return true;
+    }
+    LogError(kApplication, "PKM format problem: %s", filename);
+  } else {
+    assert(ext == "ktx");
+    if (ReadKTXHeader(file.data(), file.size(), flags, dimensions,
+                      texture_format)) {
+      return true;
+    }
+    LogError(kApplication, "KTX format problem: %s", filename);
   }
+  return false;
+}
+
+static bool IsCompressedFileExtension(const std::string &ext) {
+  return ext == "astc" || ext == "pkm" || ext == "ktx";
 }
 
 Texture::Texture(const char *filename, TextureFormat format, TextureFlags flags)
@@ -88,22 +230,82 @@ Texture::Texture(const char *filename, TextureFormat format, TextureFlags flags)
       target_(TextureTargetFromFlags(flags)),
       desired_(format),
       flags_(flags),
-      is_external_(false) {}
+      is_external_(false),
+      content_hash_(0),
+      content_size_(0),
+      shared_(nullptr) {}
 
 Texture::~Texture() {
-  if (data_) {
-    free(const_cast<uint8_t *>(data_));
-    data_ = nullptr;
-  }
-
+  FreeData();
   Delete();
   DestroyTextureImpl(impl_);
 }
 
 void Texture::Load() {
-  data_ = LoadAndUnpackTexture(filename_.c_str(), scale_, flags_, &size_,
-                               &texture_format_);
+  Read();
+  // Don't bother decoding a texture that was unloaded while it was read.
+  if (!IsLoadCancelled()) Decode();
+}
+
+void Texture::Read() {
+  file_ = LoadTextureFile(filename_.c_str(), &file_ext_, this);
+  load_stats_.bytes_read = file_ ? file_->size() : 0;
+  if (file_ && find_duplicate_) {
+    // Hash while the file is still in the cache.
+    content_hash_ = HashContents(file_->data(), file_->size());
+    content_size_ = file_->size();
+    shared_ = find_duplicate_(this);
+    // Nothing left to decode.
+    if (shared_) file_.reset();
+  }
+}
+
+void Texture::Decode() {
+  if (!file_ || IsLoadCancelled()) return;
+  if (IsCompressedFileExtension(file_ext_)) {
+    // Upload straight from the file, which is kept until Finalize(), rather
+    // than from a copy of it.
+    if (ReadCompressedHeader(filename_.c_str(), *file_, file_ext_, flags_,
+                             &size_, &texture_format_)) {
+      data_ = file_->data();
+      SetOriginalSizeIfNotYetSet(size_);
+    } else {
+      file_.reset();
+    }
+    return;
+  }
+  data_ = UnpackTextureFile(filename_.c_str(), *file_, file_ext_, scale_,
+                            flags_, &size_, &texture_format_);
   SetOriginalSizeIfNotYetSet(size_);
+  // Release the file now, rather than when the texture is destroyed.
+  file_.reset();
+  if (data_) {
+    ConvertForUpload(RendererBase::Get()->SupportsMipmapGeneration16bpp());
+  }
+}
+
+void Texture::ConvertForUpload(bool mipmap_16bpp_supported) {
+  const TextureFormat upload = UploadFormat(texture_format_, desired_);
+  const bool to_5551 = upload == kFormat5551 && texture_format_ == kFormat8888;
+  const bool to_565 = upload == kFormat565 && texture_format_ == kFormat888;
+  if (!(to_5551 || to_565) || !mipmap_16bpp_supported) return;
+
+  // Convert here, on the loader thread, rather than in Finalize(), and in
+  // place, since the 8-bit pixels aren't needed afterwards.
+  auto pixels = const_cast<uint8_t *>(data_);
+  auto pixels16 = reinterpret_cast<uint16_t *>(pixels);
+  const bool dither = (flags_ & kTextureFlagsDither16Bit) != 0;
+  if (to_5551) {
+    ConvertRgba8888ToRgba5551(pixels, size_.x, size_.y, dither, pixels16);
+    texture_format_ = kFormat5551;
+  } else {
+    ConvertRgb888ToRgb565(pixels, size_.x, size_.y, dither, pixels16);
+    texture_format_ = kFormat565;
+  }
+  // Give back the half (or third) of the buffer that is no longer used.
+  auto shrunk = static_cast<uint8_t *>(
+      realloc(pixels, PixelDataSize(texture_format_, size_)));
+  if (shrunk) data_ = shrunk;
 }
 
 void Texture::LoadFromMemory(const uint8_t *data, const vec2i &size,
@@ -116,16 +318,49 @@ void Texture::LoadFromMemory(const uint8_t *data, const vec2i &size,
 }
 
 bool Texture::Finalize() {
-  if (data_) {
+  if (shared_) {
+    // Borrow the GPU texture of the one with the same contents, which keeps
+    // owning it.
+    SetTextureId(shared_->target_, shared_->id_);
+    size_ = shared_->size_;
+    SetOriginalSizeIfNotYetSet(shared_->original_size_);
+    texture_format_ = shared_->texture_format_;
+  } else if (data_) {
     id_ = CreateTexture(data_, size_, texture_format_, desired_, flags_, impl_);
     is_external_ = false;
-    free(const_cast<uint8_t *>(data_));
-    data_ = nullptr;
+    FreeData();
   }
   CallFinalizeCallback();
   return ValidTextureHandle(id_);
 }
 
+void Texture::FreeData() {
+  // While file_ is held, data_ points into it, see Decode().
+  if (data_ && !file_) free(const_cast<uint8_t *>(data_));
+  data_ = nullptr;
+  file_.reset();
+}
+
+size_t Texture::UploadSize() const {
+  if (!data_) return 0;
+  return file_ ? file_->size() : PixelDataSize(texture_format_, size_);
+}
+
+size_t Texture::GpuMemorySize() const {
+  if (!ValidTextureHandle(id_) || is_external_) return 0;
+  // Cube maps are 1x6 strips, so this counts all their faces.
+  size_t size = PixelDataSize(texture_format_, size_);
+  // A full mipmap chain adds a third.
+  if (flags_ & kTextureFlagsUseMipMaps) size += size / 3;
+  return size;
+}
+
+size_t Texture::CpuMemorySize() const {
+  // Don't count a file that data_ points into twice.
+  if (file_ && data_) return file_->size();
+  return (file_ ? file_->size() : 0) + UploadSize();
+}
+
 void Texture::Set(size_t unit) { Set(unit, nullptr); }
 
 void Texture::Set(size_t unit, Renderer *) const {
@@ -136,20 +371,13 @@ void Texture::Set(size_t unit) const { const_cast<Texture *>(this)->Set(unit); }
 
 uint16_t *Texture::Convert8888To5551(const uint8_t *buffer, const vec2i &size) {
   auto buffer16 = new uint16_t[size.x * size.y];
-  for (int i = 0; i < size.x * size.y; i++) {
-    auto c = &buffer[i * 4];
-    buffer16[i] = ((c[0] >> 3) << 11) | ((c[1] >> 3) << 6) |
-                  ((c[2] >> 3) << 1) | ((c[3] >> 7) << 0);
-  }
+  ConvertRgba8888ToRgba5551(buffer, size.x, size.y, false, buffer16);
   return buffer16;
 }
 
 uint16_t *Texture::Convert888To565(const uint8_t *buffer, const vec2i &size) {
   auto buffer16 = new uint16_t[size.x * size.y];
-  for (int i = 0; i < size.x * size.y; i++) {
-    auto c = &buffer[i * 3];
-    buffer16[i] = ((c[0] >> 3) << 11) | ((c[1] >> 2) << 5) | ((c[2] >> 3) << 0);
-  }
+  ConvertRgb888ToRgb565(buffer, size.x, size.y, false, buffer16);
   return buffer16;
 }
 
@@ -207,92 +435,40 @@ uint8_t *Texture::UnpackWebP(const void *webp_buf, size_t size,
   return config.output.private_memory;  // Allocated with malloc by webp.
 }
 
+// A malloc()ed copy of a compressed file, so that it can be freed in the same
+// way as the other unpacked formats. Texture::Load() doesn't need this, since
+// it keeps the file until the texture is uploaded.
+static uint8_t *CopyFileContents(const void *file_buf, size_t size) {
+  auto buf = reinterpret_cast<uint8_t *>(malloc(size));
+  memcpy(buf, file_buf, size);
+  return buf;
+}
+
 uint8_t *Texture::UnpackASTC(const void *astc_buf, size_t size,
                              TextureFlags flags, vec2i *dimensions,
                              TextureFormat *texture_format) {
-  if (flags & kTextureFlagsPremultiplyAlpha) {
-    LogError(kApplication, "Premultipled alpha not supported for ASTC");
+  if (!ReadASTCHeader(astc_buf, size, flags, dimensions, texture_format)) {
+    return nullptr;
   }
-  auto &header = *reinterpret_cast<const ASTCHeader *>(astc_buf);
-  static const uint8_t magic[] = {0x13, 0xab, 0xa1, 0x5c};
-  if (memcmp(header.magic, magic, sizeof(magic))) return nullptr;
-
-  auto xsize =
-      header.xsize[0] | (header.xsize[1] << 8) | (header.xsize[2] << 16);
-  auto ysize =
-      header.ysize[0] | (header.ysize[1] << 8) | (header.ysize[2] << 16);
-  auto zsize =
-      header.zsize[0] | (header.zsize[1] << 8) | (header.zsize[2] << 16);
-
-  // TODO(wvo): Our pipeline currently doesn't support 3D textures.
-  if (zsize != 1) return nullptr;
-
-  *dimensions = vec2i(xsize, ysize);
-  *texture_format = kFormatASTC;
-
-  // TODO(wvo): This in theory doesn't need to be copied, but it keeps the API
-  // uniform, and should not affect load times.
-  // We use malloc to ensure that all unpacked texture formats can be freed
-  // in the same way (see also other Unpack* functions).
-  auto buf = reinterpret_cast<uint8_t *>(malloc(size));
-  memcpy(buf, astc_buf, size);
-  return buf;
+  return CopyFileContents(astc_buf, size);
 }
 
 uint8_t *Texture::UnpackPKM(const void *file_buf, size_t size,
                             TextureFlags flags, vec2i *dimensions,
                             TextureFormat *texture_format) {
-  if (flags & kTextureFlagsPremultiplyAlpha) {
-    LogError(kApplication, "Premultipled alpha not supported for PKM");
-  }
-  auto &header = *reinterpret_cast<const PKMHeader *>(file_buf);
-  if (strncmp(header.magic, "PKM ", 4) && strncmp(header.version, "10", 2))
+  if (!ReadPKMHeader(file_buf, size, flags, dimensions, texture_format)) {
     return nullptr;
-
-  auto xsize = (header.width[0] << 8) | header.width[1];  // Big endian!
-  auto ysize = (header.height[0] << 8) | header.height[1];
-  *dimensions = vec2i(xsize, ysize);
-  *texture_format = kFormatPKM;
-
-  // TODO(wvo): This in theory doesn't need to be copied, but it keeps the API
-  // uniform, and should not affect load times.
-  // We use malloc to ensure that all unpacked texture formats can be freed
-  // in the same way (see also other Unpack* functions).
-  auto buf = reinterpret_cast<uint8_t *>(malloc(size));
-  memcpy(buf, file_buf, size);
-  return buf;
+  }
+  return CopyFileContents(file_buf, size);
 }
 
 uint8_t *Texture::UnpackKTX(const void *file_buf, size_t size,
                             TextureFlags flags, vec2i *dimensions,
                             TextureFormat *texture_format) {
-  if (flags & kTextureFlagsPremultiplyAlpha) {
-    LogError(kApplication, "Premultipled alpha not supported for KTX");
-  }
-  auto &header = *reinterpret_cast<const KTXHeader *>(file_buf);
-  auto magic = "\xABKTX 11\xBB\r\n\x1A\n";
-  auto v = memcmp(header.id, magic, sizeof(header.id));
-  // Note: a single Nx6N face and six NxN faces are both valid cubemaps
-  bool valid_face_count =
-      (flags & kTextureFlagsIsCubeMap)
-          ? (header.faces == 6 && header.width == header.height) ||
-                (header.faces == 1 && header.width * 6 == header.height)
-          : (header.faces == 1);
-  if (v != 0 || header.endian != 0x04030201 || header.depth != 0 ||
-      !valid_face_count) {
+  if (!ReadKTXHeader(file_buf, size, flags, dimensions, texture_format)) {
     return nullptr;
   }
-
-  *dimensions = vec2i(header.width, header.height);
-  *texture_format = kFormatKTX;
-
-  // TODO(wvo): This in theory doesn't need to be copied, but it keeps the API
-  // uniform, and should not affect load times.
-  // We use malloc to ensure that all unpacked texture formats can be freed
-  // in the same way (see also other Unpack* functions).
-  auto buf = reinterpret_cast<uint8_t *>(malloc(size));
-  memcpy(buf, file_buf, size);
-  return buf;
+  return CopyFileContents(file_buf, size);
 }
 
 uint8_t *Texture::UnpackImage(const void *img_buf, size_t size,
@@ -326,7 +502,7 @@ uint8_t *Texture::UnpackImage(const void *img_buf, size_t size,
   *dimensions = vec2i(width, height);
   if (channels == 4) {
     if (flags & kTextureFlagsPremultiplyAlpha) {
-      MultiplyRgbByAlpha(image, width, height);
+      MultiplyRgbByAlpha(image, static_cast<size_t>(width) * height);
     }
 
     *texture_format = kFormat8888;
@@ -344,69 +520,81 @@ uint8_t *Texture::LoadAndUnpackTexture(const char *filename, const vec2 &scale,
                                        TextureFlags flags, vec2i *dimensions,
                                        TextureFormat *texture_format) {
   std::string ext;
-  std::string basename = filename;
-  size_t ext_pos = basename.find_last_of(".");
-  if (ext_pos != std::string::npos) {
-    ext = basename.substr(ext_pos + 1);
-    basename = basename.substr(0, ext_pos);
-  }
+  FileView file = LoadTextureFile(filename, &ext);
+  if (!file) return nullptr;
+  return UnpackTextureFile(filename, *file, ext, scale, flags, dimensions,
+                           texture_format);
+}
 
-  std::string file;
+// Whether the renderer can upload the compressed texture files with extension
+// `ext`, which is "astc", "pkm" or "ktx".
+static bool SupportsCompressedExtension(const std::string &ext) {
+  const TextureFormat format =
+      ext == "astc" ? kFormatASTC : ext == "pkm" ? kFormatPKM : kFormatKTX;
+  return RendererBase::Get()->SupportsTextureFormat(format);
+}
 
-  // Try to load ASTC, but default to WebP if not available or not supported.
-  if (ext == "astc") {
-    if (RendererBase::Get()->SupportsTextureFormat(kFormatASTC) &&
-        LoadFile(filename, &file)) {
-      auto buf = UnpackASTC(file.c_str(), file.length(), flags, dimensions,
-                            texture_format);
-      if (!buf) LogError(kApplication, "ASTC format problem: %s", filename);
-      return buf;
-    } else {
-      ext = "webp";
+const char *Texture::ReadAheadFile() const {
+  const size_t ext_pos = filename_.find_last_of(".");
+  if (ext_pos != std::string::npos) {
+    const std::string ext = filename_.substr(ext_pos + 1);
+    if ((ext == "astc" || ext == "pkm" || ext == "ktx") &&
+        !SupportsCompressedExtension(ext)) {
+      return nullptr;
     }
   }
+  return filename_.c_str();
+}
 
-  // Try to load PKM, but default to WebP if not available or not supported.
-  if (ext == "pkm") {
-    if (RendererBase::Get()->SupportsTextureFormat(kFormatPKM) &&
-        LoadFile(filename, &file)) {
-      auto buf = UnpackPKM(file.c_str(), file.length(), flags, dimensions,
-                           texture_format);
-      if (!buf) LogError(kApplication, "PKM format problem: %s", filename);
-      return buf;
-    } else {
-      ext = "webp";
-    }
+FileView Texture::LoadTextureFile(const char *filename, std::string *ext,
+                                  Texture *texture) {
+  auto load_file = [texture](const char *name) {
+    return texture ? texture->LoadReadFile(name) : LoadFileView(name);
+  };
+  std::string basename = filename;
+  ext->clear();
+  size_t ext_pos = basename.find_last_of(".");
+  if (ext_pos != std::string::npos) {
+    *ext = basename.substr(ext_pos + 1);
+    basename = basename.substr(0, ext_pos);
   }
 
-  // Try to load KTX, but default to WebP if not available or not supported.
-  if (ext == "ktx") {
-    if (RendererBase::Get()->SupportsTextureFormat(kFormatKTX) &&
-        LoadFile(filename, &file)) {
-      auto buf = UnpackKTX(file.c_str(), file.length(), flags, dimensions,
-                           texture_format);
-      if (!buf) LogError(kApplication, "KTX format problem: %s", filename);
-      return buf;
-    } else {
-      ext = "webp";
+  // Try to load ASTC, PKM or KTX, but default to WebP if not available or not
+  // supported.
+  if (*ext == "astc" || *ext == "pkm" || *ext == "ktx") {
+    if (SupportsCompressedExtension(*ext)) {
+      FileView file = load_file(filename);
+      if (file) return file;
     }
+    *ext = "webp";
   }
 
   std::string altfilename = basename;
-  if (ext.length()) altfilename += "." + ext;
+  if (ext->length()) altfilename += "." + *ext;
 
-  if (!LoadFile(altfilename.c_str(), &file)) {
-    LogError(kApplication, "Couldn\'t load: %s", filename);
-    return nullptr;
-  }
+  FileView file = load_file(altfilename.c_str());
+  if (!file) LogError(kApplication, "Couldn\'t load: %s", filename);
+  return file;
+}
 
-  if (ext == "tga" || ext == "png" || ext == "jpg") {
-    auto buf = UnpackImage(file.c_str(), file.length(), scale, flags,
+uint8_t *Texture::UnpackTextureFile(const char *filename,
+                                    const FileBuffer &file,
+                                    const std::string &ext, const vec2 &scale,
+                                    TextureFlags flags, vec2i *dimensions,
+                                    TextureFormat *texture_format) {
+  if (IsCompressedFileExtension(ext)) {
+    if (!ReadCompressedHeader(filename, file, ext, flags, dimensions,
+                              texture_format)) {
+      return nullptr;
+    }
+    return CopyFileContents(file.data(), file.size());
+  } else if (ext == "tga" || ext == "png" || ext == "jpg") {
+    auto buf = UnpackImage(file.data(), file.size(), scale, flags,
                            dimensions, texture_format);
     if (!buf) LogError(kApplication, "Image format problem: %s", filename);
     return buf;
   } else if (ext == "webp" || HasWebpHeader(file)) {
-    auto buf = UnpackWebP(file.c_str(), file.length(), scale, flags, dimensions,
+    auto buf = UnpackWebP(file.data(), file.size(), scale, flags, dimensions,
                           texture_format);
     if (!buf) LogError(kApplication, "WebP format problem: %s", filename);
     return buf;
@@ -417,34 +605,63 @@ uint8_t *Texture::LoadAndUnpackTexture(const char *filename, const vec2 &scale,
   }
 }
 
-TextureAtlas *TextureAtlas::LoadTextureAtlas(const char *filename,
-                                             TextureFormat format,
-                                             TextureFlags flags,
-                                             const TextureLoaderFn &tlf) {
-  std::string flatbuf;
-  if (LoadFile(filename, &flatbuf)) {
-    flatbuffers::Verifier verifier(
-        reinterpret_cast<const uint8_t *>(flatbuf.c_str()), flatbuf.length());
-    assert(atlasdef::VerifyTextureAtlasBuffer(verifier));
-    auto atlasdef = atlasdef::GetTextureAtlas(flatbuf.c_str());
-    Texture *atlas_texture =
-        tlf(atlasdef->texture_filename()->c_str(), format, flags);
-    auto atlas = new TextureAtlas();
-    atlas->set_atlas_texture(atlas_texture);
+void TextureAtlas::Load() {
+  Read();
+  if (!IsLoadCancelled()) Decode();
+}
+
+void TextureAtlas::Read() {
+  file_ = LoadReadFile(filename_.c_str());
+  if (file_) {
+    load_stats_.bytes_read = file_->size();
+    data_ = file_->data();
+  }
+}
+
+void TextureAtlas::Decode() {
+  if (!data_ || IsLoadCancelled()) return;
+  flatbuffers::Verifier verifier(data_, file_->size());
+  assert(atlasdef::VerifyTextureAtlasBuffer(verifier));
+  (void)verifier;
+}
+
+bool TextureAtlas::Finalize() {
+  if (data_) {
+    auto atlasdef = atlasdef::GetTextureAtlas(data_);
+    atlas_texture_ =
+        texture_loader_(atlasdef->texture_filename()->c_str(), format_, flags_);
     for (size_t i = 0; i < atlasdef->entries()->Length(); ++i) {
       flatbuffers::uoffset_t index = static_cast<flatbuffers::uoffset_t>(i);
-      atlas->index_map().insert(std::make_pair(
+      index_map_.insert(std::make_pair(
           atlasdef->entries()->Get(index)->name()->str(), index));
       vec2 size = LoadVec2(atlasdef->entries()->Get(index)->size());
       vec2 location = LoadVec2(atlasdef->entries()->Get(index)->location());
-      atlas->subtexture_bounds().push_back(
+      subtexture_bounds_.push_back(
           vec4(location.x, location.y, size.x, size.y));
     }
-    return atlas;
+    data_ = nullptr;
+  }
+  file_.reset();
+  if (!atlas_texture_) {
+    RendererBase::Get()->set_last_error(std::string("Couldn\'t load: ") +
+                                        filename_);
+    CallFinalizeCallback();
+    return false;
+  }
+  CallFinalizeCallbackAfter(std::vector<AsyncAsset *>(1, atlas_texture_));
+  return true;
+}
+
+TextureAtlas *TextureAtlas::LoadTextureAtlas(const char *filename,
+                                             TextureFormat format,
+                                             TextureFlags flags,
+                                             const TextureLoaderFn &tlf) {
+  auto atlas = new TextureAtlas(filename, format, flags, tlf);
+  if (!atlas->LoadNow()) {
+    delete atlas;
+    return nullptr;
   }
-  RendererBase::Get()->set_last_error(std::string("Couldn\'t load: ") +
-                                      filename);
-  return nullptr;
+  return atlas;
 }
 
 }  // namespace fplbase
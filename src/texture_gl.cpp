@@ -16,6 +16,7 @@
 #include "precompiled.h"
 
 #include "fplbase/flatbuffer_utils.h"
+#include "fplbase/internal/image_kernels.h"
 #include "fplbase/internal/type_conversions_gl.h"
 #include "fplbase/renderer.h"
 #include "fplbase/texture.h"
@@ -153,7 +154,9 @@ TextureHandle Texture::CreateTexture(const uint8_t *buffer, const vec2i &size,
   bool generate_mips = (flags & kTextureFlagsUseMipMaps) != 0;
   bool have_mips = generate_mips;
 
-  if (generate_mips && IsCompressed(texture_format)) {
+  // 16-bit formats count as compressed, but can have mipmaps generated.
+  if (generate_mips && IsCompressed(texture_format) &&
+      texture_format != kFormat5551 && texture_format != kFormat565) {
     if (texture_format == kFormatKTX) {
       const auto &header = *reinterpret_cast<const KTXHeader *>(buffer);
       have_mips = (header.mip_levels > 1);
@@ -170,7 +173,7 @@ TextureHandle Texture::CreateTexture(const uint8_t *buffer, const vec2i &size,
   // In some Android devices (particulary Galaxy Nexus), there is an issue
   // of glGenerateMipmap() with 16BPP texture format.
   // In that case, we are going to fallback to 888/8888 textures
-  const bool use_16bpp = MipmapGeneration16bppSupported();
+  const bool use_16bpp = RendererBase::Get()->SupportsMipmapGeneration16bpp();
   const GLint wrap_mode =
       flags & kTextureFlagsClampToEdge ? GL_CLAMP_TO_EDGE : GL_REPEAT;
 
@@ -190,13 +193,8 @@ TextureHandle Texture::CreateTexture(const uint8_t *buffer, const vec2i &size,
 
   auto format = GL_RGBA;
   auto type = GL_UNSIGNED_BYTE;
-  if (desired == kFormatAuto) {
-    desired = IsCompressed(texture_format)
-                  ? texture_format
-                  : HasAlpha(texture_format) ? kFormat5551 : kFormat565;
-  } else if (desired == kFormatNative) {
-    desired = texture_format;
-  }
+  desired = UploadFormat(texture_format, desired);
+  const bool dither = (flags & kTextureFlagsDither16Bit) != 0;
 
   auto gl_tex_image = [&](const uint8_t *buf, const vec2i &mip_size,
                           int mip_level, int buf_size, bool compressed) {
@@ -220,18 +218,26 @@ TextureHandle Texture::CreateTexture(const uint8_t *buffer, const vec2i &size,
       switch (texture_format) {
         case kFormat8888:
           if (use_16bpp) {
-            auto buffer16 = Convert8888To5551(buffer, size);
+            // Textures loaded by Texture::Load() were already converted by
+            // the loader thread, so this is only for direct calls.
+            uint16_t *buffer16 = nullptr;
+            if (buffer) {
+              buffer16 = static_cast<uint16_t *>(
+                  ThreadScratchBuffer(size.x * size.y * sizeof(uint16_t)));
+              ConvertRgba8888ToRgba5551(buffer, size.x, size.y, dither,
+                                        buffer16);
+            }
             type = GL_UNSIGNED_SHORT_5_5_5_1;
             gl_tex_image(reinterpret_cast<const uint8_t *>(buffer16), tex_size,
                          0, num_pixels * 2, false);
-            delete[] buffer16;
           } else {
             // Fallback to 8888
             gl_tex_image(buffer, tex_size, 0, num_pixels * 4, false);
           }
           break;
         case kFormat5551:
-          // Nothing coversion.
+          // No conversion.
+          type = GL_UNSIGNED_SHORT_5_5_5_1;
           gl_tex_image(buffer, tex_size, 0, num_pixels * 2, false);
           break;
         default:
@@ -246,11 +252,15 @@ TextureHandle Texture::CreateTexture(const uint8_t *buffer, const vec2i &size,
       switch (texture_format) {
         case kFormat888:
           if (use_16bpp) {
-            auto buffer16 = Convert888To565(buffer, size);
+            uint16_t *buffer16 = nullptr;
+            if (buffer) {
+              buffer16 = static_cast<uint16_t *>(
+                  ThreadScratchBuffer(size.x * size.y * sizeof(uint16_t)));
+              ConvertRgb888ToRgb565(buffer, size.x, size.y, dither, buffer16);
+            }
             type = GL_UNSIGNED_SHORT_5_6_5;
             gl_tex_image(reinterpret_cast<const uint8_t *>(buffer16), tex_size,
                          0, num_pixels * 2, false);
-            delete[] buffer16;
           } else {
             // Fallback to 888
             gl_tex_image(buffer, tex_size, 0, num_pixels * 3, false);
@@ -0,0 +1,68 @@
+// Copyright 2017 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <chrono>
+
+#include "fplbase/asset_manager.h"
+#include "fplbase/renderer.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+const char kListFileName[] = "asset_manager_test_list.bin";
+
+}  // namespace
+
+class AssetManagerTests : public ::testing::Test {
+ protected:
+  virtual void SetUp() {}
+  virtual void TearDown() { remove(kListFileName); }
+
+  // The unit tests have no GL context, so only assets that don't touch the
+  // GPU can be loaded.
+  fplbase::Renderer renderer_;
+};
+
+// A group holding the material of untextured surfaces, which the scans of
+// meshes add to their groups, is finalized.
+TEST_F(AssetManagerTests, GroupWithUntexturedMaterial) {
+  fplbase::AssetManager manager(renderer_);
+  // Record a list holding the material that mesh files name for untextured
+  // surfaces.
+  manager.StartRecordingLoads();
+  fplbase::Material *material = manager.LoadMaterial("");
+  manager.StopRecordingLoads();
+  ASSERT_TRUE(material != nullptr);
+  EXPECT_TRUE(material->IsFinalized());
+  ASSERT_TRUE(manager.SaveLoadManifest(kListFileName));
+
+  fplbase::AssetGroupHandle group = manager.LoadAssetList(kListFileName);
+  ASSERT_TRUE(group != nullptr);
+  manager.StartLoadingTextures();
+  const auto give_up =
+      std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (!group->IsFinalized() && std::chrono::steady_clock::now() < give_up) {
+    manager.TryFinalize();
+  }
+  manager.StopLoadingTextures();
+  EXPECT_TRUE(group->IsFinalized());
+  EXPECT_EQ(1, group->progress().assets_total);
+  EXPECT_EQ(group->progress().assets_total, group->progress().assets_done);
+}
+
+extern "C" int FPL_main(int argc, char *argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,93 @@
+// Copyright 2017 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "fplbase/asset_id.h"
+#include "fplbase/internal/asset_table.h"
+#include "gtest/gtest.h"
+
+using fplbase::AssetId;
+using fplbase::AssetIdFromName;
+using fplbase::AssetTable;
+
+static std::string Name(const char *prefix, int i) {
+  char name[32];
+  snprintf(name, sizeof(name), "%s%d", prefix, i);
+  return name;
+}
+
+class AssetTableTests : public ::testing::Test {
+ protected:
+  virtual void SetUp() {}
+  virtual void TearDown() {}
+};
+
+// Ids of literals are computed at compile time, and match the ids of the same
+// names at run time.
+TEST_F(AssetTableTests, CompileTimeId) {
+  static constexpr AssetId kId = AssetIdFromName("textures/a.webp");
+  static_assert(kId.hash() != 0, "AssetIdFromName must be constexpr");
+  EXPECT_TRUE(kId == AssetIdFromName(std::string("textures/a.webp")));
+  EXPECT_TRUE(kId != AssetIdFromName("textures/b.webp"));
+}
+
+// Assets can be found by name and by id, replaced, and erased.
+TEST_F(AssetTableTests, InsertFindErase) {
+  int a = 0, b = 0;
+  AssetTable<int *> table;
+  EXPECT_EQ(nullptr, table.Find("a"));
+  table.Insert("a", &a);
+  EXPECT_EQ(&a, table.Find("a"));
+  EXPECT_EQ(&a, table.Find(AssetIdFromName("a")));
+  table.Insert("a", &b);
+  EXPECT_EQ(&b, table.Find("a"));
+  EXPECT_EQ(1u, table.size());
+  EXPECT_TRUE(table.Erase("a"));
+  EXPECT_FALSE(table.Erase("a"));
+  EXPECT_EQ(nullptr, table.Find("a"));
+  EXPECT_TRUE(table.empty());
+}
+
+// Lots of inserts and erases, which grow the table and leave deleted markers
+// in it, still find every asset that is left.
+TEST_F(AssetTableTests, ManyAssets) {
+  const int kNumAssets = 1000;
+  std::vector<int> values(kNumAssets);
+  AssetTable<int *> table;
+  for (int i = 0; i < kNumAssets; ++i) {
+    table.Insert(Name("asset", i), &values[i]);
+  }
+  for (int i = 0; i < kNumAssets; i += 2) {
+    EXPECT_TRUE(table.Erase(Name("asset", i)));
+  }
+  for (int i = 0; i < kNumAssets; i += 2) {
+    table.Insert(Name("other", i), &values[i]);
+  }
+  EXPECT_EQ(static_cast<size_t>(kNumAssets), table.size());
+  for (int i = 0; i < kNumAssets; ++i) {
+    const std::string name = Name(i % 2 ? "asset" : "other", i);
+    EXPECT_EQ(&values[i], table.Find(name.c_str()));
+  }
+  size_t count = 0;
+  table.ForEach([&count](const std::string &, int *) { ++count; });
+  EXPECT_EQ(table.size(), count);
+}
+
+extern "C" int FPL_main(int argc, char *argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
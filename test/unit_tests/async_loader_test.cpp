@@ -0,0 +1,501 @@
+// Copyright 2017 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fplbase/async_loader.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+const size_t kTinyUploadSize = 4;
+
+// An asset with next to nothing to load, so that the loader's own overhead
+// dominates.
+class TinyAsset : public fplbase::AsyncAsset {
+ public:
+  TinyAsset() : AsyncAsset("tiny"), finalize_count_(0) {}
+  virtual void Load() { data_ = reinterpret_cast<const uint8_t *>("x"); }
+  virtual bool Finalize() {
+    ++finalize_count_;
+    data_ = nullptr;
+    CallFinalizeCallback();
+    return true;
+  }
+  virtual bool IsValid() { return true; }
+  virtual size_t UploadSize() const { return data_ ? kTinyUploadSize : 0; }
+  int finalize_count() const { return finalize_count_; }
+
+ private:
+  int finalize_count_;
+};
+
+// An asset that is only finalized once the assets it depends on are.
+class DependentAsset : public TinyAsset {
+ public:
+  explicit DependentAsset(const std::vector<fplbase::AsyncAsset *> &deps)
+      : deps_(deps) {}
+  virtual bool Finalize() {
+    data_ = nullptr;
+    CallFinalizeCallbackAfter(deps_);
+    return true;
+  }
+
+ private:
+  std::vector<fplbase::AsyncAsset *> deps_;
+};
+
+// An asset that keeps its decode thread busy until released.
+class BlockingAsset : public TinyAsset {
+ public:
+  BlockingAsset() : started_(false), released_(false) {}
+  virtual void Load() {
+    started_ = true;
+    while (!released_) std::this_thread::yield();
+    TinyAsset::Load();
+  }
+  bool started() const { return started_; }
+  void Release() { released_ = true; }
+
+ private:
+  std::atomic<bool> started_;
+  std::atomic<bool> released_;
+};
+
+// An asset that reads its file in Read(), which the loader may read ahead.
+class FileReadingAsset : public TinyAsset {
+ public:
+  explicit FileReadingAsset(const std::string &filename) {
+    set_filename(filename);
+  }
+  virtual const char *ReadAheadFile() const { return filename_.c_str(); }
+  virtual void Read() { file_ = LoadReadFile(filename_.c_str()); }
+  virtual void Decode() {
+    if (file_) TinyAsset::Load();
+  }
+  std::string contents() const {
+    return file_ ? std::string(reinterpret_cast<const char *>(file_->data()),
+                               file_->size())
+                 : std::string();
+  }
+
+ private:
+  fplbase::FileView file_;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+double Seconds(Clock::duration duration) {
+  return std::chrono::duration<double>(duration).count();
+}
+
+// The hand-off AsyncLoader used before the lock-free completed stack: loader
+// threads take jobs from a deque and push finished ones onto another, both
+// behind a single mutex that the main thread also takes to finalize.
+class BaselineHandOff {
+ public:
+  explicit BaselineHandOff(const std::vector<TinyAsset *> &assets)
+      : queue_(assets.begin(), assets.end()),
+        num_pending_(static_cast<int>(assets.size())) {}
+
+  void Start(int num_threads) {
+    for (int i = 0; i < num_threads; ++i) {
+      threads_.push_back(std::thread([this]() { Load(); }));
+    }
+  }
+
+  void Join() {
+    for (auto it = threads_.begin(); it != threads_.end(); ++it) it->join();
+  }
+
+  // Finalizes everything that has loaded so far, like the old TryFinalize().
+  bool TryFinalize() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (!done_.empty()) {
+      done_.front()->Finalize();
+      done_.pop_front();
+      --num_pending_;
+    }
+    return num_pending_ == 0;
+  }
+
+ private:
+  void Load() {
+    for (;;) {
+      TinyAsset *asset;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (queue_.empty()) return;
+        asset = queue_.front();
+        queue_.pop_front();
+      }
+      asset->Load();
+      std::lock_guard<std::mutex> lock(mutex_);
+      done_.push_back(asset);
+    }
+  }
+
+  std::mutex mutex_;
+  std::deque<TinyAsset *> queue_;
+  std::deque<TinyAsset *> done_;
+  int num_pending_;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace
+
+class AsyncLoaderTests : public ::testing::Test {
+ protected:
+  virtual void SetUp() {}
+  virtual void TearDown() {
+    for (auto it = assets_.begin(); it != assets_.end(); ++it) delete *it;
+    assets_.clear();
+  }
+
+  void QueueAssets(fplbase::AsyncLoader *loader, int count) {
+    for (int i = 0; i < count; ++i) {
+      assets_.push_back(new TinyAsset());
+      loader->QueueJob(assets_.back());
+    }
+  }
+
+  std::vector<TinyAsset *> assets_;
+};
+
+// Every queued asset is finalized exactly once.
+TEST_F(AsyncLoaderTests, FinalizesEveryAsset) {
+  fplbase::AsyncLoader loader;
+  loader.SetNumWorkerThreads(4);
+  QueueAssets(&loader, 1000);
+  loader.StartLoading();
+  while (!loader.TryFinalize()) {
+  }
+  loader.Stop();
+  for (auto it = assets_.begin(); it != assets_.end(); ++it) {
+    EXPECT_EQ(1, (*it)->finalize_count());
+  }
+  EXPECT_EQ(0, loader.NumPendingFinalizes());
+}
+
+// Aborting a queued asset removes it, and leaves it to the caller to delete.
+TEST_F(AsyncLoaderTests, AbortQueuedJob) {
+  fplbase::AsyncLoader loader;
+  QueueAssets(&loader, 2);
+  EXPECT_TRUE(loader.AbortJob(assets_[1]));
+  loader.StartLoading();
+  while (!loader.TryFinalize()) {
+  }
+  loader.Stop();
+  EXPECT_EQ(1, assets_[0]->finalize_count());
+  EXPECT_EQ(0, assets_[1]->finalize_count());
+}
+
+// Aborting a job that waits to be decoded makes room for the I/O threads to
+// read ahead again.
+TEST_F(AsyncLoaderTests, AbortJobWaitingForDecode) {
+  fplbase::AsyncLoader loader;
+  loader.SetNumWorkerThreads(1);
+  loader.SetNumIOThreads(1);
+  BlockingAsset *blocking = new BlockingAsset();
+  assets_.push_back(blocking);
+  loader.QueueJob(blocking);
+  QueueAssets(&loader, 4);
+  loader.StartLoading();
+  while (!blocking->started()) {
+    std::this_thread::yield();
+  }
+  // Let the I/O thread fill the decode deque up to its read-ahead limit.
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_TRUE(loader.AbortJob(assets_[2]));
+  blocking->Release();
+
+  const Clock::time_point give_up = Clock::now() + std::chrono::seconds(5);
+  bool finished = false;
+  while (!finished && Clock::now() < give_up) {
+    finished = loader.TryFinalize();
+  }
+  loader.Stop();
+  EXPECT_TRUE(finished);
+  for (size_t i = 0; i < assets_.size(); ++i) {
+    EXPECT_EQ(i == 2 ? 0 : 1, assets_[i]->finalize_count());
+  }
+}
+
+// The decode threads stop once the decoded data reaches the limit, and carry
+// on as TryFinalize() releases it.
+TEST_F(AsyncLoaderTests, MaxDecodedBytes) {
+  const int kNumThreads = 2;
+  fplbase::AsyncLoader loader;
+  loader.SetNumWorkerThreads(kNumThreads);
+  loader.SetMaxDecodedBytes(kTinyUploadSize);
+  QueueAssets(&loader, 10);
+  loader.StartLoading();
+  while (loader.DecodedBytes() == 0) {
+    std::this_thread::yield();
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  // Each decode thread may go over the limit by one asset.
+  EXPECT_TRUE(loader.DecodedBytes() <= kNumThreads * kTinyUploadSize);
+  while (!loader.TryFinalize()) {
+  }
+  loader.Stop();
+  EXPECT_EQ(0u, loader.DecodedBytes());
+  for (auto it = assets_.begin(); it != assets_.end(); ++it) {
+    EXPECT_EQ(1, (*it)->finalize_count());
+  }
+}
+
+// Continuations run once their assets are finalized, and wait() starts the
+// loader and blocks until the asset is ready.
+TEST_F(AsyncLoaderTests, HandleContinuations) {
+  fplbase::AsyncLoader loader;
+  QueueAssets(&loader, 3);
+  std::vector<fplbase::AsyncAsset *> group(assets_.begin(), assets_.end());
+  int num_all_finalized = 0;
+  fplbase::WhenAllFinalized(group, [&]() { ++num_all_finalized; });
+  fplbase::AsyncHandle<TinyAsset> handle(assets_[0], &loader);
+  TinyAsset *continued = nullptr;
+  handle.then([&](TinyAsset *asset) { continued = asset; });
+  EXPECT_FALSE(handle.ready());
+  EXPECT_EQ(0, num_all_finalized);
+
+  EXPECT_EQ(assets_[0], handle.wait());
+  EXPECT_TRUE(handle.ready());
+  EXPECT_EQ(assets_[0], continued);
+  while (!loader.TryFinalize()) {
+  }
+  loader.Stop();
+  EXPECT_EQ(1, num_all_finalized);
+
+  // Once ready, continuations run right away.
+  int num_late = 0;
+  handle.then([&](TinyAsset *) { ++num_late; });
+  fplbase::WhenAllFinalized(group, [&]() { ++num_late; });
+  EXPECT_EQ(2, num_late);
+}
+
+// Continuations added on another thread while the assets are finalized are
+// each called exactly once.
+TEST_F(AsyncLoaderTests, ContinuationsFromOtherThread) {
+  const int kNumAssets = 1000;
+  fplbase::AsyncLoader loader;
+  QueueAssets(&loader, kNumAssets);
+  std::atomic<int> num_continued(0);
+  loader.StartLoading();
+  std::thread adder([&]() {
+    for (auto it = assets_.begin(); it != assets_.end(); ++it) {
+      fplbase::AsyncHandle<TinyAsset>(*it, &loader)
+          .then([&](TinyAsset *) { ++num_continued; });
+    }
+  });
+  while (!loader.TryFinalize()) {
+  }
+  adder.join();
+  loader.Stop();
+  EXPECT_EQ(kNumAssets, num_continued);
+}
+
+// An asset that depends on others is finalized after them, and may be
+// deleted while it waits.
+TEST_F(AsyncLoaderTests, FinalizeAfterDependencies) {
+  fplbase::AsyncLoader loader;
+  QueueAssets(&loader, 2);
+  std::vector<fplbase::AsyncAsset *> deps(assets_.begin(), assets_.end());
+  DependentAsset dependent(deps);
+  DependentAsset *deleted = new DependentAsset(deps);
+  dependent.LoadNow();
+  deleted->LoadNow();
+  EXPECT_FALSE(dependent.IsFinalized());
+  delete deleted;
+
+  loader.StartLoading();
+  while (!loader.TryFinalize()) {
+  }
+  loader.Stop();
+  EXPECT_TRUE(dependent.IsFinalized());
+}
+
+// The loader records how long each stage took and how much was uploaded.
+TEST_F(AsyncLoaderTests, RecordsLoadStats) {
+  fplbase::AsyncLoader loader;
+  QueueAssets(&loader, 1);
+  loader.StartLoading();
+  while (!loader.TryFinalize()) {
+  }
+  loader.Stop();
+  const fplbase::AsyncLoadStats &stats = assets_[0]->load_stats();
+  EXPECT_TRUE(stats.queue_seconds >= 0.0);
+  EXPECT_TRUE(stats.read_seconds >= 0.0);
+  EXPECT_TRUE(stats.decode_seconds >= 0.0);
+  EXPECT_TRUE(stats.finalize_seconds >= 0.0);
+  EXPECT_EQ(kTinyUploadSize, stats.bytes_uploaded);
+}
+
+// With a read-ahead function, the I/O threads start a read for every queued
+// asset up to the read-ahead limit, rather than one read per thread, and each
+// asset is decoded once its read completes.
+TEST_F(AsyncLoaderTests, ReadsAheadOfIOThreads) {
+  const int kNumAssets = 6;
+  fplbase::AsyncLoader loader;
+  // A read-ahead limit of 8 jobs.
+  loader.SetNumWorkerThreads(4);
+  loader.SetNumIOThreads(1);
+  std::mutex mutex;
+  std::vector<fplbase::BatchReadCallback> reads;
+  loader.SetReadAheadFunction([&](const char *filename, std::string *dest,
+                                  fplbase::BatchReadCallback callback) {
+    std::lock_guard<std::mutex> lock(mutex);
+    dest->assign(filename);
+    reads.push_back(std::move(callback));
+    return true;
+  });
+  for (int i = 0; i < kNumAssets; ++i) {
+    assets_.push_back(new FileReadingAsset("ahead" + std::to_string(i)));
+    loader.QueueJob(assets_.back());
+  }
+  loader.StartLoading();
+
+  // None of the reads complete until all of them have started.
+  const Clock::time_point give_up = Clock::now() + std::chrono::seconds(5);
+  size_t num_reads = 0;
+  while (num_reads < kNumAssets && Clock::now() < give_up) {
+    std::this_thread::yield();
+    std::lock_guard<std::mutex> lock(mutex);
+    num_reads = reads.size();
+  }
+  EXPECT_EQ(static_cast<size_t>(kNumAssets), num_reads);
+  EXPECT_TRUE(num_reads > static_cast<size_t>(loader.num_io_threads()));
+
+  // An asset that is being read ahead is left to the loader to delete.
+  EXPECT_FALSE(loader.AbortJob(assets_[0]));
+  assets_.erase(assets_.begin());
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = reads.begin(); it != reads.end(); ++it) (*it)(true);
+  }
+  while (!loader.TryFinalize()) {
+  }
+  loader.Stop();
+  for (size_t i = 0; i < assets_.size(); ++i) {
+    FileReadingAsset *asset = static_cast<FileReadingAsset *>(assets_[i]);
+    EXPECT_EQ(1, asset->finalize_count());
+    EXPECT_EQ(asset->filename(), asset->contents());
+  }
+}
+
+// Assets get the files a BatchFileReader read ahead for them.
+TEST_F(AsyncLoaderTests, ReadsAheadWithBatchFileReader) {
+  const int kNumAssets = 20;
+  fplbase::BatchFileReader reader;
+  reader.Start();
+  fplbase::AsyncLoader loader;
+  loader.SetBatchFileReader(&reader);
+  for (int i = 0; i < kNumAssets; ++i) {
+    const std::string filename =
+        "async_loader_test_" + std::to_string(i) + ".bin";
+    FILE *file = fopen(filename.c_str(), "wb");
+    ASSERT_TRUE(file != nullptr);
+    fputs(filename.c_str(), file);
+    fclose(file);
+    assets_.push_back(new FileReadingAsset(filename));
+    loader.QueueJob(assets_.back());
+  }
+  loader.StartLoading();
+  while (!loader.TryFinalize()) {
+  }
+  loader.Stop();
+  for (auto it = assets_.begin(); it != assets_.end(); ++it) {
+    FileReadingAsset *asset = static_cast<FileReadingAsset *>(*it);
+    EXPECT_EQ(1, asset->finalize_count());
+    EXPECT_EQ(asset->filename(), asset->contents());
+    remove(asset->filename().c_str());
+  }
+}
+
+// Micro-benchmark of the hand-off between many loader threads and the main
+// thread, against the old mutex-and-deque hand-off. Reports how long each
+// takes to finalize lots of tiny assets, and the longest the main thread
+// spent in a single TryFinalize() call.
+TEST_F(AsyncLoaderTests, FinalizeContention) {
+  const int kNumAssets = 20000;
+  const int kNumThreads = 8;
+
+  fplbase::AsyncLoader loader;
+  loader.SetNumWorkerThreads(kNumThreads);
+  loader.SetNumIOThreads(kNumThreads);
+  QueueAssets(&loader, kNumAssets);
+
+  const Clock::time_point start = Clock::now();
+  loader.StartLoading();
+  Clock::duration longest_call = Clock::duration::zero();
+  int num_calls = 0;
+  for (;;) {
+    const Clock::time_point call_start = Clock::now();
+    const bool finished = loader.TryFinalize();
+    longest_call = std::max(longest_call, Clock::now() - call_start);
+    ++num_calls;
+    if (finished) break;
+  }
+  const double total = Seconds(Clock::now() - start);
+  loader.Stop();
+
+  std::vector<TinyAsset *> baseline_assets;
+  for (int i = 0; i < kNumAssets; ++i) {
+    baseline_assets.push_back(new TinyAsset());
+  }
+  BaselineHandOff baseline(baseline_assets);
+  const Clock::time_point baseline_start = Clock::now();
+  baseline.Start(kNumThreads);
+  Clock::duration baseline_longest_call = Clock::duration::zero();
+  int baseline_num_calls = 0;
+  for (;;) {
+    const Clock::time_point call_start = Clock::now();
+    const bool finished = baseline.TryFinalize();
+    baseline_longest_call =
+        std::max(baseline_longest_call, Clock::now() - call_start);
+    ++baseline_num_calls;
+    if (finished) break;
+  }
+  const double baseline_total = Seconds(Clock::now() - baseline_start);
+  baseline.Join();
+
+  printf("%d assets, %d threads: %.2f ms total, %d TryFinalize calls, "
+         "longest %.3f ms\n",
+         kNumAssets, kNumThreads, total * 1000.0, num_calls,
+         Seconds(longest_call) * 1000.0);
+  printf("Mutex hand-off baseline: %.2f ms total, %d TryFinalize calls, "
+         "longest %.3f ms\n",
+         baseline_total * 1000.0, baseline_num_calls,
+         Seconds(baseline_longest_call) * 1000.0);
+  for (auto it = assets_.begin(); it != assets_.end(); ++it) {
+    EXPECT_EQ(1, (*it)->finalize_count());
+  }
+  for (auto it = baseline_assets.begin(); it != baseline_assets.end(); ++it) {
+    EXPECT_EQ(1, (*it)->finalize_count());
+    delete *it;
+  }
+}
+
+extern "C" int FPL_main(int argc, char *argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
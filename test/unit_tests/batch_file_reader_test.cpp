@@ -0,0 +1,129 @@
+// Copyright 2017 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fplbase/batch_file_reader.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+const int kNumFiles = 8;
+
+std::string TestFileName(int i) {
+  return "batch_file_reader_test_" + std::to_string(i) + ".bin";
+}
+
+// Files of different sizes, most of them a few chunks long and none a whole
+// number of chunks.
+std::string TestFileContents(int i) {
+  std::string contents(i * 300 * 1024 + 1000 + i, 0);
+  for (size_t j = 0; j < contents.size(); ++j) {
+    contents[j] = static_cast<char>((j * 31 + i) & 0xff);
+  }
+  return contents;
+}
+
+}  // namespace
+
+class BatchFileReaderTests : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    for (int i = 0; i < kNumFiles; ++i) {
+      const std::string contents = TestFileContents(i);
+      FILE *file = fopen(TestFileName(i).c_str(), "wb");
+      ASSERT_TRUE(file != nullptr);
+      fwrite(contents.c_str(), 1, contents.size(), file);
+      fclose(file);
+    }
+  }
+  virtual void TearDown() {
+    for (int i = 0; i < kNumFiles; ++i) remove(TestFileName(i).c_str());
+  }
+
+  // Reads every file from several threads at once.
+  void ReadFromThreads(fplbase::BatchFileReader *reader) {
+    std::vector<std::string> contents(kNumFiles);
+    std::vector<int> results(kNumFiles, 0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kNumFiles; ++i) {
+      threads.push_back(std::thread([&, i]() {
+        results[i] = reader->LoadFile(TestFileName(i).c_str(), &contents[i]);
+      }));
+    }
+    for (auto it = threads.begin(); it != threads.end(); ++it) it->join();
+    for (int i = 0; i < kNumFiles; ++i) {
+      EXPECT_TRUE(results[i] != 0);
+      EXPECT_TRUE(contents[i] == TestFileContents(i));
+    }
+  }
+};
+
+// Whichever backend Start() picks reads the files correctly.
+TEST_F(BatchFileReaderTests, ReadsFiles) {
+  fplbase::BatchFileReader reader;
+  reader.Start();
+  ReadFromThreads(&reader);
+  std::string missing;
+  EXPECT_FALSE(reader.LoadFile("batch_file_reader_test_missing.bin", &missing));
+}
+
+// The thread pool works where io_uring would have been used.
+TEST_F(BatchFileReaderTests, ReadsFilesWithThreadPool) {
+  fplbase::BatchFileReader reader;
+  if (!reader.Start(4, false)) return;
+  EXPECT_EQ(fplbase::BatchFileReader::kBackendThreadPool, reader.backend());
+  ReadFromThreads(&reader);
+}
+
+// Once mounted, LoadFile() reads through the reader, and reads still work
+// after the reader stops.
+TEST_F(BatchFileReaderTests, MountAndStop) {
+  fplbase::BatchFileReader reader;
+  reader.Start();
+  reader.Mount();
+  std::string contents;
+  EXPECT_TRUE(fplbase::LoadFile(TestFileName(1).c_str(), &contents));
+  EXPECT_TRUE(contents == TestFileContents(1));
+  reader.Stop();
+  EXPECT_EQ(fplbase::BatchFileReader::kBackendNone, reader.backend());
+  contents.clear();
+  EXPECT_TRUE(fplbase::LoadFile(TestFileName(2).c_str(), &contents));
+  EXPECT_TRUE(contents == TestFileContents(2));
+  reader.Unmount();
+}
+
+// Files missing from the file index are not looked for.
+TEST_F(BatchFileReaderTests, ConsultsFileIndex) {
+  std::unique_ptr<fplbase::FileIndex> index(new fplbase::FileIndex());
+  index->AddRoot(".");
+  index->AddFile(TestFileName(1).c_str());
+  fplbase::SetFileIndex(std::move(index));
+  fplbase::BatchFileReader reader;
+  reader.Start();
+  std::string contents;
+  EXPECT_TRUE(reader.LoadFile(TestFileName(1).c_str(), &contents));
+  EXPECT_FALSE(reader.LoadFile(TestFileName(2).c_str(), &contents));
+  fplbase::SetFileIndex(nullptr);
+  EXPECT_TRUE(reader.LoadFile(TestFileName(2).c_str(), &contents));
+}
+
+extern "C" int FPL_main(int argc, char *argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
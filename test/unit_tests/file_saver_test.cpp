@@ -0,0 +1,82 @@
+// Copyright 2017 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "fplbase/file_utilities.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+const char kSaveFileName[] = "file_saver_test.bin";
+const char kOtherFileName[] = "file_saver_test_other.bin";
+
+}  // namespace
+
+class FileSaverTests : public ::testing::Test {
+ protected:
+  virtual void SetUp() {}
+  virtual void TearDown() {
+    remove(kSaveFileName);
+    remove(kOtherFileName);
+  }
+};
+
+// The file is replaced in one go, and no temporary file is left behind.
+TEST_F(FileSaverTests, SaveAtomic) {
+  EXPECT_TRUE(fplbase::SaveFileAtomic(kSaveFileName, "old", 3));
+  EXPECT_TRUE(fplbase::SaveFileAtomic(kSaveFileName, "new!", 4));
+  std::string contents;
+  EXPECT_TRUE(fplbase::LoadFileRaw(kSaveFileName, &contents));
+  EXPECT_TRUE(contents == "new!");
+  EXPECT_FALSE(fplbase::FileExistsRaw(
+      (std::string(kSaveFileName) + ".tmp").c_str()));
+}
+
+// Saves to the same file are coalesced, and the last one wins.
+TEST_F(FileSaverTests, SaveAsync) {
+  std::vector<fplbase::FileSaveHandle> saves;
+  for (int i = 0; i < 100; ++i) {
+    saves.push_back(fplbase::SaveFileAsync(kSaveFileName, std::to_string(i)));
+  }
+  fplbase::FileSaveHandle other =
+      fplbase::SaveFileAsync(kOtherFileName, "other", 5);
+  fplbase::FlushFileSaves();
+  for (auto it = saves.begin(); it != saves.end(); ++it) {
+    EXPECT_TRUE((*it)->done());
+    EXPECT_TRUE((*it)->success());
+  }
+  EXPECT_TRUE(other->Wait());
+
+  std::string contents;
+  EXPECT_TRUE(fplbase::LoadFileRaw(kSaveFileName, &contents));
+  EXPECT_TRUE(contents == "99");
+  EXPECT_TRUE(fplbase::LoadFileRaw(kOtherFileName, &contents));
+  EXPECT_TRUE(contents == "other");
+}
+
+// A save that can't be written reports it.
+TEST_F(FileSaverTests, SaveAsyncFails) {
+  fplbase::FileSaveHandle save =
+      fplbase::SaveFileAsync("file_saver_test_missing_dir/file.bin", "x", 1);
+  EXPECT_FALSE(save->Wait());
+  EXPECT_TRUE(save->done());
+}
+
+extern "C" int FPL_main(int argc, char *argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,123 @@
+// Copyright 2017 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <memory>
+#include <string>
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+#include "fplbase/file_utilities.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+const char kIndexedFileName[] = "file_utilities_test_indexed.bin";
+const char kUnindexedFileName[] = "file_utilities_test_unindexed.bin";
+
+void WriteTestFile(const char *filename) {
+  FILE *file = fopen(filename, "wb");
+  ASSERT_TRUE(file != nullptr);
+  fputs(filename, file);
+  fclose(file);
+}
+
+}  // namespace
+
+class FileUtilitiesTests : public ::testing::Test {
+ protected:
+  virtual void SetUp() {}
+  virtual void TearDown() {
+    fplbase::SetFileIndex(nullptr);
+    remove(kIndexedFileName);
+    remove(kUnindexedFileName);
+  }
+};
+
+// Different ways of writing the same name find the same file.
+TEST_F(FileUtilitiesTests, FileIndexNormalizesNames) {
+  fplbase::FileIndex index;
+  index.AddFile("assets/textures/a.webp");
+  EXPECT_TRUE(index.Contains("assets/textures/a.webp"));
+  EXPECT_TRUE(index.Contains("./assets/textures/a.webp"));
+  EXPECT_TRUE(index.Contains("assets//textures/./a.webp"));
+  EXPECT_TRUE(index.Contains("assets\\textures\\a.webp"));
+  EXPECT_FALSE(index.Contains("assets/textures/b.webp"));
+  EXPECT_EQ(1u, index.size());
+}
+
+// The index only rules out files under the directories it was given, and
+// leaves names it can't resolve to the file system.
+TEST_F(FileUtilitiesTests, FileIndexOnlyAnswersForItsRoots) {
+  fplbase::FileIndex index;
+  index.AddRoot("assets/");
+  index.AddFile("assets/a.bin");
+  EXPECT_TRUE(index.MayExist("assets/a.bin"));
+  EXPECT_FALSE(index.MayExist("assets/b.bin"));
+  EXPECT_FALSE(index.MayExist(".//assets/sub/b.bin"));
+  EXPECT_TRUE(index.MayExist("other/b.bin"));
+  EXPECT_TRUE(index.MayExist("/assets/b.bin"));
+  EXPECT_TRUE(index.MayExist("../assets/b.bin"));
+  EXPECT_TRUE(index.MayExist("assets/sub/../b.bin"));
+
+  index.AddRoot(".");
+  EXPECT_FALSE(index.MayExist("other/b.bin"));
+  EXPECT_TRUE(index.MayExist("/other/b.bin"));
+  EXPECT_TRUE(index.MayExist("../other/b.bin"));
+}
+
+// Files missing from the file index are not looked for by the raw file
+// functions, unless they are named in a way the index doesn't cover.
+TEST_F(FileUtilitiesTests, RawFunctionsConsultFileIndex) {
+  WriteTestFile(kIndexedFileName);
+  std::unique_ptr<fplbase::FileIndex> index(new fplbase::FileIndex());
+  EXPECT_TRUE(index->AddDirectory("."));
+  EXPECT_TRUE(index->Contains(kIndexedFileName));
+  fplbase::SetFileIndex(std::move(index));
+  WriteTestFile(kUnindexedFileName);
+
+  std::string contents;
+  EXPECT_TRUE(fplbase::FileExistsRaw(kIndexedFileName));
+  EXPECT_TRUE(
+      fplbase::FileExistsRaw((std::string("./") + kIndexedFileName).c_str()));
+  EXPECT_TRUE(fplbase::LoadFileRaw(kIndexedFileName, &contents));
+  EXPECT_FALSE(fplbase::FileExistsRaw(kUnindexedFileName));
+  EXPECT_FALSE(fplbase::LoadFileRaw(kUnindexedFileName, &contents));
+
+#if !defined(_WIN32)
+  char cwd[4096];
+  ASSERT_TRUE(getcwd(cwd, sizeof(cwd)) != nullptr);
+  const std::string dir = cwd;
+  const std::string dir_name = dir.substr(dir.find_last_of('/') + 1);
+  EXPECT_TRUE(fplbase::FileExistsRaw(
+      (dir + "/" + kUnindexedFileName).c_str()));
+  EXPECT_TRUE(fplbase::FileExistsRaw(
+      ("../" + dir_name + "/" + kUnindexedFileName).c_str()));
+#endif
+
+  // Saved files are added to the index.
+  EXPECT_TRUE(fplbase::SaveFile(kUnindexedFileName, std::string("saved")));
+  EXPECT_TRUE(fplbase::LoadFileRaw(kUnindexedFileName, &contents));
+  EXPECT_TRUE(contents == "saved");
+
+  fplbase::SetFileIndex(nullptr);
+  EXPECT_TRUE(fplbase::FileExistsRaw(kUnindexedFileName));
+}
+
+extern "C" int FPL_main(int argc, char *argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,163 @@
+// Copyright 2017 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "fplbase/internal/image_kernels.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Every combination of color and alpha, with a few more pixels so that the
+// SIMD kernels also finish with a partial block.
+std::vector<uint8_t> AllColorsAndAlphas() {
+  std::vector<uint8_t> rgba;
+  for (int a = 0; a < 256; ++a) {
+    for (int c = 0; c < 256; ++c) {
+      const uint8_t pixel[] = {static_cast<uint8_t>(c),
+                               static_cast<uint8_t>(255 - c),
+                               static_cast<uint8_t>(c ^ 0x5a),
+                               static_cast<uint8_t>(a)};
+      rgba.insert(rgba.end(), pixel, pixel + 4);
+    }
+  }
+  for (int i = 0; i < 7 * 4; ++i) rgba.push_back(static_cast<uint8_t>(i * 9));
+  return rgba;
+}
+
+// Megapixels per second that `function` premultiplies.
+double PremultiplyThroughput(void (*function)(uint8_t *, size_t)) {
+  const size_t kNumPixels = 2048 * 2048;
+  const int kIterations = 20;
+  std::vector<uint8_t> rgba(kNumPixels * 4);
+  for (size_t i = 0; i < rgba.size(); ++i) {
+    rgba[i] = static_cast<uint8_t>(i * 7);
+  }
+  const Clock::time_point start = Clock::now();
+  for (int i = 0; i < kIterations; ++i) function(&rgba[0], kNumPixels);
+  const double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  return kNumPixels * kIterations / seconds / 1e6;
+}
+
+// Converts `width` x `height` pixels of `channels` bytes each with `convert`
+// and its reference, both into a separate buffer and in place, and checks
+// that all four agree.
+bool ConversionMatchesReference(
+    int width, int height, int channels, bool dither,
+    void (*convert)(const uint8_t *, int, int, bool, uint16_t *),
+    void (*reference)(const uint8_t *, int, int, bool, uint16_t *)) {
+  const size_t num_pixels = static_cast<size_t>(width) * height;
+  std::vector<uint8_t> src(num_pixels * channels);
+  for (size_t i = 0; i < src.size(); ++i) {
+    src[i] = static_cast<uint8_t>(i * 37 + (i >> 8));
+  }
+  std::vector<uint16_t> expected(num_pixels);
+  std::vector<uint16_t> actual(num_pixels);
+  reference(&src[0], width, height, dither, &expected[0]);
+  convert(&src[0], width, height, dither, &actual[0]);
+  if (expected != actual) return false;
+
+  // In place, with the buffer sized exactly, so that reads past the end show
+  // up under a memory checker.
+  std::vector<uint8_t> in_place = src;
+  uint16_t *dest = reinterpret_cast<uint16_t *>(&in_place[0]);
+  convert(&in_place[0], width, height, dither, dest);
+  return std::equal(expected.begin(), expected.end(), dest);
+}
+
+}  // namespace
+
+class ImageKernelsTests : public ::testing::Test {
+ protected:
+  virtual void SetUp() {}
+  virtual void TearDown() {}
+};
+
+// The reference rounds c * a / 255 to the nearest integer.
+TEST_F(ImageKernelsTests, PremultiplyChannelRounds) {
+  for (int a = 0; a < 256; ++a) {
+    for (int c = 0; c < 256; ++c) {
+      const int expected = static_cast<int>(floor(c * a / 255.0 + 0.5));
+      EXPECT_EQ(expected, fplbase::PremultiplyChannel(
+                              static_cast<uint8_t>(c), static_cast<uint8_t>(a)));
+    }
+  }
+}
+
+// The kernel picked for this CPU matches the reference bit for bit.
+TEST_F(ImageKernelsTests, MultiplyRgbByAlphaMatchesReference) {
+  std::vector<uint8_t> expected = AllColorsAndAlphas();
+  std::vector<uint8_t> actual = expected;
+  const size_t num_pixels = expected.size() / 4;
+  fplbase::MultiplyRgbByAlphaReference(&expected[0], num_pixels);
+  fplbase::MultiplyRgbByAlpha(&actual[0], num_pixels);
+  EXPECT_TRUE(expected == actual);
+}
+
+// The conversions to 16 bits match the reference, for widths that do and
+// don't fill whole SIMD blocks.
+TEST_F(ImageKernelsTests, ConvertTo16BitMatchesReference) {
+  const int kWidths[] = {1, 7, 8, 9, 31, 64, 257};
+  for (size_t i = 0; i < sizeof(kWidths) / sizeof(kWidths[0]); ++i) {
+    for (int dither = 0; dither < 2; ++dither) {
+      EXPECT_TRUE(ConversionMatchesReference(
+          kWidths[i], 13, 4, dither != 0, fplbase::ConvertRgba8888ToRgba5551,
+          fplbase::ConvertRgba8888ToRgba5551Reference));
+      EXPECT_TRUE(ConversionMatchesReference(
+          kWidths[i], 13, 3, dither != 0, fplbase::ConvertRgb888ToRgb565,
+          fplbase::ConvertRgb888ToRgb565Reference));
+    }
+  }
+}
+
+// Without dither the conversions truncate each channel; with it, a flat
+// color that falls between two 16-bit values comes out as a mix of both.
+TEST_F(ImageKernelsTests, ConvertTo16BitDithers) {
+  const uint8_t rgb[8 * 3] = {0x84, 0x82, 0x84, 0x84, 0x82, 0x84,
+                              0x84, 0x82, 0x84, 0x84, 0x82, 0x84,
+                              0x84, 0x82, 0x84, 0x84, 0x82, 0x84,
+                              0x84, 0x82, 0x84, 0x84, 0x82, 0x84};
+  uint16_t plain[8];
+  uint16_t dithered[8];
+  fplbase::ConvertRgb888ToRgb565(rgb, 4, 2, false, plain);
+  fplbase::ConvertRgb888ToRgb565(rgb, 4, 2, true, dithered);
+  const uint16_t truncated = (0x10 << 11) | (0x20 << 5) | 0x10;
+  int rounded_up = 0;
+  for (int i = 0; i < 8; ++i) {
+    EXPECT_EQ(truncated, plain[i]);
+    if (dithered[i] != truncated) ++rounded_up;
+  }
+  EXPECT_TRUE(rounded_up > 0 && rounded_up < 8);
+}
+
+// Reports the throughput of the reference and of the kernel for this CPU.
+TEST_F(ImageKernelsTests, MultiplyRgbByAlphaThroughput) {
+  const double reference =
+      PremultiplyThroughput(fplbase::MultiplyRgbByAlphaReference);
+  const double fastest = PremultiplyThroughput(fplbase::MultiplyRgbByAlpha);
+  printf("MultiplyRgbByAlpha: scalar %.0f MP/s, %s %.0f MP/s\n", reference,
+         fplbase::ImageKernelsInstructionSet(), fastest);
+}
+
+extern "C" int FPL_main(int argc, char *argv[]) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -36,6 +36,17 @@ class MeshTests : public ::testing::Test {
   virtual void TearDown() {}
 };
 
+// Untextured surfaces of mesh files use a Material built in code, which a
+// mesh waits for before it counts as finalized.
+TEST_F(MeshTests, UntexturedMaterialIsFinalized) {
+  Material material;
+  EXPECT_TRUE(material.IsFinalized());
+  bool finalized = false;
+  WhenAllFinalized(std::vector<AsyncAsset *>(1, &material),
+                   [&finalized]() { finalized = true; });
+  EXPECT_TRUE(finalized);
+}
+
 TEST_F(MeshTests, IsValidFormat) {
   EXPECT_TRUE(Mesh::IsValidFormat(kP));
   EXPECT_TRUE(Mesh::IsValidFormat(kPN));